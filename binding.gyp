@@ -45,9 +45,13 @@
       ],
       "sources": [
         "src/backup.cc",
+        "src/cancellation.cc",
         "src/database.cc",
+        "src/executor.cc",
+        "src/json.cc",
         "src/marshal.cc",
         "src/node_sqlite3.cc",
+        "src/session.cc",
         "src/statement.cc"
       ],
       "defines": [ "NAPI_VERSION=<(napi_build_version)", "NAPI_DISABLE_CPP_EXCEPTIONS=1" ]
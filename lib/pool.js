@@ -0,0 +1,210 @@
+var util = require('util');
+var EventEmitter = require('events').EventEmitter;
+var sqlite3 = require('./sqlite3');
+
+// Pool(filename, [options], [callback])
+//
+// One writer connection plus `options.readers` read-only connections to the
+// same file. Queries that don't modify the database are sent to a reader
+// when that can't change what they see: the database must be in WAL mode,
+// and the writer must be idle and outside of a transaction, so that reads
+// always observe earlier writes made through the pool. Everything else runs
+// on the writer.
+//
+// Whether a query is read-only is remembered for the last
+// `options.readonlyCache` (default 256) distinct SQL strings.
+function Pool(filename, options, callback) {
+    if (typeof options === 'function') {
+        callback = options;
+        options = {};
+    }
+    options = options || {};
+    if (filename === '' || filename === ':memory:') {
+        throw new TypeError('Pool requires a database file');
+    }
+
+    EventEmitter.call(this);
+    this.filename = filename;
+    this.readers = [];
+    this.wal = false;
+    this.open = false;
+    this._next = 0;
+    this._readonly = new Map();
+    this._readonlySize = options.readonlyCache === undefined ?
+        256 : options.readonlyCache;
+    this._configuration = [];
+
+    var pool = this;
+    var count = options.readers === undefined ? 2 : options.readers;
+    var mode = options.mode ||
+        (sqlite3.OPEN_READWRITE | sqlite3.OPEN_CREATE | sqlite3.OPEN_FULLMUTEX);
+    var readerMode = sqlite3.OPEN_READONLY | sqlite3.OPEN_FULLMUTEX |
+        (mode & sqlite3.OPEN_URI);
+
+    function opened(err) {
+        if (err) {
+            if (typeof callback === 'function') callback.call(pool, err);
+            else pool.emit('error', err);
+            return;
+        }
+        pool.open = true;
+        if (typeof callback === 'function') callback.call(pool, null);
+        pool.emit('open');
+    }
+
+    this.writer = new sqlite3.Database(filename, mode, function(err) {
+        if (err) return opened(err);
+        pool.writer.get('PRAGMA journal_mode', function(err, row) {
+            if (err) return opened(err);
+            // Readers only help in WAL mode; otherwise they'd block writes.
+            pool.wal = String(row.journal_mode).toLowerCase() === 'wal';
+            if (!pool.wal || !count) return opened(null);
+
+            var remaining = count;
+            var failed = false;
+            for (var i = 0; i < count; i++) {
+                var reader = new sqlite3.Database(filename, readerMode, function(err) {
+                    if (failed) return;
+                    if (err) {
+                        failed = true;
+                        return opened(err);
+                    }
+                    if (--remaining === 0) {
+                        pool._configuration.forEach(function(args) {
+                            pool.readers.forEach(function(reader) {
+                                reader.configure.apply(reader, args);
+                            });
+                        });
+                        opened(null);
+                    }
+                });
+                pool.readers.push(reader);
+            }
+        });
+    });
+}
+util.inherits(Pool, EventEmitter);
+
+// Returns true or false once `sql` has been classified, undefined before.
+// Recently used entries are kept; the oldest is dropped when the cache is
+// full.
+Pool.prototype._isReadonly = function(sql) {
+    var readonly = this._readonly.get(sql);
+    if (readonly !== undefined) {
+        this._readonly.delete(sql);
+        this._readonly.set(sql, readonly);
+    }
+    return readonly;
+};
+
+Pool.prototype._classify = function(sql, readonly) {
+    if (!this._readonlySize) return;
+    this._readonly.delete(sql);
+    this._readonly.set(sql, readonly);
+    if (this._readonly.size > this._readonlySize) {
+        this._readonly.delete(this._readonly.keys().next().value);
+    }
+};
+
+// Picks the connection a read of `sql` may go to, or null for the writer.
+Pool.prototype._reader = function(sql) {
+    if (!this.open || !this.readers.length || this._isReadonly(sql) === false) {
+        return null;
+    }
+    if (!this.writer.idle || this.writer.inTransaction) {
+        return null;
+    }
+    for (var i = 0; i < this.readers.length; i++) {
+        if (this.readers[i].idle) return this.readers[i];
+    }
+    this._next = (this._next + 1) % this.readers.length;
+    return this.readers[this._next];
+};
+
+// Pool#get, #all, #each, #map, #allMarshal, #allJSON, #allNDJSON
+// (sql, [bind1, bind2, ...], [callback])
+['get', 'all', 'each', 'map', 'allMarshal', 'allJSON', 'allNDJSON'].forEach(function(name) {
+    Pool.prototype[name] = function(sql) {
+        var pool = this;
+        var args = arguments;
+        var reader = this._reader(sql);
+
+        if (!reader) {
+            this.writer[name].apply(this.writer, args);
+        }
+        else if (this._readonly.get(sql)) {
+            reader[name].apply(reader, args);
+        }
+        else {
+            // First time we see this query: prepare it on the reader to find
+            // out whether it is read-only, and send it to the writer if not.
+            var params = Array.prototype.slice.call(args, 1);
+            var statement = new sqlite3.Statement(reader, sql, function(err) {
+                if (err || !statement.readonly) {
+                    if (!err) pool._classify(sql, false);
+                    statement.finalize();
+                    pool.writer[name].apply(pool.writer, args);
+                    return;
+                }
+                pool._classify(sql, true);
+                statement[name].apply(statement, params).finalize();
+            });
+        }
+        return this;
+    };
+});
+
+// Pool#run, #exec, #transaction, #snapshot, #prepare and #loadExtension
+// always use the writer. Snapshots can be opened on pool.readers.
+['run', 'exec', 'transaction', 'snapshot', 'loadExtension'].forEach(function(name) {
+    Pool.prototype[name] = function() {
+        this.writer[name].apply(this.writer, arguments);
+        return this;
+    };
+});
+
+Pool.prototype.prepare = function() {
+    return this.writer.prepare.apply(this.writer, arguments);
+};
+
+Pool.prototype.serialize = function(callback) {
+    this.writer.serialize(callback);
+    return this;
+};
+
+Pool.prototype.parallelize = function(callback) {
+    this.writer.parallelize(callback);
+    return this;
+};
+
+// Pool#configure(option, value) applies to every connection in the pool.
+Pool.prototype.configure = function() {
+    this.writer.configure.apply(this.writer, arguments);
+    var args = arguments;
+    this.readers.forEach(function(reader) {
+        reader.configure.apply(reader, args);
+    });
+    if (!this.readers.length) this._configuration.push(args);
+    return this;
+};
+
+// Pool#close([callback])
+Pool.prototype.close = function(callback) {
+    var pool = this;
+    var connections = this.readers.concat(this.writer);
+    var remaining = connections.length;
+    var error = null;
+    this.open = false;
+    connections.forEach(function(db) {
+        db.close(function(err) {
+            if (err && !error) error = err;
+            if (--remaining) return;
+            if (typeof callback === 'function') callback.call(pool, error);
+            else if (error) pool.emit('error', error);
+            if (!error) pool.emit('close');
+        });
+    });
+    return this;
+};
+
+module.exports = Pool;
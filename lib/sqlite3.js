@@ -7,8 +7,10 @@ function normalizeMethod (fn) {
     return function (sql) {
         var errBack;
         var args = Array.prototype.slice.call(arguments, 1);
-        if (typeof args[args.length - 1] === 'function') {
-            var callback = args[args.length - 1];
+        var last = args[args.length - 1] instanceof Cancellation ?
+            args.length - 2 : args.length - 1;
+        if (typeof args[last] === 'function') {
+            var callback = args[last];
             errBack = function(err) {
                 if (err) {
                     callback(err);
@@ -20,16 +22,196 @@ function normalizeMethod (fn) {
     };
 }
 
+// Like normalizeMethod, but takes the statement from the database's
+// statement cache when one is configured. A cached statement that is still
+// busy with an earlier call is left alone and a fresh one is used instead.
+function cachedMethod(name) {
+    var uncached = normalizeMethod(function(statement, params) {
+        statement[name].apply(statement, params).finalize();
+        return this;
+    });
+
+    return function(sql) {
+        var cache = this._statementCache;
+        if (!cache || !cache.size || typeof sql !== 'string') {
+            return uncached.apply(this, arguments);
+        }
+
+        var params = Array.prototype.slice.call(arguments, 1);
+        var cancellation = params[params.length - 1] instanceof Cancellation ?
+            params.pop() : null;
+        var callback, complete;
+        if (name === 'each') {
+            if (typeof params[params.length - 1] !== 'function') {
+                return uncached.apply(this, arguments);
+            }
+            if (typeof params[params.length - 2] === 'function') {
+                complete = params.pop();
+            }
+        }
+        else if (typeof params[params.length - 1] === 'function') {
+            callback = params.pop();
+        }
+        var errorCallback = complete || callback || params[params.length - 1];
+
+        // Calling without parameters would silently reuse the last bindings.
+        var unbound = bindsNothing(params);
+        var statement = cache.get(sql);
+        if (statement && statement._bound && unbound) {
+            statement = null;
+        }
+        if (!statement) {
+            statement = new Statement(this, sql, function(err) {
+                if (err) {
+                    if (typeof errorCallback === 'function') errorCallback.call(this, err);
+                    else this.emit('error', err);
+                }
+                else if (!cache.add(sql, statement)) {
+                    statement.finalize();
+                }
+            }, true);
+        }
+        statement._busy = true;
+        statement._bound = !unbound;
+
+        if (name === 'each') {
+            params.push(function() {
+                statement._busy = false;
+                if (complete) return complete.apply(this, arguments);
+            });
+        }
+        else {
+            params.push(function(err) {
+                statement._busy = false;
+                if (callback) return callback.apply(this, arguments);
+                if (err) this.emit('error', err);
+            });
+        }
+        if (cancellation) params.push(cancellation);
+        statement[name].apply(statement, params);
+        if (name === 'get') {
+            // Don't leave the statement in the middle of its result.
+            statement.reset();
+        }
+        return this;
+    };
+}
+
+function bindsNothing(params) {
+    if (!params.length) return true;
+    var first = params[0];
+    return params.length === 1 && first !== null && typeof first === 'object' &&
+        !Buffer.isBuffer(first) && !(first instanceof Date) &&
+        !(first instanceof RegExp) && Object.keys(first).length === 0;
+}
+
+// Prepared statements kept by a Database for reuse, least recently used
+// first. See Database#configure('statementCache', size).
+function StatementCache() {
+    this.size = 0;
+    this.statements = new Map();
+}
+
+StatementCache.prototype.get = function(sql) {
+    var statement = this.statements.get(sql);
+    if (!statement || statement._busy) return null;
+    this.statements.delete(sql);
+    this.statements.set(sql, statement);
+    return statement;
+};
+
+StatementCache.prototype.add = function(sql, statement) {
+    if (!this.size || this.statements.has(sql)) return false;
+    this.statements.set(sql, statement);
+    this.trim(this.size);
+    return true;
+};
+
+// Finalizing a busy statement is fine; it happens after its pending calls.
+StatementCache.prototype.trim = function(size) {
+    var keys = this.statements.keys();
+    while (this.statements.size > size) {
+        var sql = keys.next().value;
+        var statement = this.statements.get(sql);
+        this.statements.delete(sql);
+        statement.finalize();
+    }
+};
+
+// Writes collected by a Database to be committed together. See
+// Database#configure('groupCommit', window).
+function GroupCommit(db) {
+    this.db = db;
+    this.window = 0;
+    this.size = 64;
+    this.operations = [];
+    this.callbacks = [];
+    this.timer = null;
+}
+
+// Only plain data changes are grouped; anything that controls transactions
+// or can't run inside one goes through on its own.
+GroupCommit.prototype.accepts = function(sql) {
+    return this.window > 0 && typeof sql === 'string' &&
+        /^\s*(INSERT|UPDATE|DELETE|REPLACE)\b/i.test(sql);
+};
+
+GroupCommit.prototype.add = function(sql, params, callback) {
+    this.operations.push({ sql: sql, params: params });
+    this.callbacks.push(callback);
+    if (this.operations.length >= this.size) {
+        this.flush();
+    }
+    else if (!this.timer) {
+        this.timer = setTimeout(this.flush.bind(this), this.window);
+    }
+};
+
+// Queues the collected writes as one transaction, each in its own savepoint
+// so that a failing write doesn't take the others with it.
+GroupCommit.prototype.flush = function() {
+    if (this.timer) {
+        clearTimeout(this.timer);
+        this.timer = null;
+    }
+    if (!this.operations.length) return;
+
+    var db = this.db;
+    var operations = this.operations;
+    var callbacks = this.callbacks;
+    this.operations = [];
+    this.callbacks = [];
+
+    transaction.call(db, operations, { isolate: true }, function(err, results) {
+        var emitted = false;
+        callbacks.forEach(function(callback, i) {
+            var result = err ? { error: err } : results[i];
+            var error = result.error || null;
+            if (typeof callback === 'function') {
+                callback.call({
+                    sql: operations[i].sql,
+                    lastID: result.lastID,
+                    changes: result.changes
+                }, error);
+            }
+            else if (error && !(err && emitted)) {
+                emitted = true;
+                db.emit('error', error);
+            }
+        });
+    });
+};
+
 function inherits(target, source) {
     for (var k in source.prototype)
         target.prototype[k] = source.prototype[k];
 }
 
 sqlite3.cached = {
-    Database: function(file, a, b) {
+    Database: function(file, a, b, c) {
         if (file === '' || file === ':memory:') {
             // Don't cache special databases.
-            return new Database(file, a, b);
+            return new Database(file, a, b, c);
         }
 
         var db;
@@ -37,12 +219,14 @@ sqlite3.cached = {
         function cb() { callback.call(db, null); }
 
         if (!sqlite3.cached.objects[file]) {
-            db = sqlite3.cached.objects[file] = new Database(file, a, b);
+            db = sqlite3.cached.objects[file] = new Database(file, a, b, c);
         }
         else {
             // Make sure the callback is called.
             db = sqlite3.cached.objects[file];
-            var callback = (typeof a === 'number') ? b : a;
+            var callback = [a, b, c].filter(function(arg) {
+                return typeof arg === 'function';
+            })[0];
             if (typeof callback === 'function') {
                 if (db.open) process.nextTick(cb);
                 else db.once('open', cb);
@@ -58,10 +242,14 @@ sqlite3.cached = {
 var Database = sqlite3.Database;
 var Statement = sqlite3.Statement;
 var Backup = sqlite3.Backup;
+var Session = sqlite3.Session;
+var Cancellation = sqlite3.Cancellation;
+var transaction = Database.prototype.transaction;
 
 inherits(Database, EventEmitter);
 inherits(Statement, EventEmitter);
 inherits(Backup, EventEmitter);
+if (Session) inherits(Session, EventEmitter);
 
 // Database#prepare(sql, [bind1, bind2, ...], [callback])
 Database.prototype.prepare = normalizeMethod(function(statement, params) {
@@ -70,41 +258,125 @@ Database.prototype.prepare = normalizeMethod(function(statement, params) {
         : statement;
 });
 
+// Database#prepareSync(sql) prepares the statement right away on the main
+// thread for use with Statement#runSync, #getSync and #allSync. Like those,
+// it throws unless the database is idle.
+Database.prototype.prepareSync = function(sql) {
+    return new Statement(this, sql, undefined, false, true);
+};
+
 // Database#run(sql, [bind1, bind2, ...], [callback])
-Database.prototype.run = normalizeMethod(function(statement, params) {
-    statement.run.apply(statement, params).finalize();
+var run = cachedMethod('run');
+Database.prototype.run = function(sql) {
+    var group = this._groupCommit;
+    var cancellation = arguments[arguments.length - 1] instanceof Cancellation;
+    if (!group || !group.accepts(sql) || cancellation) {
+        if (group) group.flush();
+        return run.apply(this, arguments);
+    }
+
+    var params = Array.prototype.slice.call(arguments, 1);
+    var callback;
+    if (typeof params[params.length - 1] === 'function') {
+        callback = params.pop();
+    }
+    var first = params[0];
+    if (params.length === 1 && first !== null && typeof first === 'object' &&
+            !Buffer.isBuffer(first) && !(first instanceof Date) &&
+            !(first instanceof RegExp)) {
+        // Parameters given as an array or as named parameters.
+        params = first;
+    }
+    group.add(sql, params, callback);
     return this;
-});
+};
 
 // Database#get(sql, [bind1, bind2, ...], [callback])
-Database.prototype.get = normalizeMethod(function(statement, params) {
-    statement.get.apply(statement, params).finalize();
-    return this;
-});
+Database.prototype.get = cachedMethod('get');
 
 // Database#all(sql, [bind1, bind2, ...], [callback])
-Database.prototype.all = normalizeMethod(function(statement, params) {
-    statement.all.apply(statement, params).finalize();
-    return this;
-});
+Database.prototype.all = cachedMethod('all');
 
-Database.prototype.allMarshal = normalizeMethod(function(statement, params) {
-    statement.allMarshal.apply(statement, params).finalize();
-    return this;
-});
+Database.prototype.allMarshal = cachedMethod('allMarshal');
+
+// Database#allJSON(sql, [bind1, bind2, ...], [callback])
+Database.prototype.allJSON = cachedMethod('allJSON');
 
+// Database#allNDJSON(sql, [bind1, bind2, ...], [callback])
+Database.prototype.allNDJSON = cachedMethod('allNDJSON');
 
 // Database#each(sql, [bind1, bind2, ...], [callback], [complete])
-Database.prototype.each = normalizeMethod(function(statement, params) {
-    statement.each.apply(statement, params).finalize();
-    return this;
-});
+// Returning false from the row callback stops fetching further rows.
+Database.prototype.each = cachedMethod('each');
 
-Database.prototype.map = normalizeMethod(function(statement, params) {
-    statement.map.apply(statement, params).finalize();
-    return this;
+Database.prototype.map = cachedMethod('map');
+
+// Database#runAsync, #getAsync and #allAsync(sql, [bind1, bind2, ...]) are
+// the promise-returning forms of run, get and all; Database#execAsync(sql)
+// is native. The promise is settled by the native code directly. A
+// Cancellation may be passed as the last argument.
+['runAsync', 'getAsync', 'allAsync'].forEach(function(name) {
+    Database.prototype[name] = function(sql) {
+        // A failed prepare rejects the promise of the queued call instead.
+        var statement = new Statement(this, sql, function() {});
+        var promise = statement[name].apply(statement,
+            Array.prototype.slice.call(arguments, 1));
+        statement.finalize();
+        return promise;
+    };
 });
 
+// Database#configure('statementCache', size) keeps up to `size` prepared
+// statements for reuse by run, get, all, each and the other shortcuts above.
+//
+// Database#configure('groupCommit', window) holds back INSERT, UPDATE,
+// DELETE and REPLACE statements given to run() for up to `window`
+// milliseconds, or until 'groupCommitSize' (64) of them have been collected,
+// and commits them in a single transaction. Each run() callback still gets
+// its own error, lastID and changes. Any other call on the database sends
+// the collected writes first, so the order of operations is unchanged.
+var configure = Database.prototype.configure;
+Database.prototype.configure = function(option, value) {
+    if (option === 'statementCache') {
+        if (typeof value !== 'number' || value < 0) {
+            throw new TypeError('Value must be a non-negative integer');
+        }
+        if (!this._statementCache) this._statementCache = new StatementCache();
+        this._statementCache.size = Math.floor(value);
+        this._statementCache.trim(this._statementCache.size);
+        return this;
+    }
+    if (option === 'groupCommit') {
+        if (typeof value !== 'number' || value < 0) {
+            throw new TypeError('Value must be a non-negative integer');
+        }
+        if (!this._groupCommit) this._groupCommit = new GroupCommit(this);
+        this._groupCommit.window = value;
+        if (!value) this._groupCommit.flush();
+        return this;
+    }
+    if (option === 'groupCommitSize') {
+        if (typeof value !== 'number' || value < 1) {
+            throw new TypeError('Value must be a positive integer');
+        }
+        if (!this._groupCommit) this._groupCommit = new GroupCommit(this);
+        this._groupCommit.size = Math.floor(value);
+        return this;
+    }
+    return configure.apply(this, arguments);
+};
+
+// Database#close([callback])
+// Cached statements are finalized first so they don't keep the handle open.
+var close = Database.prototype.close;
+Database.prototype.close = function() {
+    if (this._statementCache) {
+        this._statementCache.size = 0;
+        this._statementCache.trim(0);
+    }
+    return close.apply(this, arguments);
+};
+
 // Database#backup(filename, [callback])
 // Database#backup(filename, destName, sourceName, filenameIsDest, [callback])
 Database.prototype.backup = function() {
@@ -122,6 +394,96 @@ Database.prototype.backup = function() {
     return backup;
 };
 
+// Database#session([tables], [callback]) starts recording the changes made
+// to the given tables, or to all tables of the main database, for
+// Session#changeset() and #patchset().
+Database.prototype.session = function(tables, callback) {
+    if (!Session) {
+        throw new Error('Sessions are not supported by this build of SQLite');
+    }
+    if (typeof tables === 'function') {
+        callback = tables;
+        tables = null;
+    }
+    return new Session(this, tables, callback);
+};
+
+// Writes held back for a group commit must be queued before anything else.
+[
+    'prepare', 'get', 'all', 'allMarshal', 'allJSON', 'allNDJSON', 'each',
+    'map', 'exec', 'execSync', 'prepareSync', 'transaction',
+    'runAsync', 'getAsync', 'allAsync', 'execAsync',
+    'allMarshalPartitioned', 'wait', 'close', 'loadExtension', 'serialize', 'parallelize', 'backup',
+    'session', 'applyChangeset'
+].forEach(function(name) {
+    var method = Database.prototype[name];
+    Database.prototype[name] = function() {
+        if (this._groupCommit) this._groupCommit.flush();
+        return method.apply(this, arguments);
+    };
+});
+
+// The same goes for calls on statements, which share the connection's queue.
+[
+    'bind', 'get', 'run', 'all', 'allMarshal', 'allJSON', 'allNDJSON', 'each',
+    'fetch', 'reset', 'runSync', 'getSync', 'allSync',
+    'runAsync', 'getAsync', 'allAsync'
+].forEach(function(name) {
+    var method = Statement.prototype[name];
+    Statement.prototype[name] = function() {
+        var group = this.database._groupCommit;
+        if (group) group.flush();
+        return method.apply(this, arguments);
+    };
+});
+
+// Trailing { timeout, signal } options, given after the callback so that
+// they can't be taken for named parameters, are turned into a Cancellation
+// for the native call. A call that is cancelled or runs past its timeout
+// fails with SQLITE_INTERRUPT: it is dropped if it hasn't started yet and
+// interrupted if it is running, without affecting other calls on the same
+// connection. A Cancellation can also be passed in place of the options.
+function cancellable(name, method) {
+    return function() {
+        var args = Array.prototype.slice.call(arguments);
+        var options = args[args.length - 1];
+        if (args.length < 2 || typeof args[args.length - 2] !== 'function' ||
+                options === null || typeof options !== 'object' ||
+                options instanceof Cancellation) {
+            return method.apply(this, arguments);
+        }
+        args.pop();
+
+        var cancellation = new Cancellation(options.timeout);
+        var signal = options.signal;
+        if (signal && signal.aborted) {
+            cancellation.cancel();
+        }
+        else if (signal) {
+            var abort = function() { cancellation.cancel(); };
+            signal.addEventListener('abort', abort);
+            // Stop listening once the call is done, which each() can only
+            // tell when it has a completion callback.
+            var last = args.length - 1;
+            if (name !== 'each' || typeof args[last - 1] === 'function') {
+                var callback = args[last];
+                args[last] = function() {
+                    signal.removeEventListener('abort', abort);
+                    return callback.apply(this, arguments);
+                };
+            }
+        }
+        args.push(cancellation);
+        return method.apply(this, args);
+    };
+}
+
+['run', 'get', 'all', 'each', 'allMarshal', 'allJSON', 'allNDJSON'].forEach(function(name) {
+    Statement.prototype[name] = cancellable(name, Statement.prototype[name]);
+    Database.prototype[name] = cancellable(name, Database.prototype[name]);
+});
+Database.prototype.exec = cancellable('exec', Database.prototype.exec);
+
 Statement.prototype.map = function() {
     var params = Array.prototype.slice.call(arguments);
     var callback = params.pop();
@@ -148,9 +510,95 @@ Statement.prototype.map = function() {
     return this.all.apply(this, params);
 };
 
+// Statement#cursor([bind1, bind2, ...])
+Statement.prototype.cursor = function() {
+    var cursor = new Cursor(this);
+    var params = Array.prototype.slice.call(arguments);
+    this.reset();
+    if (params.length) {
+        params.push(function(err) {
+            if (err) cursor.error = err;
+        });
+        this.bind.apply(this, params);
+    }
+    return cursor;
+};
+
+// A pull-based view of a statement's result. Rows are only stepped when
+// asked for, so the caller decides how much of the result is in memory.
+function Cursor(statement) {
+    this.statement = statement;
+    this.pageSize = 100;
+    this.done = false;
+    this.error = null;
+}
+sqlite3.Cursor = Cursor;
+
+// Cursor#fetch(count, callback)
+Cursor.prototype.fetch = function(count, callback) {
+    var cursor = this;
+    if (this.done || this.error) {
+        var error = this.error;
+        process.nextTick(function() { callback.call(cursor, error, error ? undefined : []); });
+        return this;
+    }
+    this.statement.fetch(count, function(err, rows) {
+        if (cursor.error) return callback.call(cursor, cursor.error);
+        if (!err && rows.length < count) cursor.done = true;
+        callback.call(cursor, err, rows);
+    });
+    return this;
+};
+
+// Cursor#close([callback])
+Cursor.prototype.close = function(callback) {
+    this.done = true;
+    this.statement.reset(callback);
+    return this;
+};
+
+if (typeof Symbol === 'function' && Symbol.asyncIterator) {
+    // for await (var row of statement.cursor(...)) fetches pageSize rows at a time.
+    Cursor.prototype[Symbol.asyncIterator] = function() {
+        var cursor = this;
+        var rows = [];
+        var index = 0;
+        return {
+            next: function() {
+                if (index < rows.length) {
+                    return Promise.resolve({ value: rows[index++], done: false });
+                }
+                return new Promise(function(resolve, reject) {
+                    cursor.fetch(cursor.pageSize, function(err, page) {
+                        if (err) return reject(err);
+                        rows = page;
+                        index = 0;
+                        if (!rows.length) return resolve({ value: undefined, done: true });
+                        resolve({ value: rows[index++], done: false });
+                    });
+                });
+            },
+            return: function() {
+                return new Promise(function(resolve) {
+                    cursor.close(function() {
+                        resolve({ value: undefined, done: true });
+                    });
+                });
+            }
+        };
+    };
+}
+
+sqlite3.Pool = require('./pool');
+
 var isVerbose = false;
 
-var supportedEvents = [ 'trace', 'profile', 'insert', 'update', 'delete' ];
+// 'changes' is emitted once per committed transaction with all rows it
+// changed, see Database#configure('changes'); configure('changesTables',
+// [names]) and configure('changesCoalesce', true) narrow it down natively.
+// 'preupdate' is emitted at the same time with the old and new values of
+// those rows.
+var supportedEvents = [ 'trace', 'profile', 'insert', 'update', 'delete', 'changes', 'preupdate' ];
 
 Database.prototype.addListener = Database.prototype.on = function(type) {
     var val = EventEmitter.prototype.addListener.apply(this, arguments);
@@ -188,7 +636,8 @@ sqlite3.verbose = function() {
             'each',
             'map',
             'close',
-            'exec'
+            'exec',
+            'transaction'
         ].forEach(function (name) {
             trace.extendTrace(Database.prototype, name);
         });
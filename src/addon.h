@@ -0,0 +1,54 @@
+#ifndef NODE_SQLITE3_SRC_ADDON_H
+#define NODE_SQLITE3_SRC_ADDON_H
+
+#include <deque>
+#include <set>
+
+#include <napi.h>
+
+namespace node_sqlite3 {
+
+class Database;
+
+// State kept per Node.js environment, so that the module can be loaded by
+// the main thread and any number of worker threads at the same time. Each
+// environment has its own classes, databases and admission limits.
+struct AddonData {
+    AddonData() :
+        max_concurrency(0), max_database_concurrency(0), max_queue_depth(0),
+        running_jobs(0) {}
+
+    Napi::FunctionReference database;
+    Napi::FunctionReference statement;
+    Napi::FunctionReference backup;
+    Napi::FunctionReference session;
+    Napi::FunctionReference cancellation;
+
+    // Limits set with sqlite3.configure(); zero is unlimited.
+    unsigned int max_concurrency;
+    unsigned int max_database_concurrency;
+    unsigned int max_queue_depth;
+
+    // Jobs running on worker threads, and the databases that have jobs
+    // waiting to be admitted, in round-robin order; see Database::Admit().
+    unsigned int running_jobs;
+    std::deque<Database*> ready_databases;
+
+    // Every Database object that hasn't been destroyed yet.
+    std::set<Database*> databases;
+};
+
+inline AddonData* GetAddonData(napi_env env) {
+#if NAPI_VERSION >= 6
+    return Napi::Env(env).GetInstanceData<AddonData>();
+#else
+    // Without instance data, the module can only be used from one
+    // environment. It is never deleted, like the references it holds.
+    static AddonData* data = new AddonData();
+    return data;
+#endif
+}
+
+}
+
+#endif
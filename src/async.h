@@ -1,6 +1,11 @@
 #ifndef NODE_SQLITE3_SRC_ASYNC_H
 #define NODE_SQLITE3_SRC_ASYNC_H
 
+#include <atomic>
+#include <iterator>
+#include <stdint.h>
+#include <vector>
+
 #include <napi.h>
 #include <uv.h>
 
@@ -11,23 +16,121 @@
 #endif
 
 
+// Hands items from any number of threads to the thread running the event
+// loop. Items are stored by value in a ring of slots that producers claim
+// with a compare-and-swap, so pushing an item neither locks nor allocates.
+// Should the ring fill up because the event loop falls behind, items go to
+// an overflow list under a mutex instead until it has caught up; since the
+// overflow is only taken once the ring is empty, each producer's items still
+// come out in the order they were pushed.
+template <class Item, unsigned int Capacity = 256> class MPSCQueue {
+    struct Slot {
+        // Equals the position of the next push into this slot while it is
+        // free, and one more than its current position once it holds an item.
+        std::atomic<size_t> sequence;
+        Item item;
+    };
+
+public:
+    MPSCQueue() : head(0), tail(0), overflowed(false) {
+        for (size_t i = 0; i < Capacity; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        NODE_SQLITE3_MUTEX_INIT
+    }
+
+    ~MPSCQueue() {
+        NODE_SQLITE3_MUTEX_DESTROY
+    }
+
+    // May be called from any thread.
+    void push(Item item) {
+        if (!overflowed.load(std::memory_order_acquire) && claim(item)) {
+            return;
+        }
+        NODE_SQLITE3_MUTEX_LOCK(&mutex)
+        overflow.push_back(std::move(item));
+        overflowed.store(true, std::memory_order_release);
+        NODE_SQLITE3_MUTEX_UNLOCK(&mutex)
+    }
+
+    // Moves the items that are ready to `items`. Only called by the consumer.
+    void drain(std::vector<Item>& items) {
+        while (true) {
+            Slot& slot = slots[head % Capacity];
+            if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+                break;
+            }
+            items.push_back(std::move(slot.item));
+            slot.sequence.store(head + Capacity, std::memory_order_release);
+            head++;
+        }
+
+        if (!overflowed.load(std::memory_order_acquire)) {
+            return;
+        }
+        NODE_SQLITE3_MUTEX_LOCK(&mutex)
+        // A slot that is claimed but not filled yet holds an item pushed
+        // before the overflow; the producer will send another wakeup.
+        if (head == tail.load(std::memory_order_acquire)) {
+            items.insert(items.end(), std::make_move_iterator(overflow.begin()),
+                std::make_move_iterator(overflow.end()));
+            overflow.clear();
+            overflowed.store(false, std::memory_order_release);
+        }
+        NODE_SQLITE3_MUTEX_UNLOCK(&mutex)
+    }
+
+protected:
+    bool claim(Item& item) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos % Capacity];
+            intptr_t diff = (intptr_t)slot.sequence.load(std::memory_order_acquire) - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.item = std::move(item);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                // The ring is full.
+                return false;
+            }
+            else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    Slot slots[Capacity];
+    // Only used by the consumer.
+    size_t head;
+    std::atomic<size_t> tail;
+    std::atomic<bool> overflowed;
+    NODE_SQLITE3_MUTEX_t
+    std::vector<Item> overflow;
+};
+
 // Generic uv_async handler.
 template <class Item, class Parent> class Async {
     typedef void (*Callback)(Parent* parent, Item* item);
 
 protected:
     uv_async_t watcher;
-    NODE_SQLITE3_MUTEX_t
-    std::vector<Item*> data;
+    MPSCQueue<Item> queue;
+    // Set while a wakeup is on its way, so that there is one uv_async_send()
+    // per batch of items rather than one per item.
+    std::atomic<bool> signalled;
     Callback callback;
 public:
     Parent* parent;
 
 public:
     Async(Parent* parent_, Callback cb_)
-        : callback(cb_), parent(parent_) {
+        : signalled(false), callback(cb_), parent(parent_) {
         watcher.data = this;
-        NODE_SQLITE3_MUTEX_INIT
         uv_loop_t *loop;
         napi_get_uv_event_loop(parent_->Env(), &loop);
         uv_async_init(loop, &watcher, reinterpret_cast<uv_async_cb>(listener));
@@ -35,12 +138,12 @@ public:
 
     static void listener(uv_async_t* handle) {
         Async* async = static_cast<Async*>(handle->data);
-        std::vector<Item*> rows;
-        NODE_SQLITE3_MUTEX_LOCK(&async->mutex)
-        rows.swap(async->data);
-        NODE_SQLITE3_MUTEX_UNLOCK(&async->mutex)
-        for (unsigned int i = 0, size = rows.size(); i < size; i++) {
-            async->callback(async->parent, rows[i]);
+        // Items sent from here on need another wakeup.
+        async->signalled.exchange(false);
+        std::vector<Item> items;
+        async->queue.drain(items);
+        for (unsigned int i = 0, size = items.size(); i < size; i++) {
+            async->callback(async->parent, &items[i]);
         }
     }
 
@@ -59,23 +162,11 @@ public:
         uv_close((uv_handle_t*)&watcher, close);
     }
 
-    void add(Item* item) {
-        NODE_SQLITE3_MUTEX_LOCK(&mutex);
-        data.push_back(item);
-        NODE_SQLITE3_MUTEX_UNLOCK(&mutex)
-    }
-
-    void send() {
-        uv_async_send(&watcher);
-    }
-
-    void send(Item* item) {
-        add(item);
-        send();
-    }
-
-    ~Async() {
-        NODE_SQLITE3_MUTEX_DESTROY
+    void send(Item item) {
+        queue.push(std::move(item));
+        if (!signalled.exchange(true)) {
+            uv_async_send(&watcher);
+        }
     }
 };
 
@@ -2,13 +2,12 @@
 #include <napi.h>
 
 #include "macros.h"
+#include "addon.h"
 #include "database.h"
 #include "backup.h"
 
 using namespace node_sqlite3;
 
-Napi::FunctionReference Backup::constructor;
-
 
 Napi::Object Backup::Init(Napi::Env env, Napi::Object exports) {
     Napi::HandleScope scope(env);
@@ -24,8 +23,7 @@ Napi::Object Backup::Init(Napi::Env env, Napi::Object exports) {
         InstanceAccessor("retryErrors", &Backup::RetryErrorGetter, &Backup::RetryErrorSetter),
     });
 
-    constructor = Napi::Persistent(t);
-    constructor.SuppressDestruct();
+    GetAddonData(env)->backup = Napi::Persistent(t);
 
     exports.Set("Backup", t);
     return exports;
@@ -187,13 +185,8 @@ Backup::Backup(const Napi::CallbackInfo& info) : Napi::ObjectWrap<Backup>(info)
 void Backup::Work_BeginInitialize(Database::Baton* baton) {
     assert(baton->db->open);
     baton->db->pending++;
-    Napi::Env env = baton->db->Env();
-    int status = napi_create_async_work(
-        env, NULL, Napi::String::New(env, "sqlite3.Backup.Initialize"),
-        Work_Initialize, Work_AfterInitialize, baton, &baton->request
-    );
-    assert(status == 0);
-    napi_queue_async_work(env, baton->request);
+    baton->db->QueueWork(&baton->request, "sqlite3.Backup.Initialize",
+        Work_Initialize, Work_AfterInitialize, baton);
 }
 
 void Backup::Work_Initialize(napi_env e, void* data) {
@@ -0,0 +1,80 @@
+#include <napi.h>
+
+#include "macros.h"
+#include "addon.h"
+#include "cancellation.h"
+
+using namespace node_sqlite3;
+
+namespace {
+
+// The cancellation of the call this thread is running, if any.
+thread_local const Cancellation::State* current = NULL;
+
+}
+
+Napi::Object Cancellation::Init(Napi::Env env, Napi::Object exports) {
+    Napi::HandleScope scope(env);
+
+    Napi::Function t = DefineClass(env, "Cancellation", {
+        InstanceMethod("cancel", &Cancellation::Cancel),
+        InstanceAccessor("cancelled", &Cancellation::CancelledGetter, nullptr),
+    });
+
+    GetAddonData(env)->cancellation = Napi::Persistent(t);
+
+    exports.Set("Cancellation", t);
+    return exports;
+}
+
+// new Cancellation([timeout])
+Cancellation::Cancellation(const Napi::CallbackInfo& info) : Napi::ObjectWrap<Cancellation>(info) {
+    Napi::Env env = info.Env();
+
+    uint64_t deadline = 0;
+    if (info.Length() > 0 && !info[0].IsUndefined()) {
+        if (!info[0].IsNumber() || info[0].As<Napi::Number>().DoubleValue() < 0) {
+            Napi::TypeError::New(env, "Timeout must be a non-negative number").ThrowAsJavaScriptException();
+            return;
+        }
+        double timeout = info[0].As<Napi::Number>().DoubleValue();
+        if (timeout > 0) {
+            deadline = uv_hrtime() + (uint64_t)(timeout * 1e6);
+        }
+    }
+
+    state = std::make_shared<State>(deadline);
+}
+
+std::shared_ptr<Cancellation::State> Cancellation::From(Napi::Value value) {
+    if (!value.IsObject() ||
+            !value.As<Napi::Object>().InstanceOf(GetAddonData(value.Env())->cancellation.Value())) {
+        return std::shared_ptr<State>();
+    }
+    return Unwrap(value.As<Napi::Object>())->state;
+}
+
+Napi::Value Cancellation::Cancel(const Napi::CallbackInfo& info) {
+    state->cancelled = true;
+    return info.This();
+}
+
+Napi::Value Cancellation::CancelledGetter(const Napi::CallbackInfo& info) {
+    return Napi::Boolean::New(this->Env(), state->Cancelled());
+}
+
+Cancellation::Scope::Scope(const State* state) : previous(current) {
+    current = state;
+}
+
+Cancellation::Scope::~Scope() {
+    current = previous;
+}
+
+bool Cancellation::Cancelled() {
+    return current != NULL && current->Cancelled();
+}
+
+int Cancellation::ProgressHandler(void* data) {
+    return Cancelled() ? 1 : 0;
+}
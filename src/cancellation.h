@@ -0,0 +1,75 @@
+#ifndef NODE_SQLITE3_SRC_CANCELLATION_H
+#define NODE_SQLITE3_SRC_CANCELLATION_H
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+#include <napi.h>
+#include <uv.h>
+
+using namespace Napi;
+
+namespace node_sqlite3 {
+
+// A cancellation flag and optional deadline for a single call, created in JS
+// as `new sqlite3.Cancellation([timeout])` and passed after the callback:
+//
+//   stmt.all(params, callback, cancellation);
+//   cancellation.cancel();
+//
+// A call that is cancelled while it is still queued fails without running;
+// one that is already running is stopped by the progress handler installed
+// on every connection, which only looks at the call running on its own
+// thread, so other calls on the same connection carry on.
+class Cancellation : public Napi::ObjectWrap<Cancellation> {
+public:
+    // Shared by the JS object and the batons of the calls it was given to,
+    // and read from worker threads.
+    struct State {
+        State(uint64_t deadline_) : cancelled(false), deadline(deadline_) {}
+        bool Cancelled() const {
+            return cancelled || (deadline && uv_hrtime() >= deadline);
+        }
+        std::atomic<bool> cancelled;
+        // uv_hrtime() value after which the call is cancelled; zero for none.
+        uint64_t deadline;
+    };
+
+    // Makes `state` the cancellation of the call running on this thread for
+    // as long as the scope lasts.
+    class Scope {
+    public:
+        Scope(const State* state);
+        ~Scope();
+    private:
+        const State* previous;
+    };
+
+    // Number of virtual machine instructions between progress handler calls.
+    static const int PROGRESS_OPS = 1000;
+
+    static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+    // Returns the state of `value` if it is a Cancellation, NULL otherwise.
+    static std::shared_ptr<State> From(Napi::Value value);
+
+    // Whether the call running on this thread has been cancelled.
+    static bool Cancelled();
+
+    // For sqlite3_progress_handler(); a non-zero return interrupts the
+    // running statement with SQLITE_INTERRUPT.
+    static int ProgressHandler(void* data);
+
+    Cancellation(const Napi::CallbackInfo& info);
+
+    Napi::Value Cancel(const Napi::CallbackInfo& info);
+    Napi::Value CancelledGetter(const Napi::CallbackInfo& info);
+
+protected:
+    std::shared_ptr<State> state;
+};
+
+}
+
+#endif
@@ -1,53 +1,426 @@
 #include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 #include "macros.h"
 #include "database.h"
 #include "statement.h"
+#include "session.h"
 
 using namespace node_sqlite3;
 
-Napi::FunctionReference Database::constructor;
-
 Napi::Object Database::Init(Napi::Env env, Napi::Object exports) {
     Napi::HandleScope scope(env);
 
     Napi::Function t = DefineClass(env, "Database", {
         InstanceMethod("close", &Database::Close),
         InstanceMethod("exec", &Database::Exec),
+        InstanceMethod("execSync", &Database::ExecSync),
+        InstanceMethod("execAsync", &Database::ExecAsync),
+        InstanceMethod("transaction", &Database::Transaction),
+        InstanceMethod("snapshot", &Database::Snapshot),
+        InstanceMethod("openSnapshot", &Database::OpenSnapshot),
+        InstanceMethod("applyChangeset", &Database::ApplyChangeset),
         InstanceMethod("wait", &Database::Wait),
         InstanceMethod("loadExtension", &Database::LoadExtension),
         InstanceMethod("serialize", &Database::Serialize),
         InstanceMethod("parallelize", &Database::Parallelize),
+        InstanceMethod("bulk", &Database::Bulk),
+        InstanceMethod("interactive", &Database::Interactive),
         InstanceMethod("configure", &Database::Configure),
         InstanceMethod("interrupt", &Database::Interrupt),
-        InstanceAccessor("open", &Database::OpenGetter, nullptr)
+        InstanceMethod("allMarshalPartitioned", &Database::AllMarshalPartitioned),
+        InstanceAccessor("open", &Database::OpenGetter, nullptr),
+        InstanceAccessor("idle", &Database::IdleGetter, nullptr),
+        InstanceAccessor("inTransaction", &Database::InTransactionGetter, nullptr)
     });
 
-    constructor = Napi::Persistent(t);
-    constructor.SuppressDestruct();
+    GetAddonData(env)->database = Napi::Persistent(t);
 
     exports.Set("Database", t);
     return exports;
 }
 
+void Database::ReportExternalMemory() {
+    int64_t change = external_memory.exchange(0);
+    if (change != 0) {
+        int64_t total;
+        napi_adjust_external_memory(this->Env(), change, &total);
+    }
+}
+
+// Work waiting for admission, see Database::Admit().
+struct Database::AdmissionJob {
+    AdmissionJob(Database* db_, napi_async_work* request_, const char* name_,
+                 napi_async_execute_callback execute_,
+                 napi_async_complete_callback complete_, void* data_) :
+        db(db_), request(request_), name(name_), execute(execute_),
+        complete(complete_), data(data_) {}
+
+    Database* db;
+    napi_async_work* request;
+    const char* name;
+    napi_async_execute_callback execute;
+    napi_async_complete_callback complete;
+    void* data;
+};
+
+void Database::QueueWork(napi_async_work* request, const char* name,
+                         napi_async_execute_callback execute,
+                         napi_async_complete_callback complete, void* data) {
+    AddonData* addon = GetAddonData(this->Env());
+    admission.push(new AdmissionJob(this, request, name, execute, complete, data));
+    if (!admission_ready) {
+        admission_ready = true;
+        addon->ready_databases.push_back(this);
+    }
+    Admit(addon);
+}
+
+// Starts waiting jobs while the limits allow, taking one job from each
+// database in turn so that a database with a long queue can't hold up the
+// others.
+void Database::Admit(AddonData* addon) {
+    std::deque<Database*>& ready_databases = addon->ready_databases;
+    size_t skipped = 0;
+    while (!ready_databases.empty() && skipped < ready_databases.size() &&
+           (!addon->max_concurrency || addon->running_jobs < addon->max_concurrency)) {
+        Database* db = ready_databases.front();
+        ready_databases.pop_front();
+
+        if (addon->max_database_concurrency &&
+                db->running >= addon->max_database_concurrency) {
+            ready_databases.push_back(db);
+            skipped++;
+            continue;
+        }
+        skipped = 0;
+
+        AdmissionJob* job = db->admission.front();
+        db->admission.pop();
+        if (db->admission.empty()) {
+            db->admission_ready = false;
+        }
+        else {
+            ready_databases.push_back(db);
+        }
+        addon->running_jobs++;
+        db->Dispatch(job);
+    }
+}
+
+void Database::Dispatch(AdmissionJob* job) {
+    running++;
+
+    if (executor) {
+        *job->request = NULL;
+        executor->Queue(ExecuteAdmitted, CompleteAdmitted, job);
+        return;
+    }
+
+    Napi::Env env = this->Env();
+    int status = napi_create_async_work(
+        env, NULL, Napi::String::New(env, job->name),
+        ExecuteAdmitted, CompleteAdmitted, job, job->request
+    );
+    UNUSED(status);
+    assert(status == 0);
+    napi_queue_async_work(env, *job->request);
+}
+
+void Database::ExecuteAdmitted(napi_env e, void* data) {
+    AdmissionJob* job = static_cast<AdmissionJob*>(data);
+    job->execute(e, job->data);
+}
+
+void Database::CompleteAdmitted(napi_env e, napi_status status, void* data) {
+    AdmissionJob* job = static_cast<AdmissionJob*>(data);
+    napi_async_complete_callback complete = job->complete;
+    void* baton = job->data;
+    AddonData* addon = GetAddonData(e);
+
+    assert(addon->running_jobs);
+    assert(job->db->running);
+    addon->running_jobs--;
+    job->db->running--;
+    delete job;
+
+    complete(e, status, baton);
+    Admit(addon);
+}
+
+// sqlite3.configure(option, value)
+//
+// 'maxConcurrency' caps the number of worker jobs running at once across all
+// databases, 'maxDatabaseConcurrency' the number per database; waiting jobs
+// are started in turn across databases. With 'maxQueueDepth', a call made
+// while that many are already waiting for a database fails right away with
+// "Database queue is full", unless it only cleans up or sets up hooks; see
+// Sheddable(). Zero, the default, means no limit. The limits apply to the
+// databases of the calling thread.
+Napi::Value Database::ConfigureModule(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    AddonData* addon = GetAddonData(env);
+
+    REQUIRE_ARGUMENTS(2);
+    REQUIRE_ARGUMENT_STRING(0, option);
+
+    // Also rejects NaN, which fails both comparisons.
+    double number = info[1].IsNumber() ? info[1].As<Napi::Number>().DoubleValue() : -1;
+    if (!(number >= 0 && number <= UINT32_MAX) || number != (double)(uint32_t)number) {
+        Napi::TypeError::New(env, "Value must be a non-negative integer").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    unsigned int value = (uint32_t)number;
+
+    if (option == "maxConcurrency") {
+        addon->max_concurrency = value;
+    }
+    else if (option == "maxDatabaseConcurrency") {
+        addon->max_database_concurrency = value;
+    }
+    else if (option == "maxQueueDepth") {
+        addon->max_queue_depth = value;
+    }
+    else {
+        Napi::Error::New(env, option + " is not a valid configuration option").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    // Raised limits may let waiting jobs start.
+    Admit(addon);
+
+    return env.Undefined();
+}
+
+// Work that has been held back to be queued again later.
+struct Database::DeferredWork {
+    DeferredWork(Database* db_, napi_async_work* request_, const char* name_,
+                 napi_async_execute_callback execute_,
+                 napi_async_complete_callback complete_, void* data_) :
+        db(db_), request(request_), name(name_), execute(execute_),
+        complete(complete_), data(data_) {
+        // The old work item is done with; QueueWork() creates a new one.
+        if (*request) {
+            napi_delete_async_work(db->Env(), *request);
+            *request = NULL;
+        }
+        db->deferred_work++;
+    }
+    ~DeferredWork() {
+        db->deferred_work--;
+    }
+    void Queue() {
+        db->QueueWork(request, name, execute, complete, data);
+    }
+
+    uv_timer_t timer;
+    Database* db;
+    napi_async_work* request;
+    const char* name;
+    napi_async_execute_callback execute;
+    napi_async_complete_callback complete;
+    void* data;
+};
+
+namespace {
+
+void DeferredWorkClosed(uv_handle_t* handle) {
+    delete static_cast<Database::DeferredWork*>(handle->data);
+}
+
+void DeferredWorkReady(uv_timer_t* handle) {
+    static_cast<Database::DeferredWork*>(handle->data)->Queue();
+    uv_close(reinterpret_cast<uv_handle_t*>(handle), DeferredWorkClosed);
+}
+
+void WatcherClosed(uv_handle_t* handle) {
+    delete reinterpret_cast<uv_async_t*>(handle);
+}
+
+}
+
+bool Database::DeferBusy(BusyRetry* retry, napi_async_work* request, const char* name,
+                         napi_async_execute_callback execute,
+                         napi_async_complete_callback complete, void* data) {
+    if (busy_retry <= 0 || retry->waited >= busy_retry) {
+        return false;
+    }
+
+    // Back off exponentially from 1ms, but check at least every 100ms.
+    retry->delay = retry->delay ? retry->delay * 2 : 1;
+    if (retry->delay > 100) retry->delay = 100;
+    if (retry->delay > busy_retry - retry->waited) {
+        retry->delay = busy_retry - retry->waited;
+    }
+    retry->waited += retry->delay;
+
+    // The operation keeps its place: the statement stays locked and the
+    // database keeps counting it as pending while the timer runs.
+    DeferredWork* work = new DeferredWork(this, request, name, execute,
+        complete, data);
+
+    uv_loop_t* loop;
+    napi_get_uv_event_loop(this->Env(), &loop);
+    uv_timer_init(loop, &work->timer);
+    work->timer.data = work;
+    uv_timer_start(&work->timer, DeferredWorkReady, retry->delay, 0);
+    return true;
+}
+
+bool Database::DeferLocked(napi_async_work* request, const char* name,
+                           napi_async_execute_callback execute,
+                           napi_async_complete_callback complete, void* data) {
+#ifdef SQLITE_ENABLE_UNLOCK_NOTIFY
+    // The watcher and the waiter have to be in place before registering:
+    // if the other connection is already done, UnlockNotify is called right
+    // away, and otherwise it may be called from that connection's worker at
+    // any time.
+    if (unlock_watcher == NULL) {
+        uv_loop_t* loop;
+        napi_get_uv_event_loop(this->Env(), &loop);
+        unlock_watcher = new uv_async_t();
+        uv_async_init(loop, unlock_watcher, UnlockWatcher);
+        unlock_watcher->data = this;
+    }
+    uv_ref(reinterpret_cast<uv_handle_t*>(unlock_watcher));
+
+    unlock_waiters.push_back(new DeferredWork(this, request, name, execute,
+        complete, data));
+
+    // Fails when waiting for the other connection would deadlock.
+    if (sqlite3_unlock_notify(_handle, UnlockNotify, this) != SQLITE_OK) {
+        delete unlock_waiters.back();
+        unlock_waiters.pop_back();
+        if (unlock_waiters.empty()) {
+            uv_unref(reinterpret_cast<uv_handle_t*>(unlock_watcher));
+        }
+        return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef SQLITE_ENABLE_UNLOCK_NOTIFY
+// Called by SQLite on whichever thread ended the blocking transaction, with
+// every connection that was waiting for it.
+void Database::UnlockNotify(void** args, int count) {
+    for (int i = 0; i < count; i++) {
+        Database* db = static_cast<Database*>(args[i]);
+        uv_async_send(db->unlock_watcher);
+    }
+}
+
+void Database::UnlockWatcher(uv_async_t* handle) {
+    Database* db = static_cast<Database*>(handle->data);
+
+    // Everything that was waiting runs again; whatever is still blocked by
+    // another connection parks itself again.
+    std::vector<DeferredWork*> waiters;
+    waiters.swap(db->unlock_waiters);
+    for (unsigned int i = 0; i < waiters.size(); i++) {
+        waiters[i]->Queue();
+        delete waiters[i];
+    }
+    if (db->unlock_waiters.empty()) {
+        uv_unref(reinterpret_cast<uv_handle_t*>(handle));
+    }
+}
+#endif
+
+void Database::CloseUnlockWatcher() {
+    if (unlock_watcher) {
+        uv_close(reinterpret_cast<uv_handle_t*>(unlock_watcher), WatcherClosed);
+        unlock_watcher = NULL;
+    }
+}
+
+void Database::CompleteInline(napi_async_complete_callback complete, void* data) {
+    if (inline_watcher == NULL) {
+        uv_loop_t* loop;
+        napi_get_uv_event_loop(this->Env(), &loop);
+        inline_watcher = new uv_async_t();
+        uv_async_init(loop, inline_watcher, InlineWatcher);
+        inline_watcher->data = this;
+    }
+    uv_ref(reinterpret_cast<uv_handle_t*>(inline_watcher));
+
+    inline_pending++;
+    inline_completions.push_back(std::make_pair(complete, data));
+    uv_async_send(inline_watcher);
+}
+
+void Database::InlineWatcher(uv_async_t* handle) {
+    Database* db = static_cast<Database*>(handle->data);
+    Napi::Env env = db->Env();
+    Napi::HandleScope scope(env);
+
+    // Completions may run more work inline, which is completed next time.
+    std::vector<std::pair<napi_async_complete_callback, void*> > completions;
+    completions.swap(db->inline_completions);
+    if (db->inline_completions.empty()) {
+        uv_unref(reinterpret_cast<uv_handle_t*>(handle));
+    }
+    for (unsigned int i = 0; i < completions.size(); i++) {
+        db->inline_pending--;
+        CallComplete(env, "sqlite3.Inline", completions[i].first, completions[i].second);
+    }
+}
+
+void Database::CloseInlineWatcher() {
+    if (inline_watcher) {
+        uv_close(reinterpret_cast<uv_handle_t*>(inline_watcher), WatcherClosed);
+        inline_watcher = NULL;
+    }
+}
+
+// Interactive calls are preferred, but once this many of them have been
+// taken ahead of waiting bulk work, the next bulk call goes first.
+static const unsigned int BULK_AGING = 8;
+
+std::queue<Database::Call*>* Database::NextLane() {
+    if (bulk_queue.empty()) {
+        return queue.empty() ? NULL : &queue;
+    }
+    if (queue.empty()) {
+        return &bulk_queue;
+    }
+    std::queue<Call*>* lane = bulk_skipped >= BULK_AGING ? &bulk_queue : &queue;
+    std::queue<Call*>* other = lane == &queue ? &bulk_queue : &queue;
+    // A barrier first lets the calls queued before it in the other lane go.
+    if (lane->front()->barrier &&
+            other->front()->sequence < lane->front()->sequence) {
+        return other;
+    }
+    return lane;
+}
+
 void Database::Process() {
     Napi::Env env = this->Env();
     Napi::HandleScope scope(env);
 
-    if (!open && locked && !queue.empty()) {
+    if (!open && locked && NextLane()) {
         EXCEPTION(Napi::String::New(env, "Database handle is closed"), SQLITE_MISUSE, exception);
         Napi::Value argv[] = { exception };
         bool called = false;
 
         // Call all callbacks with the error object.
-        while (!queue.empty()) {
-            Call* call = queue.front();
+        std::queue<Call*>* lane;
+        while ((lane = NextLane()) != NULL) {
+            Call* call = lane->front();
             Napi::Function cb = call->baton->callback.Value();
-            if (!cb.IsUndefined() && cb.IsFunction()) {
+            if (call->baton->deferred) {
+                RejectDeferred(env, call->baton->deferred, exception);
+                called = true;
+            }
+            else if (!cb.IsUndefined() && cb.IsFunction()) {
                 TRY_CATCH_CALL(this->Value(), cb, 1, argv);
                 called = true;
             }
-            queue.pop();
+            lane->pop();
             // We don't call the actual callback, so we have to make sure that
             // the baton gets destroyed.
             delete call->baton;
@@ -63,14 +436,28 @@ void Database::Process() {
         return;
     }
 
-    while (open && (!locked || pending == 0) && !queue.empty()) {
-        Call* call = queue.front();
+    std::queue<Call*>* lane;
+    while (open && (!locked || pending == 0) && (lane = NextLane()) != NULL) {
+        Call* call = lane->front();
+
+        if (call->baton->cancellation && call->baton->cancellation->Cancelled()) {
+            lane->pop();
+            Cancel(call->baton);
+            delete call;
+            continue;
+        }
 
         if (call->exclusive && pending > 0) {
             break;
         }
 
-        queue.pop();
+        lane->pop();
+        if (lane == &bulk_queue) {
+            bulk_skipped = 0;
+        }
+        else if (!bulk_queue.empty()) {
+            bulk_skipped++;
+        }
         locked = call->exclusive;
         call->callback(call->baton);
         delete call;
@@ -86,7 +473,30 @@ void Database::Schedule(Work_Callback callback, Baton* baton, bool exclusive) {
     if (!open && locked) {
         EXCEPTION(Napi::String::New(env, "Database is closed"), SQLITE_MISUSE, exception);
         Napi::Function cb = baton->callback.Value();
-        if (!cb.IsUndefined() && cb.IsFunction()) {
+        if (baton->deferred) {
+            RejectDeferred(env, baton->deferred, exception);
+        }
+        else if (!cb.IsUndefined() && cb.IsFunction()) {
+            Napi::Value argv[] = { exception };
+            TRY_CATCH_CALL(Value(), cb, 1, argv);
+        }
+        else {
+            Napi::Value argv[] = { Napi::String::New(env, "error"), exception };
+            EMIT_EVENT(Value(), 2, argv);
+        }
+        return;
+    }
+
+    unsigned int max_queue_depth = GetAddonData(env)->max_queue_depth;
+    if (max_queue_depth && Sheddable(callback) &&
+            queue.size() + bulk_queue.size() + admission.size() >= max_queue_depth) {
+        // Shed load instead of letting the queue grow without bound.
+        EXCEPTION(Napi::String::New(env, "Database queue is full"), SQLITE_BUSY, exception);
+        Napi::Function cb = baton->callback.Value();
+        if (baton->deferred) {
+            RejectDeferred(env, baton->deferred, exception);
+        }
+        else if (!cb.IsUndefined() && cb.IsFunction()) {
             Napi::Value argv[] = { exception };
             TRY_CATCH_CALL(Value(), cb, 1, argv);
         }
@@ -94,11 +504,20 @@ void Database::Schedule(Work_Callback callback, Baton* baton, bool exclusive) {
             Napi::Value argv[] = { Napi::String::New(env, "error"), exception };
             EMIT_EVENT(Value(), 2, argv);
         }
+        delete baton;
         return;
     }
 
-    if (!open || ((locked || exclusive || serialize) && pending > 0)) {
-        queue.push(new Call(callback, baton, exclusive || serialize));
+    bool barrier = Barrier(callback);
+    if (!open || ((locked || exclusive || serialize) && pending > 0) ||
+            (barrier && (!queue.empty() || !bulk_queue.empty()))) {
+        Call* call = new Call(callback, baton, exclusive || serialize);
+        call->barrier = barrier;
+        call->sequence = queued_calls++;
+        (bulk ? bulk_queue : queue).push(call);
+    }
+    else if (baton->cancellation && baton->cancellation->Cancelled()) {
+        Cancel(baton);
     }
     else {
         locked = exclusive;
@@ -106,9 +525,54 @@ void Database::Schedule(Work_Callback callback, Baton* baton, bool exclusive) {
     }
 }
 
+// Whether a call may be turned away when the queue is full. Closing the
+// database or a session frees resources, and the hooks registered by
+// configure() have no callback to report the error to.
+bool Database::Sheddable(Work_Callback callback) {
+    if (callback == Work_BeginClose ||
+            callback == RegisterTraceCallback ||
+            callback == RegisterProfileCallback ||
+            callback == RegisterUpdateCallback) {
+        return false;
+    }
+#ifdef SQLITE_ENABLE_SESSION
+    if (callback == Session::Work_Close) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+// Whether a call waits for all calls queued before it, in both lanes.
+bool Database::Barrier(Work_Callback callback) {
+    return callback == Work_BeginClose || callback == Work_Wait;
+}
+
+// Fails a call whose cancellation fired before it could start.
+void Database::Cancel(Baton* baton) {
+    Napi::Env env = this->Env();
+    Napi::HandleScope scope(env);
+
+    EXCEPTION(Napi::String::New(env, "interrupted"), SQLITE_INTERRUPT, exception);
+    Napi::Function cb = baton->callback.Value();
+    if (baton->deferred) {
+        RejectDeferred(env, baton->deferred, exception);
+    }
+    else if (!cb.IsUndefined() && cb.IsFunction()) {
+        Napi::Value argv[] = { exception };
+        TRY_CATCH_CALL(Value(), cb, 1, argv);
+    }
+    else {
+        Napi::Value argv[] = { Napi::String::New(env, "error"), exception };
+        EMIT_EVENT(Value(), 2, argv);
+    }
+    delete baton;
+}
+
 Database::Database(const Napi::CallbackInfo& info) : Napi::ObjectWrap<Database>(info) {
     init();
     Napi::Env env = info.Env();
+    GetAddonData(env)->databases.insert(this);
 
     if (info.Length() <= 0 || !info[0].IsString()) {
         Napi::TypeError::New(env, "String expected").ThrowAsJavaScriptException();
@@ -126,6 +590,14 @@ Database::Database(const Napi::CallbackInfo& info) : Napi::ObjectWrap<Database>(
         mode = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX;
     }
 
+    if (info.Length() >= pos && info[pos].IsObject() && !info[pos].IsFunction()) {
+        Napi::Object options = info[pos++].As<Napi::Object>();
+        Napi::Value dedicated = options.Get("dedicatedThread");
+        if (dedicated.IsBoolean() && dedicated.As<Napi::Boolean>().Value()) {
+            executor = new Executor(env);
+        }
+    }
+
     Napi::Function callback;
     if (info.Length() >= pos && info[pos].IsFunction()) {
         callback = info[pos++].As<Napi::Function>();
@@ -140,14 +612,8 @@ Database::Database(const Napi::CallbackInfo& info) : Napi::ObjectWrap<Database>(
 }
 
 void Database::Work_BeginOpen(Baton* baton) {
-    Napi::Env env = baton->db->Env();
-    int status = napi_create_async_work(
-        env, NULL, Napi::String::New(env, "sqlite3.Database.Open"),
-        Work_Open, Work_AfterOpen, baton, &baton->request
-    );
-    UNUSED(status);
-    assert(status == 0);
-    napi_queue_async_work(env, baton->request);
+    baton->db->QueueWork(&baton->request, "sqlite3.Database.Open",
+        Work_Open, Work_AfterOpen, baton);
 }
 
 void Database::Work_Open(napi_env e, void* data) {
@@ -168,7 +634,9 @@ void Database::Work_Open(napi_env e, void* data) {
     }
     else {
         // Set default database handle values.
-        sqlite3_busy_timeout(db->_handle, 1000);
+        sqlite3_busy_handler(db->_handle, BusyHandler, db);
+        sqlite3_progress_handler(db->_handle, Cancellation::PROGRESS_OPS,
+            Cancellation::ProgressHandler, NULL);
     }
 }
 
@@ -206,7 +674,7 @@ void Database::Work_AfterOpen(napi_env e, napi_status status, void* data) {
         db->Process();
     }
 
-    napi_delete_async_work(e, baton->request);
+    if (baton->request) napi_delete_async_work(e, baton->request);
     delete baton;
 }
 
@@ -216,6 +684,23 @@ Napi::Value Database::OpenGetter(const Napi::CallbackInfo& info) {
     return Napi::Boolean::New(env, db->open);
 }
 
+// True when nothing is queued on or running against the connection.
+Napi::Value Database::IdleGetter(const Napi::CallbackInfo& info) {
+    Napi::Env env = this->Env();
+    Database* db = this;
+    // Exclusive calls such as exec() and transaction() don't count as
+    // pending, so look at the work started or held back as well.
+    return Napi::Boolean::New(env, db->open && db->pending == 0 &&
+        db->running == 0 && db->admission.empty() && db->deferred_work == 0 &&
+        db->queue.empty() && db->bulk_queue.empty());
+}
+
+Napi::Value Database::InTransactionGetter(const Napi::CallbackInfo& info) {
+    Napi::Env env = this->Env();
+    Database* db = this;
+    return Napi::Boolean::New(env, db->open && !sqlite3_get_autocommit(db->_handle));
+}
+
 Napi::Value Database::Close(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
     Database* db = this;
@@ -234,16 +719,11 @@ void Database::Work_BeginClose(Baton* baton) {
     assert(baton->db->pending == 0);
 
     baton->db->RemoveCallbacks();
+    baton->db->CloseSessions();
     baton->db->closing = true;
 
-    Napi::Env env = baton->db->Env();
-    int status = napi_create_async_work(
-        env, NULL, Napi::String::New(env, "sqlite3.Database.Close"),
-        Work_Close, Work_AfterClose, baton, &baton->request
-    );
-    UNUSED(status);
-    assert(status == 0);
-    napi_queue_async_work(env, baton->request);
+    baton->db->QueueWork(&baton->request, "sqlite3.Database.Close",
+        Work_Close, Work_AfterClose, baton);
 }
 
 void Database::Work_Close(napi_env e, void* data) {
@@ -280,6 +760,10 @@ void Database::Work_AfterClose(napi_env e, napi_status status, void* data) {
         // Leave db->locked to indicate that this db object has reached
         // the end of its life.
         argv[0] = env.Null();
+        if (db->executor) {
+            // Nothing else will run on this connection.
+            db->executor->Stop();
+        }
     }
 
     Napi::Function cb = baton->callback.Value();
@@ -299,7 +783,7 @@ void Database::Work_AfterClose(napi_env e, napi_status status, void* data) {
         db->Process();
     }
 
-    napi_delete_async_work(e, baton->request);
+    if (baton->request) napi_delete_async_work(e, baton->request);
     delete baton;
 }
 
@@ -339,6 +823,46 @@ Napi::Value Database::Parallelize(const Napi::CallbackInfo& info) {
     return info.This();
 }
 
+// Database#bulk([callback]) and Database#interactive([callback])
+//
+// Select the lane that calls on the database are queued in, for the duration
+// of the callback or, without one, from now on. Calls waiting in the
+// interactive lane are started before those in the bulk lane, except that
+// bulk work goes ahead every few calls so that it isn't starved. Order, and
+// serialize(), still hold within each lane, and close() and wait() wait for
+// the calls made before them in both lanes.
+Napi::Value Database::Bulk(const Napi::CallbackInfo& info) {
+    Napi::Env env = this->Env();
+    Database* db = this;
+    OPTIONAL_ARGUMENT_FUNCTION(0, callback);
+
+    bool before = db->bulk;
+    db->bulk = true;
+
+    if (!callback.IsEmpty() && callback.IsFunction()) {
+        TRY_CATCH_CALL(info.This(), callback, 0, NULL);
+        db->bulk = before;
+    }
+
+    return info.This();
+}
+
+Napi::Value Database::Interactive(const Napi::CallbackInfo& info) {
+    Napi::Env env = this->Env();
+    Database* db = this;
+    OPTIONAL_ARGUMENT_FUNCTION(0, callback);
+
+    bool before = db->bulk;
+    db->bulk = false;
+
+    if (!callback.IsEmpty() && callback.IsFunction()) {
+        TRY_CATCH_CALL(info.This(), callback, 0, NULL);
+        db->bulk = before;
+    }
+
+    return info.This();
+}
+
 Napi::Value Database::Configure(const Napi::CallbackInfo& info) {
     Napi::Env env = this->Env();
     Database* db = this;
@@ -360,10 +884,115 @@ Napi::Value Database::Configure(const Napi::CallbackInfo& info) {
             Napi::TypeError::New(env, "Value must be an integer").ThrowAsJavaScriptException();
             return env.Null();
         }
+        db->busy_timeout = info[1].As<Napi::Number>().Int32Value();
+    }
+    else if (info[0].StrictEquals( Napi::String::New(env, "busyRetry"))) {
+        if (!info[1].IsNumber() || info[1].As<Napi::Number>().Int32Value() < 0) {
+            Napi::TypeError::New(env, "Value must be a non-negative integer").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        // Instead of sleeping in SQLite on a worker thread, busy operations
+        // that support it are retried from a timer for up to this many
+        // milliseconds. The others keep waiting for the busy timeout.
+        db->busy_retry = info[1].As<Napi::Number>().Int32Value();
+    }
+    else if (info[0].StrictEquals( Napi::String::New(env, "maxRows")) ||
+             info[0].StrictEquals( Napi::String::New(env, "maxBytes"))) {
+        // Up to Number.MAX_SAFE_INTEGER. Also rejects NaN, which fails both
+        // comparisons.
+        double number = info[1].IsNumber() ? info[1].As<Napi::Number>().DoubleValue() : -1;
+        if (!(number >= 0 && number <= 9007199254740991.0) ||
+                number != (double)(sqlite3_int64)number) {
+            Napi::TypeError::New(env, "Value must be a non-negative integer").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        // Limits only affect calls made after this point; the value is copied
+        // into each baton when the call is scheduled.
+        sqlite3_int64 limit = (sqlite3_int64)number;
+        if (info[0].StrictEquals( Napi::String::New(env, "maxRows"))) {
+            db->max_rows = limit;
+        }
+        else {
+            db->max_bytes = limit;
+        }
+    }
+    else if (info[0].StrictEquals( Napi::String::New(env, "inlineThreshold"))) {
+        if (!info[1].IsNumber() || info[1].As<Napi::Number>().DoubleValue() < 0) {
+            Napi::TypeError::New(env, "Value must be a non-negative number").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        // Given in microseconds.
+        db->inline_threshold = (uint64_t)(info[1].As<Napi::Number>().DoubleValue() * 1000);
+    }
+    else if (info[0].StrictEquals( Napi::String::New(env, "insert")) ||
+             info[0].StrictEquals( Napi::String::New(env, "update")) ||
+             info[0].StrictEquals( Napi::String::New(env, "delete"))) {
+        std::string type = info[0].As<Napi::String>();
+        int bit = 1 << (type == "insert" ? SQLITE_INSERT :
+                        type == "update" ? SQLITE_UPDATE : SQLITE_DELETE);
+        sqlite3_mutex* mtx = db->HookMutex();
+        sqlite3_mutex_enter(mtx);
+        if (info[1].ToBoolean().Value()) {
+            db->update_types |= bit;
+        }
+        else {
+            db->update_types &= ~bit;
+        }
+        sqlite3_mutex_leave(mtx);
         Napi::Function handle;
-        Baton* baton = new Baton(db, handle);
-        baton->status = info[1].As<Napi::Number>().Int32Value();
-        db->Schedule(SetBusyTimeout, baton);
+        db->Schedule(RegisterUpdateCallback, new Baton(db, handle));
+    }
+    else if (info[0].StrictEquals( Napi::String::New(env, "changes"))) {
+        sqlite3_mutex* mtx = db->HookMutex();
+        sqlite3_mutex_enter(mtx);
+        db->changes_enabled = info[1].ToBoolean().Value();
+        sqlite3_mutex_leave(mtx);
+        Napi::Function handle;
+        db->Schedule(RegisterUpdateCallback, new Baton(db, handle));
+    }
+    else if (info[0].StrictEquals( Napi::String::New(env, "preupdate"))) {
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+        sqlite3_mutex* mtx = db->HookMutex();
+        sqlite3_mutex_enter(mtx);
+        db->preupdate_enabled = info[1].ToBoolean().Value();
+        sqlite3_mutex_leave(mtx);
+        Napi::Function handle;
+        db->Schedule(RegisterUpdateCallback, new Baton(db, handle));
+#else
+        Napi::Error::New(env, "The preupdate hook is not supported by this build of SQLite").ThrowAsJavaScriptException();
+        return env.Null();
+#endif
+    }
+    else if (info[0].StrictEquals( Napi::String::New(env, "changesTables"))) {
+        // Only changes to these tables are reported, by both 'changes' and
+        // 'preupdate'; null for all tables.
+        std::vector<std::string> tables;
+        if (info[1].IsArray()) {
+            Napi::Array array = info[1].As<Napi::Array>();
+            for (uint32_t i = 0; i < array.Length(); i++) {
+                Napi::Value name = array.Get(i);
+                if (!name.IsString()) {
+                    Napi::TypeError::New(env, "Value must be an array of table names or null").ThrowAsJavaScriptException();
+                    return env.Null();
+                }
+                tables.push_back(name.As<Napi::String>());
+            }
+        }
+        else if (!info[1].IsNull()) {
+            Napi::TypeError::New(env, "Value must be an array of table names or null").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        sqlite3_mutex* mtx = db->HookMutex();
+        sqlite3_mutex_enter(mtx);
+        db->changes_tables.swap(tables);
+        sqlite3_mutex_leave(mtx);
+    }
+    else if (info[0].StrictEquals( Napi::String::New(env, "changesCoalesce"))) {
+        // Report only the net change of each row within a transaction.
+        sqlite3_mutex* mtx = db->HookMutex();
+        sqlite3_mutex_enter(mtx);
+        db->changes_coalesce = info[1].ToBoolean().Value();
+        sqlite3_mutex_leave(mtx);
     }
     else {
         Napi::TypeError::New(env, (StringConcat(
@@ -381,6 +1010,18 @@ Napi::Value Database::Configure(const Napi::CallbackInfo& info) {
     return info.This();
 }
 
+// Called when the environment the database belongs to is torn down, for
+// example when its worker thread exits. Stops running queries so that their
+// work finishes quickly, and lets the dedicated thread exit.
+void Database::Shutdown() {
+    if (_handle) {
+        sqlite3_interrupt(_handle);
+    }
+    if (executor) {
+        executor->Stop();
+    }
+}
+
 Napi::Value Database::Interrupt(const Napi::CallbackInfo& info) {
     Napi::Env env = this->Env();
     Database* db = this;
@@ -399,27 +1040,107 @@ Napi::Value Database::Interrupt(const Napi::CallbackInfo& info) {
     return info.This();
 }
 
-void Database::SetBusyTimeout(Baton* baton) {
-    assert(baton->db->open);
-    assert(baton->db->_handle);
+// Synchronous calls run on the main thread, so they are only allowed while
+// no work of the database is running on a worker or waiting to be started:
+// otherwise they could block on the database mutex, or run ahead of calls
+// made before them. Calls whose work is done but whose callbacks haven't
+// all run yet don't count, so synchronous calls can be made from callbacks.
+// Throws and returns false when the database isn't idle.
+bool Database::CheckSync(Napi::Env env) {
+    if (!open) {
+        Napi::Error::New(env, "Database is not open").ThrowAsJavaScriptException();
+        return false;
+    }
+    if (closing) {
+        Napi::Error::New(env, "Database is closing").ThrowAsJavaScriptException();
+        return false;
+    }
+    if (running || !admission.empty() ||
+            !queue.empty() || !bulk_queue.empty()) {
+        EXCEPTION(Napi::String::New(env, "Database is busy"), SQLITE_BUSY, exception);
+        Napi::Error(env, exception).ThrowAsJavaScriptException();
+        return false;
+    }
+    return true;
+}
+
+// Database#execSync(sql)
+Napi::Value Database::ExecSync(const Napi::CallbackInfo& info) {
+    Napi::Env env = this->Env();
 
-    // Abuse the status field for passing the timeout.
-    sqlite3_busy_timeout(baton->db->_handle, baton->status);
+    REQUIRE_ARGUMENT_STRING(0, sql);
 
-    delete baton;
-}
+    if (!CheckSync(env)) {
+        return env.Null();
+    }
 
-void Database::RegisterTraceCallback(Baton* baton) {
-    assert(baton->db->open);
-    assert(baton->db->_handle);
-    Database* db = baton->db;
+    std::string error;
+    size_t offset = 0;
+    int extended_status;
+    int status = ExecScript(sql, &offset, error, &extended_status);
 
-    if (db->debug_trace == NULL) {
-        // Add it.
-        db->debug_trace = new AsyncTrace(db, TraceCallback);
-        sqlite3_trace(db->_handle, TraceCallback, db);
+    if (status != SQLITE_OK) {
+        EXCEPTION(Napi::String::New(env, error.c_str()), status, exception);
+        Napi::Error(env, exception).ThrowAsJavaScriptException();
+        return env.Null();
     }
-    else {
+
+    return info.This();
+}
+
+namespace {
+
+thread_local bool no_busy_wait = false;
+
+}
+
+Database::NoBusyWait::NoBusyWait(bool enabled) : previous(no_busy_wait) {
+    no_busy_wait = previous || enabled;
+}
+
+Database::NoBusyWait::~NoBusyWait() {
+    no_busy_wait = previous;
+}
+
+// Installed instead of sqlite3_busy_timeout() so that whether to wait can be
+// decided per operation. Waits like SQLite's default handler does.
+int Database::BusyHandler(void* data, int count) {
+    Database* db = static_cast<Database*>(data);
+    if (no_busy_wait) return 0;
+
+    static const int delays[] = { 1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50, 100 };
+    static const int totals[] = { 0, 1, 3, 8, 18, 33, 53, 78, 103, 128, 178, 228 };
+    static const int last = sizeof(delays) / sizeof(delays[0]) - 1;
+
+    int timeout = db->busy_timeout;
+    int delay, prior;
+    if (count <= last) {
+        delay = delays[count];
+        prior = totals[count];
+    }
+    else {
+        delay = delays[last];
+        prior = totals[last] + delay * (count - last);
+    }
+    if (prior + delay > timeout) {
+        delay = timeout - prior;
+        if (delay <= 0) return 0;
+    }
+    sqlite3_sleep(delay);
+    return 1;
+}
+
+void Database::RegisterTraceCallback(Baton* baton) {
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    Database* db = baton->db;
+
+    if (db->debug_trace == NULL) {
+        // Add it.
+        db->debug_trace = new AsyncTrace(db, TraceCallback);
+        sqlite3_trace(db->_handle, TraceCallback, db);
+    }
+    else {
         // Remove it.
         sqlite3_trace(db->_handle, NULL, NULL);
         db->debug_trace->finish();
@@ -432,7 +1153,7 @@ void Database::RegisterTraceCallback(Baton* baton) {
 void Database::TraceCallback(void* db, const char* sql) {
     // Note: This function is called in the thread pool.
     // Note: Some queries, such as "EXPLAIN" queries, are not sent through this.
-    static_cast<Database*>(db)->debug_trace->send(new std::string(sql));
+    static_cast<Database*>(db)->debug_trace->send(std::string(sql));
 }
 
 void Database::TraceCallback(Database* db, std::string* sql) {
@@ -445,7 +1166,6 @@ void Database::TraceCallback(Database* db, std::string* sql) {
         Napi::String::New(env, sql->c_str())
     };
     EMIT_EVENT(db->Value(), 2, argv);
-    delete sql;
 }
 
 void Database::RegisterProfileCallback(Baton* baton) {
@@ -468,122 +1188,1318 @@ void Database::RegisterProfileCallback(Baton* baton) {
     delete baton;
 }
 
-void Database::ProfileCallback(void* db, const char* sql, sqlite3_uint64 nsecs) {
-    // Note: This function is called in the thread pool.
-    // Note: Some queries, such as "EXPLAIN" queries, are not sent through this.
-    ProfileInfo* info = new ProfileInfo();
-    info->sql = std::string(sql);
-    info->nsecs = nsecs;
-    static_cast<Database*>(db)->debug_profile->send(info);
-}
+void Database::ProfileCallback(void* db, const char* sql, sqlite3_uint64 nsecs) {
+    // Note: This function is called in the thread pool.
+    // Note: Some queries, such as "EXPLAIN" queries, are not sent through this.
+    ProfileInfo info;
+    info.sql = std::string(sql);
+    info.nsecs = nsecs;
+    static_cast<Database*>(db)->debug_profile->send(std::move(info));
+}
+
+void Database::ProfileCallback(Database *db, ProfileInfo* info) {
+    Napi::Env env = db->Env();
+    Napi::HandleScope scope(env);
+
+    Napi::Value argv[] = {
+        Napi::String::New(env, "profile"),
+        Napi::String::New(env, info->sql.c_str()),
+        Napi::Number::New(env, (double)info->nsecs / 1000000.0)
+    };
+    EMIT_EVENT(db->Value(), 3, argv);
+}
+
+// The connection's mutex, which the hooks below run under, or NULL while
+// there is no connection for them to run on.
+sqlite3_mutex* Database::HookMutex() {
+    return open && _handle ? sqlite3_db_mutex(_handle) : NULL;
+}
+
+// Installs or removes the update, preupdate, commit and rollback hooks, and
+// the async handles that deliver what they collect, to match update_types,
+// changes_enabled and preupdate_enabled.
+void Database::RegisterUpdateCallback(Baton* baton) {
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    Database* db = baton->db;
+    AsyncUpdate* update_event = NULL;
+    AsyncChanges* changes_event = NULL;
+    AsyncPreupdate* preupdate_event = NULL;
+
+    sqlite3_mutex* mtx = sqlite3_db_mutex(db->_handle);
+    sqlite3_mutex_enter(mtx);
+    if (db->update_types && db->update_event == NULL) {
+        db->update_event = new AsyncUpdate(db, UpdateCallback);
+    }
+    else if (!db->update_types && db->update_event != NULL) {
+        update_event = db->update_event;
+        db->update_event = NULL;
+    }
+    if (db->changes_enabled && db->changes_event == NULL) {
+        db->changes_event = new AsyncChanges(db, ChangesCallback);
+    }
+    else if (!db->changes_enabled && db->changes_event != NULL) {
+        changes_event = db->changes_event;
+        db->changes_event = NULL;
+        db->changes = ChangeBatch();
+    }
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+    if (db->preupdate_enabled && db->preupdate_event == NULL) {
+        db->preupdate_event = new AsyncPreupdate(db, PreupdateCallback);
+        sqlite3_preupdate_hook(db->_handle, PreupdateCallback, db);
+    }
+    else if (!db->preupdate_enabled && db->preupdate_event != NULL) {
+        preupdate_event = db->preupdate_event;
+        db->preupdate_event = NULL;
+        db->preupdates = PreupdateBatch();
+        sqlite3_preupdate_hook(db->_handle, NULL, NULL);
+    }
+#endif
+
+    if (db->update_event || db->changes_event) {
+        sqlite3_update_hook(db->_handle, UpdateCallback, db);
+    }
+    else {
+        sqlite3_update_hook(db->_handle, NULL, NULL);
+    }
+    bool batched = db->changes_event || db->preupdate_event;
+    sqlite3_commit_hook(db->_handle, batched ? CommitCallback : NULL, db);
+    sqlite3_rollback_hook(db->_handle, batched ? RollbackCallback : NULL, db);
+    sqlite3_mutex_leave(mtx);
+
+    // Deliver what is left outside of the mutex.
+    if (update_event) update_event->finish();
+    if (changes_event) changes_event->finish();
+    if (preupdate_event) preupdate_event->finish();
+
+    delete baton;
+}
+
+void Database::UpdateCallback(void* db_, int type, const char* database,
+        const char* table, sqlite3_int64 rowid) {
+    // Note: This function is called in the thread pool.
+    // Note: Some queries, such as "EXPLAIN" queries, are not sent through this.
+    Database* db = static_cast<Database*>(db_);
+    if (db->update_event && (db->update_types & (1 << type))) {
+        UpdateInfo info;
+        info.type = type;
+        info.database = std::string(database);
+        info.table = std::string(table);
+        info.rowid = rowid;
+        db->update_event->send(std::move(info));
+    }
+    if (db->changes_event) {
+        db->AddChange(type, database, table, rowid);
+    }
+}
+
+namespace {
+
+// Whether `name` is the name of `table` as used by the 'changes' event.
+bool SameTable(const std::string& name, const char* database, const char* table) {
+    if (strcmp(database, "main") == 0) {
+        return name == table;
+    }
+    size_t length = strlen(database);
+    return name.size() > length && name.compare(0, length, database) == 0 &&
+        name[length] == '.' && name.compare(length + 1, std::string::npos, table) == 0;
+}
+
+// The net effect of a change following another one of the same row, or 0
+// if they cancel each other out.
+int MergeChange(int previous, int next) {
+    if (previous == SQLITE_INSERT) {
+        return next == SQLITE_DELETE ? 0 : SQLITE_INSERT;
+    }
+    if (previous == SQLITE_DELETE) {
+        // The row was replaced.
+        return next == SQLITE_INSERT ? SQLITE_UPDATE : next;
+    }
+    return next;
+}
+
+}
+
+// Whether changes to the table pass configure('changesTables').
+bool Database::WantsChanges(const char* database, const char* table) {
+    if (changes_tables.empty()) {
+        return true;
+    }
+    for (size_t i = 0; i < changes_tables.size(); i++) {
+        if (SameTable(changes_tables[i], database, table)) return true;
+    }
+    return false;
+}
+
+// The position of the table in a batch's table names, which adds it the
+// first time.
+uint32_t Database::TableIndex(std::vector<std::string>& tables,
+        const char* database, const char* table) {
+    uint32_t index = 0;
+    while (index < tables.size() && !SameTable(tables[index], database, table)) {
+        index++;
+    }
+    if (index == tables.size()) {
+        tables.push_back(strcmp(database, "main") == 0 ?
+            std::string(table) : std::string(database) + "." + table);
+    }
+    return index;
+}
+
+// Called by the update hook, with the connection's mutex held.
+void Database::AddChange(int type, const char* database, const char* table,
+        sqlite3_int64 rowid) {
+    if (!WantsChanges(database, table)) {
+        return;
+    }
+    uint32_t index = TableIndex(changes.tables, database, table);
+
+    if (changes_coalesce) {
+        ChangeKey key = { index, rowid };
+        std::unordered_map<ChangeKey, size_t, ChangeKeyHash>::iterator it =
+            changes.positions.find(key);
+        if (it != changes.positions.end()) {
+            if (!change_marks.empty()) {
+                changes.undo.push_back(std::make_pair(it->second, changes.types[it->second]));
+            }
+            int merged = MergeChange(changes.types[it->second], type);
+            changes.types[it->second] = merged;
+            if (merged == 0) {
+                changes.removed++;
+                changes.positions.erase(it);
+            }
+            return;
+        }
+        changes.positions[key] = changes.types.size();
+    }
+
+    changes.types.push_back(type);
+    changes.table_indexes.push_back(index);
+    changes.rowids.push_back(rowid);
+}
+
+// SQLite calls the commit hook before committing, and the commit can still
+// fail, for example with SQLITE_BUSY, leaving the transaction open. So the
+// changes are only handed over by ConfirmCommit() once the statement that
+// committed is done.
+int Database::CommitCallback(void* db_) {
+    Database* db = static_cast<Database*>(db_);
+    db->committing = true;
+    return 0;
+}
+
+void Database::RollbackCallback(void* db_) {
+    Database* db = static_cast<Database*>(db_);
+    db->committing = false;
+    db->changes = ChangeBatch();
+    db->preupdates = PreupdateBatch();
+    db->change_marks.clear();
+}
+
+// Called with the connection's mutex held after running a statement. Hands
+// the changes of a transaction over when it committed. Changes of a
+// statement that failed inside a transaction that still commits are
+// included, as SQLite doesn't report those rollbacks to the hooks.
+void Database::ConfirmCommit() {
+    if (!committing) return;
+    committing = false;
+    if (!sqlite3_get_autocommit(_handle)) {
+        // The commit failed. The changes stay until the transaction is
+        // committed again or rolled back.
+        return;
+    }
+    if (changes_event && changes.types.size() > changes.removed) {
+        changes_event->send(std::move(changes));
+    }
+    if (preupdate_event && !preupdates.changes.empty()) {
+        preupdate_event->send(std::move(preupdates));
+    }
+    changes = ChangeBatch();
+    preupdates = PreupdateBatch();
+    change_marks.clear();
+}
+
+// Called with the connection's mutex held, right after the library opened
+// a savepoint, and after it released or rolled back to it.
+void Database::MarkChanges() {
+    ChangeMark mark;
+    mark.tables = changes.tables.size();
+    mark.changes = changes.types.size();
+    mark.undo = changes.undo.size();
+    mark.preupdate_tables = preupdates.tables.size();
+    mark.preupdate_changes = preupdates.changes.size();
+    mark.preupdate_values = preupdates.values.size();
+    change_marks.push_back(mark);
+}
+
+void Database::ReleaseChanges() {
+    if (change_marks.empty()) return;
+    change_marks.pop_back();
+    if (change_marks.empty()) {
+        changes.undo.clear();
+    }
+}
+
+void Database::RollbackChanges() {
+    if (change_marks.empty()) return;
+    ChangeMark mark = change_marks.back();
+
+    // Coalesced changes of rows that existed before get their earlier type
+    // back, most recent first.
+    while (changes.undo.size() > mark.undo) {
+        size_t position = changes.undo.back().first;
+        uint8_t type = changes.undo.back().second;
+        changes.undo.pop_back();
+        if (changes.types[position] == 0) {
+            ChangeKey key = { changes.table_indexes[position], changes.rowids[position] };
+            changes.positions[key] = position;
+            changes.removed--;
+        }
+        changes.types[position] = type;
+    }
+    for (size_t i = mark.changes; i < changes.types.size(); i++) {
+        if (changes.types[i] == 0) {
+            changes.removed--;
+        }
+        else if (changes_coalesce) {
+            ChangeKey key = { changes.table_indexes[i], changes.rowids[i] };
+            changes.positions.erase(key);
+        }
+    }
+    changes.types.resize(mark.changes);
+    changes.table_indexes.resize(mark.changes);
+    changes.rowids.resize(mark.changes);
+    changes.tables.resize(mark.tables);
+
+    preupdates.changes.resize(mark.preupdate_changes);
+    preupdates.values.resize(mark.preupdate_values);
+    preupdates.tables.resize(mark.preupdate_tables);
+
+    ReleaseChanges();
+}
+
+// Emits 'changes' with the changes of one transaction as parallel arrays:
+// `types` holds sqlite3.INSERT, UPDATE or DELETE, `tableIndexes` positions in
+// `tables` and `rowids` the rowids.
+void Database::ChangesCallback(Database* db, ChangeBatch* batch) {
+    Napi::Env env = db->Env();
+    Napi::HandleScope scope(env);
+
+    size_t count = batch->types.size() - batch->removed;
+    Napi::Array tables = Napi::Array::New(env, batch->tables.size());
+    for (size_t i = 0; i < batch->tables.size(); i++) {
+        tables.Set(i, Napi::String::New(env, batch->tables[i]));
+    }
+    Napi::Uint8Array types = Napi::Uint8Array::New(env, count);
+    Napi::Uint32Array table_indexes = Napi::Uint32Array::New(env, count);
+    Napi::Float64Array rowids = Napi::Float64Array::New(env, count);
+    for (size_t i = 0, j = 0; i < batch->types.size(); i++) {
+        if (batch->types[i] == 0) continue;
+        types[j] = batch->types[i];
+        table_indexes[j] = batch->table_indexes[i];
+        rowids[j] = (double)batch->rowids[i];
+        j++;
+    }
+
+    Napi::Object changes = Napi::Object::New(env);
+    changes.Set(Napi::String::New(env, "tables"), tables);
+    changes.Set(Napi::String::New(env, "types"), types);
+    changes.Set(Napi::String::New(env, "tableIndexes"), table_indexes);
+    changes.Set(Napi::String::New(env, "rowids"), rowids);
+
+    Napi::Value argv[] = { Napi::String::New(env, "changes"), changes };
+    EMIT_EVENT(db->Value(), 2, argv);
+}
+
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+// Captures the old and new values of each row about to change. Called with
+// the connection's mutex held.
+void Database::PreupdateCallback(void* db_, sqlite3* handle, int type,
+        const char* database, const char* table,
+        sqlite3_int64 old_rowid, sqlite3_int64 new_rowid) {
+    Database* db = static_cast<Database*>(db_);
+    if (db->preupdate_event == NULL || !db->WantsChanges(database, table)) {
+        return;
+    }
+
+    PreupdateBatch& batch = db->preupdates;
+    PreupdateChange change;
+    change.type = type;
+    change.table = TableIndex(batch.tables, database, table);
+    change.old_rowid = old_rowid;
+    change.new_rowid = new_rowid;
+    change.columns = sqlite3_preupdate_count(handle);
+    change.first = batch.values.size();
+
+    for (int i = 0; type != SQLITE_INSERT && i < change.columns; i++) {
+        sqlite3_value* value = NULL;
+        sqlite3_preupdate_old(handle, i, &value);
+        batch.values.push_back(ValuePtr(value ? sqlite3_value_dup(value) : NULL));
+    }
+    for (int i = 0; type != SQLITE_DELETE && i < change.columns; i++) {
+        sqlite3_value* value = NULL;
+        sqlite3_preupdate_new(handle, i, &value);
+        batch.values.push_back(ValuePtr(value ? sqlite3_value_dup(value) : NULL));
+    }
+
+    batch.changes.push_back(change);
+}
+#endif
+
+namespace {
+
+Napi::Value ValueToJS(Napi::Env env, sqlite3_value* value) {
+    if (value == NULL) {
+        return env.Null();
+    }
+    switch (sqlite3_value_type(value)) {
+        case SQLITE_INTEGER:
+            return Napi::Number::New(env, sqlite3_value_int64(value));
+        case SQLITE_FLOAT:
+            return Napi::Number::New(env, sqlite3_value_double(value));
+        case SQLITE_TEXT:
+            return Napi::String::New(env,
+                reinterpret_cast<const char*>(sqlite3_value_text(value)),
+                sqlite3_value_bytes(value));
+        case SQLITE_BLOB:
+            return Napi::Buffer<char>::Copy(env,
+                static_cast<const char*>(sqlite3_value_blob(value)),
+                sqlite3_value_bytes(value));
+        default:
+            return env.Null();
+    }
+}
+
+Napi::Array ValuesToJS(Napi::Env env, const std::vector<Database::ValuePtr>& values,
+        size_t first, int count) {
+    Napi::Array result = Napi::Array::New(env, count);
+    for (int i = 0; i < count; i++) {
+        result.Set(i, ValueToJS(env, values[first + i].get()));
+    }
+    return result;
+}
+
+}
+
+// Emits 'preupdate' with an array of the rows one transaction changed, each
+// as { type, table, oldRowid, newRowid, old, new }. `old` and `new` hold the
+// column values in table order and are left out for inserts and deletes
+// respectively.
+void Database::PreupdateCallback(Database* db, PreupdateBatch* batch) {
+    Napi::Env env = db->Env();
+    Napi::HandleScope scope(env);
+
+    std::vector<Napi::String> tables;
+    for (size_t i = 0; i < batch->tables.size(); i++) {
+        tables.push_back(Napi::String::New(env, batch->tables[i]));
+    }
+
+    Napi::Array changes = Napi::Array::New(env, batch->changes.size());
+    for (size_t i = 0; i < batch->changes.size(); i++) {
+        const PreupdateChange& change = batch->changes[i];
+        Napi::Object object = Napi::Object::New(env);
+        object.Set(Napi::String::New(env, "type"),
+            Napi::String::New(env, sqlite_authorizer_string(change.type)));
+        object.Set(Napi::String::New(env, "table"), tables[change.table]);
+        object.Set(Napi::String::New(env, "oldRowid"), Napi::Number::New(env, change.old_rowid));
+        object.Set(Napi::String::New(env, "newRowid"), Napi::Number::New(env, change.new_rowid));
+        size_t first = change.first;
+        if (change.type != SQLITE_INSERT) {
+            object.Set(Napi::String::New(env, "old"),
+                ValuesToJS(env, batch->values, first, change.columns));
+            first += change.columns;
+        }
+        if (change.type != SQLITE_DELETE) {
+            object.Set(Napi::String::New(env, "new"),
+                ValuesToJS(env, batch->values, first, change.columns));
+        }
+        changes.Set(i, object);
+    }
+
+    Napi::Value argv[] = { Napi::String::New(env, "preupdate"), changes };
+    EMIT_EVENT(db->Value(), 2, argv);
+}
+
+void Database::UpdateCallback(Database *db, UpdateInfo* info) {
+    Napi::Env env = db->Env();
+    Napi::HandleScope scope(env);
+
+    Napi::Value argv[] = {
+        Napi::String::New(env, sqlite_authorizer_string(info->type)),
+        Napi::String::New(env, info->database.c_str()),
+        Napi::String::New(env, info->table.c_str()),
+        Napi::Number::New(env, info->rowid),
+    };
+    EMIT_EVENT(db->Value(), 4, argv);
+}
+
+Napi::Value Database::Exec(const Napi::CallbackInfo& info) {
+    Napi::Env env = this->Env();
+    Database* db = this;
+
+    REQUIRE_ARGUMENT_STRING(0, sql);
+    OPTIONAL_ARGUMENT_FUNCTION(1, callback);
+
+    Baton* baton = new ExecBaton(db, callback, sql.c_str());
+    baton->cancellation = Cancellation::From(info[info.Length() - 1]);
+    db->Schedule(Work_BeginExec, baton, true);
+
+    return info.This();
+}
+
+// Database#execAsync(sql) returns a promise that is settled directly when
+// the statements have run.
+Napi::Value Database::ExecAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = this->Env();
+
+    REQUIRE_ARGUMENT_STRING(0, sql);
+
+    Baton* baton = new ExecBaton(this, Napi::Function(), sql.c_str());
+    baton->cancellation = Cancellation::From(info[info.Length() - 1]);
+    napi_value promise = CreateDeferred(env, &baton->deferred);
+    if (promise == NULL) {
+        delete baton;
+        Napi::Error::New(env).ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    Schedule(Work_BeginExec, baton, true);
+
+    return Napi::Value(env, promise);
+}
+
+void Database::Work_BeginExec(Baton* baton) {
+    assert(baton->db->locked);
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    assert(baton->db->pending == 0);
+    baton->db->QueueWork(&baton->request, "sqlite3.Database.Exec",
+        Work_Exec, Work_AfterExec, baton);
+}
+
+void Database::Work_Exec(napi_env e, void* data) {
+    ExecBaton* baton = static_cast<ExecBaton*>(data);
+    Cancellation::Scope cancellation(baton->cancellation.get());
+
+    if (Cancellation::Cancelled()) {
+        // Cancelled while waiting for a worker.
+        baton->status = SQLITE_INTERRUPT;
+        baton->message = "interrupted";
+        return;
+    }
+
+    baton->status = baton->db->ExecScript(baton->sql, &baton->offset,
+        baton->message, &baton->extended_status);
+}
+
+// Runs the statements in sql from *offset on, one after the other, like
+// sqlite3_exec(), and checks after each of them whether a commit it made
+// went through. When one fails, *offset is left pointing at it.
+int Database::ExecScript(const std::string& sql, size_t* offset, std::string& message,
+                         int* extended_status) {
+    sqlite3_mutex* mtx = sqlite3_db_mutex(_handle);
+    sqlite3_mutex_enter(mtx);
+
+    const char* start = sql.c_str();
+    const char* tail = start + *offset;
+    int status = SQLITE_OK;
+    while (status == SQLITE_OK && *tail) {
+        sqlite3_stmt* stmt = NULL;
+        const char* next = tail;
+        status = sqlite3_prepare_v2(_handle, tail, -1, &stmt, &next);
+        if (status == SQLITE_OK && stmt != NULL) {
+            while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {}
+            if (status == SQLITE_DONE) {
+                status = SQLITE_OK;
+            }
+        }
+        if (status != SQLITE_OK) {
+            message = std::string(sqlite3_errmsg(_handle));
+            *extended_status = sqlite3_extended_errcode(_handle);
+        }
+        else {
+            tail = next;
+        }
+        sqlite3_finalize(stmt);
+        ConfirmCommit();
+    }
+    *offset = tail - start;
+
+    sqlite3_mutex_leave(mtx);
+    return status;
+}
+
+void Database::Work_AfterExec(napi_env e, napi_status status, void* data) {
+    ExecBaton* baton = static_cast<ExecBaton*>(data);
+
+    Database* db = baton->db;
+
+    if (baton->status == SQLITE_LOCKED &&
+            baton->extended_status == SQLITE_LOCKED_SHAREDCACHE &&
+            db->DeferLocked(&baton->request, "sqlite3.Database.Exec",
+            Work_Exec, Work_AfterExec, baton)) {
+        // The statements before the one that found its table locked have
+        // run; it goes on from there.
+        baton->status = SQLITE_OK;
+        baton->message.clear();
+        return;
+    }
+
+    Napi::Env env = db->Env();
+    Napi::HandleScope scope(env);
+
+    Napi::Function cb = baton->callback.Value();
+
+    if (baton->status != SQLITE_OK) {
+        EXCEPTION(Napi::String::New(env, baton->message.c_str()), baton->status, exception);
+
+        if (baton->deferred) {
+            RejectDeferred(env, baton->deferred, exception);
+        }
+        else if (!cb.IsUndefined() && cb.IsFunction()) {
+            Napi::Value argv[] = { exception };
+            TRY_CATCH_CALL(db->Value(), cb, 1, argv);
+        }
+        else {
+            Napi::Value info[] = { Napi::String::New(env, "error"), exception };
+            EMIT_EVENT(db->Value(), 2, info);
+        }
+    }
+    else if (baton->deferred) {
+        ResolveDeferred(env, baton->deferred, env.Undefined());
+    }
+    else if (!cb.IsUndefined() && cb.IsFunction()) {
+        Napi::Value argv[] = { env.Null() };
+        TRY_CATCH_CALL(db->Value(), cb, 1, argv);
+    }
+
+    db->Process();
+
+    if (baton->request) napi_delete_async_work(e, baton->request);
+    delete baton;
+}
+
+struct Database::TransactionOp {
+    TransactionOp() : stmt(NULL), locked(false), status(SQLITE_OK),
+        inserted_id(0), changes(0), columns(0) {}
+    // Either SQL text that is prepared for this transaction only, or a
+    // prepared Statement that is locked while the transaction runs.
+    std::string sql;
+    Statement* stmt;
+    bool locked;
+    Parameters parameters;
+    // Only set for isolated operations; otherwise a failure fails the whole
+    // transaction.
+    int status;
+    std::string message;
+    sqlite3_int64 inserted_id;
+    int changes;
+    int columns;
+    Rows rows;
+};
+
+static void ClearRows(Rows& rows) {
+    for (Rows::iterator it = rows.begin(); it < rows.end(); ++it) {
+        for (Row::iterator field = (*it)->begin(); field < (*it)->end(); ++field) {
+            DELETE_FIELD(*field);
+        }
+        delete *it;
+    }
+    rows.clear();
+}
+
+Database::TransactionBaton::~TransactionBaton() {
+    for (unsigned int i = 0; i < ops.size(); i++) {
+        TransactionOp* op = ops[i];
+        for (unsigned int j = 0; j < op->parameters.size(); j++) {
+            Values::Field* field = op->parameters[j];
+            DELETE_FIELD(field);
+        }
+        ClearRows(op->rows);
+        if (op->stmt) op->stmt->Unref();
+        delete op;
+    }
+    if (memory) {
+        db->AdjustExternalMemory(-memory);
+        db->ReportExternalMemory();
+    }
+}
+
+// Database#transaction(operations, [options], [callback])
+//
+// Each operation is a string of SQL or an object with either `sql` or a
+// prepared `statement`, and optional `params`. All of them run in a single
+// trip to the worker thread inside BEGIN/COMMIT, or inside a savepoint when
+// a transaction is already open, and are rolled back if any of them fails.
+// With the `isolate` option, failing operations are rolled back on their own
+// and report their error in their result instead.
+Napi::Value Database::Transaction(const Napi::CallbackInfo& info) {
+    Napi::Env env = this->Env();
+    Database* db = this;
+
+    if (info.Length() <= 0 || !info[0].IsArray()) {
+        Napi::TypeError::New(env, "Array of operations expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    size_t last = info.Length() > 1 && info[1].IsObject() && !info[1].IsFunction() ? 2 : 1;
+    OPTIONAL_ARGUMENT_FUNCTION(last, callback);
+
+    Napi::Array operations = info[0].As<Napi::Array>();
+    TransactionBaton* baton = new TransactionBaton(db, callback);
+    if (last == 2) {
+        baton->isolate = info[1].As<Napi::Object>().Get("isolate").ToBoolean().Value();
+    }
+    size_t bytes = 0;
+
+    for (uint32_t i = 0; i < operations.Length(); i++) {
+        TransactionOp* op = new TransactionOp();
+        baton->ops.push_back(op);
+
+        Napi::Value item = operations.Get(i);
+        Napi::Value sql = item;
+        Napi::Value statement = env.Undefined();
+        Napi::Value params = env.Undefined();
+        if (item.IsObject()) {
+            Napi::Object object = item.As<Napi::Object>();
+            sql = object.Get("sql");
+            statement = object.Get("statement");
+            params = object.Get("params");
+        }
+
+        if (sql.IsString()) {
+            op->sql = sql.As<Napi::String>().Utf8Value();
+        }
+        else if (statement.IsObject() &&
+                 statement.As<Napi::Object>().InstanceOf(GetAddonData(env)->statement.Value())) {
+            op->stmt = Statement::Unwrap(statement.As<Napi::Object>());
+            op->stmt->Ref();
+            if (op->stmt->db != db) {
+                delete baton;
+                Napi::TypeError::New(env, "Statement belongs to a different database").ThrowAsJavaScriptException();
+                return env.Null();
+            }
+        }
+        else {
+            delete baton;
+            Napi::TypeError::New(env, "Operation must have SQL or a statement").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+
+        if (params.IsUndefined() || params.IsNull()) {
+            continue;
+        }
+        if (!params.IsArray() && !params.IsObject()) {
+            Napi::Array single = Napi::Array::New(env, 1);
+            single.Set((uint32_t)0, params);
+            params = single;
+        }
+        Statement::ParseParameters(params, op->parameters);
+        bytes += Statement::ParameterBytes(op->parameters);
+    }
+
+    if (bytes) {
+        baton->memory += bytes;
+        db->AdjustExternalMemory(bytes);
+        db->ReportExternalMemory();
+    }
+
+    db->Schedule(Work_BeginTransaction, baton, true);
+
+    return info.This();
+}
+
+void Database::Work_BeginTransaction(Baton* b) {
+    assert(b->db->locked);
+    assert(b->db->open);
+    assert(b->db->_handle);
+    assert(b->db->pending == 0);
+    TransactionBaton* baton = static_cast<TransactionBaton*>(b);
+
+    // Statements are locked for the duration so that none of their own
+    // queued work runs on them from another thread in the meantime. A
+    // statement used by several operations is locked, and later unlocked,
+    // by the first of them.
+    std::set<Statement*> statements;
+    for (unsigned int i = 0; i < baton->ops.size(); i++) {
+        TransactionOp* op = baton->ops[i];
+        if (op->stmt == NULL || statements.count(op->stmt)) continue;
+        if (!op->stmt->prepared || op->stmt->finalized || op->stmt->locked) {
+            baton->status = SQLITE_MISUSE;
+            baton->message = "Statement is not prepared or is in use";
+            baton->failed = i;
+            break;
+        }
+        op->stmt->locked = true;
+        op->locked = true;
+        statements.insert(op->stmt);
+    }
+
+    baton->db->QueueWork(&baton->request, "sqlite3.Database.Transaction",
+        Work_Transaction, Work_AfterTransaction, baton);
+}
+
+void Database::Work_Transaction(napi_env e, void* data) {
+    TransactionBaton* baton = static_cast<TransactionBaton*>(data);
+    if (baton->status != SQLITE_OK) return;
+
+    sqlite3* db = baton->db->_handle;
+    Database::NoBusyWait busy_scope(baton->db->busy_retry > 0);
+    sqlite3_mutex* mtx = sqlite3_db_mutex(db);
+    sqlite3_mutex_enter(mtx);
+
+    bool nested = !sqlite3_get_autocommit(db);
+    int status = sqlite3_exec(db,
+        nested ? "SAVEPOINT node_sqlite3_transaction" : "BEGIN", NULL, NULL, NULL);
+    if (status != SQLITE_OK) {
+        baton->message = std::string(sqlite3_errmsg(db));
+    }
+    else if (nested) {
+        // Rolling back to a savepoint doesn't call the rollback hook.
+        baton->db->MarkChanges();
+    }
+    bool marked = status == SQLITE_OK && nested;
+
+    size_t bytes = 0;
+    for (unsigned int i = 0; status == SQLITE_OK && i < baton->ops.size(); i++) {
+        TransactionOp* op = baton->ops[i];
+        sqlite3_stmt* stmt = NULL;
+        if (baton->isolate) {
+            status = sqlite3_exec(db, "SAVEPOINT node_sqlite3_operation", NULL, NULL, NULL);
+            if (status != SQLITE_OK) {
+                baton->message = std::string(sqlite3_errmsg(db));
+                baton->failed = i;
+                break;
+            }
+            baton->db->MarkChanges();
+        }
+        if (op->stmt) {
+            stmt = op->stmt->_handle;
+            sqlite3_reset(stmt);
+        }
+        else {
+            status = sqlite3_prepare_v2(db, op->sql.c_str(), op->sql.size(), &stmt, NULL);
+        }
+
+        if (status == SQLITE_OK && !op->parameters.empty()) {
+            status = Statement::BindParameters(stmt, op->parameters);
+        }
+
+        if (status == SQLITE_OK && stmt != NULL) {
+            op->columns = sqlite3_column_count(stmt);
+            while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+                Row* row = new Row();
+                bytes += Statement::GetRow(row, stmt);
+                op->rows.push_back(row);
+            }
+            if (status == SQLITE_DONE) {
+                status = SQLITE_OK;
+                op->inserted_id = sqlite3_last_insert_rowid(db);
+                op->changes = sqlite3_changes(db);
+            }
+        }
+
+        std::string message;
+        if (status != SQLITE_OK) {
+            message = std::string(sqlite3_errmsg(db));
+            baton->shared_cache_locked =
+                sqlite3_extended_errcode(db) == SQLITE_LOCKED_SHAREDCACHE;
+        }
+
+        if (op->stmt) {
+            sqlite3_reset(stmt);
+            op->stmt->status = SQLITE_OK;
+        }
+        else {
+            sqlite3_finalize(stmt);
+        }
+
+        if (baton->isolate) {
+            if (status == SQLITE_OK) {
+                status = sqlite3_exec(db, "RELEASE node_sqlite3_operation", NULL, NULL, NULL);
+                baton->db->ReleaseChanges();
+            }
+            else if (status != SQLITE_BUSY && !baton->shared_cache_locked &&
+                     !sqlite3_get_autocommit(db)) {
+                // Lock contention affects the whole batch, so it isn't
+                // treated as the failure of a single operation.
+                op->status = status;
+                op->message = message;
+                status = sqlite3_exec(db, "ROLLBACK TO node_sqlite3_operation; "
+                    "RELEASE node_sqlite3_operation", NULL, NULL, NULL);
+                baton->db->RollbackChanges();
+            }
+            else {
+                // The whole batch is rolled back below.
+                baton->db->RollbackChanges();
+            }
+            if (status != SQLITE_OK && message.empty()) {
+                message = std::string(sqlite3_errmsg(db));
+            }
+        }
+
+        if (status != SQLITE_OK) {
+            baton->message = message;
+            baton->failed = i;
+        }
+    }
+
+    if (status == SQLITE_OK) {
+        status = sqlite3_exec(db,
+            nested ? "RELEASE node_sqlite3_transaction" : "COMMIT", NULL, NULL, NULL);
+        if (status != SQLITE_OK) {
+            baton->message = std::string(sqlite3_errmsg(db));
+        }
+        else if (marked) {
+            baton->db->ReleaseChanges();
+        }
+    }
+
+    if (status != SQLITE_OK) {
+        // Some errors already roll back the transaction themselves, in which
+        // case this fails harmlessly.
+        sqlite3_exec(db, nested ?
+            "ROLLBACK TO node_sqlite3_transaction; RELEASE node_sqlite3_transaction" :
+            "ROLLBACK", NULL, NULL, NULL);
+        if (marked) {
+            baton->db->RollbackChanges();
+        }
+    }
+
+    baton->db->ConfirmCommit();
+    sqlite3_mutex_leave(mtx);
+
+    baton->status = status;
+    baton->memory += bytes;
+    baton->rows_memory += bytes;
+    baton->db->AdjustExternalMemory(bytes);
+}
+
+void Database::Work_AfterTransaction(napi_env e, napi_status status, void* data) {
+    TransactionBaton* baton = static_cast<TransactionBaton*>(data);
+
+    Database* db = baton->db;
+
+    if ((baton->status == SQLITE_BUSY && db->DeferBusy(&baton->busy,
+            &baton->request, "sqlite3.Database.Transaction",
+            Work_Transaction, Work_AfterTransaction, baton)) ||
+        (baton->status == SQLITE_LOCKED && baton->shared_cache_locked &&
+            db->DeferLocked(&baton->request, "sqlite3.Database.Transaction",
+            Work_Transaction, Work_AfterTransaction, baton))) {
+        // Everything was rolled back; start over from a clean slate.
+        for (unsigned int i = 0; i < baton->ops.size(); i++) {
+            ClearRows(baton->ops[i]->rows);
+            baton->ops[i]->status = SQLITE_OK;
+            baton->ops[i]->message.clear();
+        }
+        db->AdjustExternalMemory(-baton->rows_memory);
+        baton->memory -= baton->rows_memory;
+        baton->rows_memory = 0;
+        baton->status = SQLITE_OK;
+        baton->message.clear();
+        baton->failed = -1;
+        baton->shared_cache_locked = false;
+        return;
+    }
+
+    Napi::Env env = db->Env();
+    Napi::HandleScope scope(env);
+
+    db->ReportExternalMemory();
+
+    Napi::Function cb = baton->callback.Value();
+
+    if (baton->status != SQLITE_OK) {
+        EXCEPTION(Napi::String::New(env, baton->message.c_str()), baton->status, exception);
+        if (baton->failed >= 0) {
+            exception_obj.Set(Napi::String::New(env, "index"), Napi::Number::New(env, baton->failed));
+        }
+
+        if (!cb.IsUndefined() && cb.IsFunction()) {
+            Napi::Value argv[] = { exception };
+            TRY_CATCH_CALL(db->Value(), cb, 1, argv);
+        }
+        else {
+            Napi::Value info[] = { Napi::String::New(env, "error"), exception };
+            EMIT_EVENT(db->Value(), 2, info);
+        }
+    }
+    else if (!cb.IsUndefined() && cb.IsFunction()) {
+        Napi::Array results = Napi::Array::New(env, baton->ops.size());
+        for (unsigned int i = 0; i < baton->ops.size(); i++) {
+            TransactionOp* op = baton->ops[i];
+            Napi::Object result = Napi::Object::New(env);
+            if (op->status != SQLITE_OK) {
+                EXCEPTION(Napi::String::New(env, op->message.c_str()), op->status, error);
+                result.Set(Napi::String::New(env, "error"), error);
+                results.Set(i, result);
+                continue;
+            }
+            result.Set(Napi::String::New(env, "lastID"), Napi::Number::New(env, op->inserted_id));
+            result.Set(Napi::String::New(env, "changes"), Napi::Number::New(env, op->changes));
+            if (op->columns) {
+                Napi::Array rows = Napi::Array::New(env, op->rows.size());
+                for (unsigned int j = 0; j < op->rows.size(); j++) {
+                    rows.Set(j, Statement::RowToJS(env, op->rows[j]));
+                    delete op->rows[j];
+                }
+                op->rows.clear();
+                result.Set(Napi::String::New(env, "rows"), rows);
+            }
+            results.Set(i, result);
+        }
+        Napi::Value argv[] = { env.Null(), results };
+        TRY_CATCH_CALL(db->Value(), cb, 2, argv);
+    }
+
+    db->Process();
+
+    for (unsigned int i = 0; i < baton->ops.size(); i++) {
+        TransactionOp* op = baton->ops[i];
+        if (op->locked) {
+            op->stmt->locked = false;
+            op->locked = false;
+            op->stmt->Process();
+        }
+    }
+
+    if (baton->request) napi_delete_async_work(e, baton->request);
+    delete baton;
+}
+
+// Database#snapshot([callback])
+//
+// Records the version of the database this connection currently reads, or
+// the latest one when it isn't in a transaction. The snapshot can be passed
+// to openSnapshot() on any connection to the same WAL-mode database, so that
+// reads spread over several connections all see the same commit.
+Napi::Value Database::Snapshot(const Napi::CallbackInfo& info) {
+    Napi::Env env = this->Env();
+    Database* db = this;
+
+    OPTIONAL_ARGUMENT_FUNCTION(0, callback);
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    Baton* baton = new SnapshotBaton(db, callback);
+    db->Schedule(Work_BeginSnapshot, baton, true);
+    return info.This();
+#else
+    Napi::Error::New(env, "Snapshots are not supported by this build of SQLite").ThrowAsJavaScriptException();
+    return env.Null();
+#endif
+}
+
+void Database::Work_BeginSnapshot(Baton* baton) {
+    assert(baton->db->locked);
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    assert(baton->db->pending == 0);
+    baton->db->QueueWork(&baton->request, "sqlite3.Database.Snapshot",
+        Work_Snapshot, Work_AfterSnapshot, baton);
+}
+
+void Database::Work_Snapshot(napi_env e, void* data) {
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    SnapshotBaton* baton = static_cast<SnapshotBaton*>(data);
+    sqlite3* db = baton->db->_handle;
+
+    // sqlite3_snapshot_get() needs an open read transaction.
+    bool autocommit = sqlite3_get_autocommit(db);
+    int status = SQLITE_OK;
+    if (autocommit) {
+        status = sqlite3_exec(db, "BEGIN; SELECT COUNT(*) FROM sqlite_master",
+            NULL, NULL, NULL);
+    }
+    if (status == SQLITE_OK) {
+        status = sqlite3_snapshot_get(db, "main", &baton->snapshot);
+    }
+    if (status != SQLITE_OK) {
+        baton->status = status;
+        baton->message = std::string(sqlite3_errmsg(db));
+    }
+    if (autocommit) {
+        sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+    }
+#endif
+}
+
+void Database::Work_AfterSnapshot(napi_env e, napi_status status, void* data) {
+    SnapshotBaton* baton = static_cast<SnapshotBaton*>(data);
+
+    Database* db = baton->db;
+
+    Napi::Env env = db->Env();
+    Napi::HandleScope scope(env);
+
+    Napi::Function cb = baton->callback.Value();
+
+    if (baton->status != SQLITE_OK) {
+        EXCEPTION(Napi::String::New(env, baton->message.c_str()), baton->status, exception);
+
+        if (!cb.IsUndefined() && cb.IsFunction()) {
+            Napi::Value argv[] = { exception };
+            TRY_CATCH_CALL(db->Value(), cb, 1, argv);
+        }
+        else {
+            Napi::Value info[] = { Napi::String::New(env, "error"), exception };
+            EMIT_EVENT(db->Value(), 2, info);
+        }
+    }
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    else {
+        // The snapshot is freed once the handle is garbage collected.
+        Napi::Value snapshot = Napi::External<sqlite3_snapshot>::New(env,
+            baton->snapshot, [](Napi::Env, sqlite3_snapshot* snapshot) {
+                sqlite3_snapshot_free(snapshot);
+            });
+        baton->snapshot = NULL;
+        if (!cb.IsUndefined() && cb.IsFunction()) {
+            Napi::Value argv[] = { env.Null(), snapshot };
+            TRY_CATCH_CALL(db->Value(), cb, 2, argv);
+        }
+    }
+#endif
+
+    db->Process();
+
+    if (baton->request) napi_delete_async_work(e, baton->request);
+    delete baton;
+}
+
+// Database#openSnapshot(snapshot, [callback])
+//
+// Starts a read transaction that sees the database as it was when the
+// snapshot was taken. It lasts until it is ended with COMMIT or ROLLBACK.
+Napi::Value Database::OpenSnapshot(const Napi::CallbackInfo& info) {
+    Napi::Env env = this->Env();
+    Database* db = this;
+
+    if (info.Length() <= 0 || !info[0].IsExternal()) {
+        Napi::TypeError::New(env, "Snapshot expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    OPTIONAL_ARGUMENT_FUNCTION(1, callback);
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    Napi::External<sqlite3_snapshot> handle = info[0].As<Napi::External<sqlite3_snapshot> >();
+    SnapshotBaton* baton = new SnapshotBaton(db, callback, handle.Data());
+    baton->handle = Napi::Persistent(handle);
+    db->Schedule(Work_BeginOpenSnapshot, baton, true);
+    return info.This();
+#else
+    Napi::Error::New(env, "Snapshots are not supported by this build of SQLite").ThrowAsJavaScriptException();
+    return env.Null();
+#endif
+}
+
+void Database::Work_BeginOpenSnapshot(Baton* baton) {
+    assert(baton->db->locked);
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    assert(baton->db->pending == 0);
+    baton->db->QueueWork(&baton->request, "sqlite3.Database.OpenSnapshot",
+        Work_OpenSnapshot, Work_AfterOpenSnapshot, baton);
+}
+
+void Database::Work_OpenSnapshot(napi_env e, void* data) {
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    SnapshotBaton* baton = static_cast<SnapshotBaton*>(data);
+    sqlite3* db = baton->db->_handle;
+
+    int status = sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    if (status == SQLITE_OK) {
+        status = sqlite3_snapshot_open(db, "main", baton->snapshot);
+        if (status != SQLITE_OK) {
+            baton->message = std::string(sqlite3_errmsg(db));
+            sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        }
+    }
+    else {
+        baton->message = std::string(sqlite3_errmsg(db));
+    }
+    baton->status = status;
+    // Only borrowed from the JS handle, which the baton holds on to.
+    baton->snapshot = NULL;
+#endif
+}
+
+void Database::Work_AfterOpenSnapshot(napi_env e, napi_status status, void* data) {
+    SnapshotBaton* baton = static_cast<SnapshotBaton*>(data);
+
+    Database* db = baton->db;
 
-void Database::ProfileCallback(Database *db, ProfileInfo* info) {
     Napi::Env env = db->Env();
     Napi::HandleScope scope(env);
 
-    Napi::Value argv[] = {
-        Napi::String::New(env, "profile"),
-        Napi::String::New(env, info->sql.c_str()),
-        Napi::Number::New(env, (double)info->nsecs / 1000000.0)
-    };
-    EMIT_EVENT(db->Value(), 3, argv);
-    delete info;
-}
+    Napi::Function cb = baton->callback.Value();
 
-void Database::RegisterUpdateCallback(Baton* baton) {
-    assert(baton->db->open);
-    assert(baton->db->_handle);
-    Database* db = baton->db;
+    if (baton->status != SQLITE_OK) {
+        EXCEPTION(Napi::String::New(env, baton->message.c_str()), baton->status, exception);
 
-    if (db->update_event == NULL) {
-        // Add it.
-        db->update_event = new AsyncUpdate(db, UpdateCallback);
-        sqlite3_update_hook(db->_handle, UpdateCallback, db);
+        if (!cb.IsUndefined() && cb.IsFunction()) {
+            Napi::Value argv[] = { exception };
+            TRY_CATCH_CALL(db->Value(), cb, 1, argv);
+        }
+        else {
+            Napi::Value info[] = { Napi::String::New(env, "error"), exception };
+            EMIT_EVENT(db->Value(), 2, info);
+        }
     }
-    else {
-        // Remove it.
-        sqlite3_update_hook(db->_handle, NULL, NULL);
-        db->update_event->finish();
-        db->update_event = NULL;
+    else if (!cb.IsUndefined() && cb.IsFunction()) {
+        Napi::Value argv[] = { env.Null() };
+        TRY_CATCH_CALL(db->Value(), cb, 1, argv);
     }
 
+    db->Process();
+
+    if (baton->request) napi_delete_async_work(e, baton->request);
     delete baton;
 }
 
-void Database::UpdateCallback(void* db, int type, const char* database,
-        const char* table, sqlite3_int64 rowid) {
-    // Note: This function is called in the thread pool.
-    // Note: Some queries, such as "EXPLAIN" queries, are not sent through this.
-    UpdateInfo* info = new UpdateInfo();
-    info->type = type;
-    info->database = std::string(database);
-    info->table = std::string(table);
-    info->rowid = rowid;
-    static_cast<Database*>(db)->update_event->send(info);
+#ifdef SQLITE_ENABLE_SESSION
+// Names of the kinds of conflict, indexed by SQLITE_CHANGESET_DATA and so on.
+static const char* conflict_names[] = {
+    NULL, "data", "notFound", "conflict", "constraint", "foreignKey"
+};
+
+static bool ParseConflictAction(Napi::Value value, int* action) {
+    if (!value.IsString()) return false;
+    std::string name = value.As<Napi::String>().Utf8Value();
+    if (name == "omit") *action = SQLITE_CHANGESET_OMIT;
+    else if (name == "replace") *action = SQLITE_CHANGESET_REPLACE;
+    else if (name == "abort") *action = SQLITE_CHANGESET_ABORT;
+    else return false;
+    return true;
 }
 
-void Database::UpdateCallback(Database *db, UpdateInfo* info) {
-    Napi::Env env = db->Env();
-    Napi::HandleScope scope(env);
-
-    Napi::Value argv[] = {
-        Napi::String::New(env, sqlite_authorizer_string(info->type)),
-        Napi::String::New(env, info->database.c_str()),
-        Napi::String::New(env, info->table.c_str()),
-        Napi::Number::New(env, info->rowid),
-    };
-    EMIT_EVENT(db->Value(), 4, argv);
-    delete info;
+// Called on the worker for each conflict, so it can't call into JS; the
+// action for each kind of conflict is decided up front instead.
+static int ApplyChangesetConflict(void* data, int type, sqlite3_changeset_iter* iter) {
+    Database::ApplyChangesetBaton* baton = static_cast<Database::ApplyChangesetBaton*>(data);
+    baton->conflicts++;
+    int action = baton->actions[type];
+    if (action == SQLITE_CHANGESET_REPLACE &&
+            type != SQLITE_CHANGESET_DATA && type != SQLITE_CHANGESET_CONFLICT) {
+        // SQLite only allows replacing the row that is in the way.
+        action = SQLITE_CHANGESET_OMIT;
+    }
+    if (action == SQLITE_CHANGESET_ABORT) {
+        baton->aborted = type;
+    }
+    return action;
 }
+#endif
 
-Napi::Value Database::Exec(const Napi::CallbackInfo& info) {
+// Database#applyChangeset(changeset, [onConflict], [callback])
+//
+// Applies a changeset or patchset made by Session#changeset() or #patchset()
+// in a single transaction. onConflict is 'abort' (the default), 'omit' or
+// 'replace', or an object choosing one of these for each kind of conflict:
+// { data, notFound, conflict, constraint, foreignKey }. 'replace' only
+// applies to data and conflict conflicts; others are omitted instead. The
+// callback gets the number of conflicts that were encountered.
+Napi::Value Database::ApplyChangeset(const Napi::CallbackInfo& info) {
     Napi::Env env = this->Env();
     Database* db = this;
 
-    REQUIRE_ARGUMENT_STRING(0, sql);
-    OPTIONAL_ARGUMENT_FUNCTION(1, callback);
+    if (info.Length() <= 0 || !info[0].IsBuffer()) {
+        Napi::TypeError::New(env, "Changeset buffer expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    Napi::Value policy = env.Undefined();
+    Napi::Function callback;
+    if (info.Length() > 1 && info[1].IsFunction()) {
+        callback = info[1].As<Napi::Function>();
+    }
+    else {
+        if (info.Length() > 1) policy = info[1];
+        if (info.Length() > 2 && !info[2].IsUndefined()) {
+            if (!info[2].IsFunction()) {
+                Napi::TypeError::New(env, "Callback expected").ThrowAsJavaScriptException();
+                return env.Null();
+            }
+            callback = info[2].As<Napi::Function>();
+        }
+    }
 
-    Baton* baton = new ExecBaton(db, callback, sql.c_str());
-    db->Schedule(Work_BeginExec, baton, true);
+#ifdef SQLITE_ENABLE_SESSION
+    int actions[SQLITE_CHANGESET_FOREIGN_KEY + 1];
+    for (int i = 0; i <= SQLITE_CHANGESET_FOREIGN_KEY; i++) {
+        actions[i] = SQLITE_CHANGESET_ABORT;
+    }
+    bool valid = true;
+    if (policy.IsString()) {
+        int action;
+        valid = ParseConflictAction(policy, &action);
+        for (int i = 0; valid && i <= SQLITE_CHANGESET_FOREIGN_KEY; i++) {
+            actions[i] = action;
+        }
+    }
+    else if (policy.IsObject()) {
+        Napi::Object object = policy.As<Napi::Object>();
+        for (int i = SQLITE_CHANGESET_DATA; valid && i <= SQLITE_CHANGESET_FOREIGN_KEY; i++) {
+            Napi::Value value = object.Get(conflict_names[i]);
+            if (!value.IsUndefined()) {
+                valid = ParseConflictAction(value, &actions[i]);
+            }
+        }
+    }
+    else if (!policy.IsUndefined() && !policy.IsNull()) {
+        valid = false;
+    }
+    if (!valid) {
+        Napi::TypeError::New(env, "Conflict action must be 'abort', 'omit' or 'replace'").ThrowAsJavaScriptException();
+        return env.Null();
+    }
 
+    ApplyChangesetBaton* baton = new ApplyChangesetBaton(db, callback);
+    Napi::Buffer<char> buffer = info[0].As<Napi::Buffer<char> >();
+    baton->changeset.assign(buffer.Data(), buffer.Data() + buffer.Length());
+    memcpy(baton->actions, actions, sizeof(actions));
+    db->Schedule(Work_BeginApplyChangeset, baton, true);
     return info.This();
+#else
+    Napi::Error::New(env, "Sessions are not supported by this build of SQLite").ThrowAsJavaScriptException();
+    return env.Null();
+#endif
 }
 
-void Database::Work_BeginExec(Baton* baton) {
+void Database::Work_BeginApplyChangeset(Baton* baton) {
     assert(baton->db->locked);
     assert(baton->db->open);
     assert(baton->db->_handle);
     assert(baton->db->pending == 0);
-    Napi::Env env = baton->db->Env();
-    int status = napi_create_async_work(
-        env, NULL, Napi::String::New(env, "sqlite3.Database.Exec"),
-        Work_Exec, Work_AfterExec, baton, &baton->request
-    );
-    UNUSED(status);
-    assert(status == 0);
-    napi_queue_async_work(env, baton->request);
+    baton->db->QueueWork(&baton->request, "sqlite3.Database.ApplyChangeset",
+        Work_ApplyChangeset, Work_AfterApplyChangeset, baton);
 }
 
-void Database::Work_Exec(napi_env e, void* data) {
-    ExecBaton* baton = static_cast<ExecBaton*>(data);
-
-    char* message = NULL;
-    baton->status = sqlite3_exec(
-        baton->db->_handle,
-        baton->sql.c_str(),
-        NULL,
-        NULL,
-        &message
-    );
-
-    if (baton->status != SQLITE_OK && message != NULL) {
-        baton->message = std::string(message);
-        sqlite3_free(message);
+void Database::Work_ApplyChangeset(napi_env e, void* data) {
+#ifdef SQLITE_ENABLE_SESSION
+    ApplyChangesetBaton* baton = static_cast<ApplyChangesetBaton*>(data);
+    sqlite3* db = baton->db->_handle;
+
+    sqlite3_mutex* mtx = sqlite3_db_mutex(db);
+    sqlite3_mutex_enter(mtx);
+    int status = sqlite3changeset_apply(db, baton->changeset.size(),
+        baton->changeset.empty() ? NULL : &baton->changeset[0],
+        NULL, ApplyChangesetConflict, baton);
+    baton->db->ConfirmCommit();
+    sqlite3_mutex_leave(mtx);
+
+    if (status != SQLITE_OK) {
+        baton->status = status;
+        if (status == SQLITE_ABORT && baton->aborted) {
+            baton->message = std::string("Changeset aborted on a ") +
+                conflict_names[baton->aborted] + " conflict";
+        }
+        else {
+            baton->message = std::string(sqlite3_errmsg(db));
+        }
     }
+#endif
 }
 
-void Database::Work_AfterExec(napi_env e, napi_status status, void* data) {
-    ExecBaton* baton = static_cast<ExecBaton*>(data);
+void Database::Work_AfterApplyChangeset(napi_env e, napi_status status, void* data) {
+#ifdef SQLITE_ENABLE_SESSION
+    ApplyChangesetBaton* baton = static_cast<ApplyChangesetBaton*>(data);
 
     Database* db = baton->db;
 
@@ -605,14 +2521,15 @@ void Database::Work_AfterExec(napi_env e, napi_status status, void* data) {
         }
     }
     else if (!cb.IsUndefined() && cb.IsFunction()) {
-        Napi::Value argv[] = { env.Null() };
-        TRY_CATCH_CALL(db->Value(), cb, 1, argv);
+        Napi::Value argv[] = { env.Null(), Napi::Number::New(env, baton->conflicts) };
+        TRY_CATCH_CALL(db->Value(), cb, 2, argv);
     }
 
     db->Process();
 
-    napi_delete_async_work(e, baton->request);
+    if (baton->request) napi_delete_async_work(e, baton->request);
     delete baton;
+#endif
 }
 
 Napi::Value Database::Wait(const Napi::CallbackInfo& info) {
@@ -665,14 +2582,8 @@ void Database::Work_BeginLoadExtension(Baton* baton) {
     assert(baton->db->open);
     assert(baton->db->_handle);
     assert(baton->db->pending == 0);
-    Napi::Env env = baton->db->Env();
-    int status = napi_create_async_work(
-        env, NULL, Napi::String::New(env, "sqlite3.Database.LoadExtension"),
-        Work_LoadExtension, Work_AfterLoadExtension, baton, &baton->request
-    );
-    UNUSED(status);
-    assert(status == 0);
-    napi_queue_async_work(env, baton->request);
+    baton->db->QueueWork(&baton->request, "sqlite3.Database.LoadExtension",
+        Work_LoadExtension, Work_AfterLoadExtension, baton);
 }
 
 void Database::Work_LoadExtension(napi_env e, void* data) {
@@ -725,7 +2636,7 @@ void Database::Work_AfterLoadExtension(napi_env e, napi_status status, void* dat
 
     db->Process();
 
-    napi_delete_async_work(e, baton->request);
+    if (baton->request) napi_delete_async_work(e, baton->request);
     delete baton;
 }
 
@@ -738,4 +2649,439 @@ void Database::RemoveCallbacks() {
         debug_profile->finish();
         debug_profile = NULL;
     }
+    if (update_event) {
+        update_event->finish();
+        update_event = NULL;
+    }
+    if (changes_event) {
+        changes_event->finish();
+        changes_event = NULL;
+    }
+    if (preupdate_event) {
+        preupdate_event->finish();
+        preupdate_event = NULL;
+    }
+}
+
+// Sessions have to be deleted before the connection they record is closed.
+// The Session objects live on until they are garbage collected, unless the
+// database goes first, as it may when the environment is torn down.
+void Database::CloseSessions(bool detach) {
+#ifdef SQLITE_ENABLE_SESSION
+    std::set<Session*>::iterator it = sessions.begin();
+    for (; it != sessions.end(); ++it) {
+        (*it)->Delete();
+        if (detach) (*it)->db = NULL;
+    }
+    if (detach) sessions.clear();
+#endif
+}
+
+// The number of threads in libuv's threadpool, worked out the way libuv does.
+static int ThreadpoolSize() {
+    const char* value = getenv("UV_THREADPOOL_SIZE");
+    int size = value ? atoi(value) : 4;
+    return size < 1 ? 1 : size > 1024 ? 1024 : size;
+}
+
+// Database#allMarshalPartitioned(sql, { table, key, partitions }, [callback])
+//
+// Like allMarshal(), but splits the scan into key ranges that run in
+// parallel, each on its own read-only connection to the database file. The
+// query selects a range with $start <= key < $end; the ranges cover the
+// table's key from min() to max() and the result is concatenated in range
+// order. The ranges are shared out among no more threads than the threadpool
+// has, or than sqlite3.configure('maxConcurrency') allows.
+Napi::Value Database::AllMarshalPartitioned(const Napi::CallbackInfo& info) {
+    Napi::Env env = this->Env();
+    Database* db = this;
+
+    REQUIRE_ARGUMENT_STRING(0, sql);
+    if (info.Length() <= 1 || !info[1].IsObject()) {
+        Napi::TypeError::New(env, "Options object expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    OPTIONAL_ARGUMENT_FUNCTION(2, callback);
+
+    Napi::Object options = info[1].As<Napi::Object>();
+    Napi::Value table = options.Get("table");
+    Napi::Value key = options.Get("key");
+    Napi::Value partitions = options.Get("partitions");
+    if (!table.IsString()) {
+        Napi::TypeError::New(env, "Table name expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    if (!key.IsUndefined() && !key.IsString()) {
+        Napi::TypeError::New(env, "Key column must be a string").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    int count = 4;
+    if (!partitions.IsUndefined()) {
+        if (!partitions.IsNumber() || partitions.As<Napi::Number>().Int32Value() < 1 ||
+                partitions.As<Napi::Number>().Int32Value() > 64) {
+            Napi::RangeError::New(env, "Partitions must be between 1 and 64").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        count = partitions.As<Napi::Number>().Int32Value();
+    }
+
+    PartitionBaton* baton = new PartitionBaton(db, callback);
+    baton->sql = sql;
+    baton->table = table.As<Napi::String>().Utf8Value();
+    baton->key = key.IsString() ? key.As<Napi::String>().Utf8Value() : "rowid";
+    baton->partitions = count;
+    int threads = ThreadpoolSize();
+    unsigned int max_concurrency = GetAddonData(env)->max_concurrency;
+    if (max_concurrency && max_concurrency < (unsigned int)threads) {
+        threads = max_concurrency;
+    }
+    baton->threads = count < threads ? count : threads;
+    baton->max_rows = db->max_rows;
+    baton->max_bytes = db->max_bytes;
+    db->Schedule(Work_BeginAllMarshalPartitioned, baton);
+
+    return info.This();
+}
+
+void Database::Work_BeginAllMarshalPartitioned(Baton* baton) {
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    baton->db->pending++;
+    baton->db->QueueWork(&baton->request, "sqlite3.Database.AllMarshalPartitioned",
+        Work_AllMarshalPartitioned, Work_AfterAllMarshalPartitioned, baton);
+}
+
+namespace {
+
+struct Partition {
+    Partition() : handle(NULL), start(0), end(0), end_overflow(false),
+        countRows(0), status(SQLITE_OK) {}
+    sqlite3* handle;
+    const std::string* sql;
+    sqlite3_int64 start;
+    sqlite3_int64 end;
+    // The range ends just past INT64_MAX, which is bound as a double.
+    bool end_overflow;
+    std::vector<std::string> colNames;
+    std::vector<Marshaller> colData;
+    int countRows;
+    int status;
+    std::string message;
+};
+
+// Scans every step-th partition from first on.
+struct PartitionScanner {
+    std::vector<Partition>* parts;
+    size_t first;
+    size_t step;
+    uv_thread_t thread;
+    bool started;
+};
+
+std::string QuoteIdentifier(const std::string& name) {
+    std::string quoted("\"");
+    for (size_t i = 0; i < name.size(); i++) {
+        if (name[i] == '"') quoted += '"';
+        quoted += name[i];
+    }
+    return quoted + "\"";
+}
+
+int BindRangeParameter(sqlite3_stmt* stmt, const char* name) {
+    static const char prefixes[] = { '$', ':', '@' };
+    for (size_t i = 0; i < sizeof(prefixes); i++) {
+        std::string parameter = prefixes[i] + std::string(name);
+        int index = sqlite3_bind_parameter_index(stmt, parameter.c_str());
+        if (index) return index;
+    }
+    return 0;
+}
+
+void ScanPartition(void* data) {
+    Partition* part = static_cast<Partition*>(data);
+    sqlite3_stmt* stmt = NULL;
+
+    part->status = sqlite3_prepare_v2(part->handle, part->sql->c_str(),
+        part->sql->size(), &stmt, NULL);
+    if (part->status == SQLITE_OK) {
+        int start = BindRangeParameter(stmt, "start");
+        int end = BindRangeParameter(stmt, "end");
+        if (!start || !end) {
+            part->status = SQLITE_MISUSE;
+            part->message = "Query must select a key range with $start and $end";
+            sqlite3_finalize(stmt);
+            return;
+        }
+        sqlite3_bind_int64(stmt, start, part->start);
+        if (part->end_overflow) {
+            sqlite3_bind_double(stmt, end, 9223372036854775808.0);
+        }
+        else {
+            sqlite3_bind_int64(stmt, end, part->end);
+        }
+
+        int columns = sqlite3_column_count(stmt);
+        part->colNames.resize(columns);
+        part->colData.resize(columns);
+        for (int i = 0; i < columns; i++) {
+            part->colNames[i] = std::string(sqlite3_column_name(stmt, i));
+        }
+
+        while ((part->status = sqlite3_step(stmt)) == SQLITE_ROW) {
+            part->countRows++;
+            Statement::MarshalRow(stmt, part->colData);
+        }
+        if (part->status == SQLITE_DONE) {
+            part->status = SQLITE_OK;
+        }
+    }
+    if (part->status != SQLITE_OK) {
+        part->message = std::string(sqlite3_errmsg(part->handle));
+    }
+    sqlite3_finalize(stmt);
+}
+
+void ScanPartitions(void* data) {
+    PartitionScanner* scanner = static_cast<PartitionScanner*>(data);
+    for (size_t i = scanner->first; i < scanner->parts->size(); i += scanner->step) {
+        ScanPartition(&(*scanner->parts)[i]);
+    }
+}
+
+// Runs sql on handle and returns the first column of the first row as text.
+std::string QueryText(sqlite3* handle, const std::string& sql, int* status) {
+    std::string result;
+    sqlite3_stmt* stmt = NULL;
+    *status = sqlite3_prepare_v2(handle, sql.c_str(), sql.size(), &stmt, NULL);
+    if (*status == SQLITE_OK) {
+        *status = sqlite3_step(stmt);
+        if (*status == SQLITE_ROW) {
+            const char* text = (const char*)sqlite3_column_text(stmt, 0);
+            if (text) result = text;
+            *status = SQLITE_OK;
+        }
+        else if (*status == SQLITE_DONE) {
+            *status = SQLITE_OK;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+}
+
+void Database::Work_AllMarshalPartitioned(napi_env e, void* data) {
+    PartitionBaton* baton = static_cast<PartitionBaton*>(data);
+
+    const char* filename = sqlite3_db_filename(baton->db->_handle, "main");
+    if (filename == NULL || filename[0] == '\0') {
+        baton->status = SQLITE_MISUSE;
+        baton->message = "Partitioned scans need a database file";
+        return;
+    }
+
+    std::vector<Partition> parts(baton->partitions);
+    int status;
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_int64 min = 0, max = 0;
+    bool empty = true;
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    sqlite3_snapshot* snapshot = NULL;
+#endif
+
+    // The first connection determines the key range. Its read transaction
+    // stays open until the scan is done, which keeps the other connections
+    // on the same version of the database: in WAL mode they open the same
+    // snapshot, in rollback mode its shared lock holds off any commit.
+    sqlite3* first = NULL;
+    status = sqlite3_open_v2(filename, &first, SQLITE_OPEN_READONLY, NULL);
+    parts[0].handle = first;
+    if (status == SQLITE_OK) {
+        sqlite3_busy_timeout(first, 1000);
+        bool wal = QueryText(first, "PRAGMA journal_mode", &status) == "wal";
+#ifndef SQLITE_ENABLE_SNAPSHOT
+        // Without snapshots, separate connections could see different
+        // versions of a WAL database.
+        if (wal) parts.resize(1);
+#endif
+        if (status == SQLITE_OK) {
+            status = sqlite3_exec(first, "BEGIN", NULL, NULL, NULL);
+        }
+        if (status == SQLITE_OK) {
+            std::string query = "SELECT min(" + QuoteIdentifier(baton->key) + "), max(" +
+                QuoteIdentifier(baton->key) + ") FROM " + QuoteIdentifier(baton->table);
+            status = sqlite3_prepare_v2(first, query.c_str(), query.size(), &stmt, NULL);
+        }
+        if (status == SQLITE_OK && (status = sqlite3_step(stmt)) == SQLITE_ROW) {
+            empty = sqlite3_column_type(stmt, 0) == SQLITE_NULL;
+            min = sqlite3_column_int64(stmt, 0);
+            max = sqlite3_column_int64(stmt, 1);
+            status = SQLITE_OK;
+        }
+        sqlite3_finalize(stmt);
+#ifdef SQLITE_ENABLE_SNAPSHOT
+        if (status == SQLITE_OK && wal && parts.size() > 1) {
+            status = sqlite3_snapshot_get(first, "main", &snapshot);
+        }
+#endif
+    }
+    if (status != SQLITE_OK) {
+        baton->status = status;
+        baton->message = std::string(first ? sqlite3_errmsg(first) : sqlite3_errstr(status));
+        sqlite3_close(first);
+        return;
+    }
+
+    sqlite3_uint64 span = 0;
+    if (empty) {
+        // Still run the query once to get the column names.
+        parts.resize(1);
+        min = 0;
+        max = -1;
+    }
+    else {
+        span = (sqlite3_uint64)max - (sqlite3_uint64)min;
+        if (span < parts.size() - 1) {
+            parts.resize(span + 1);
+        }
+    }
+
+    int count = parts.size();
+    for (int i = 0; i < count; i++) {
+        Partition& part = parts[i];
+        part.sql = &baton->sql;
+        part.start = min + (sqlite3_int64)((span / count) * i + (span % count) * i / count);
+        if (i > 0) {
+            parts[i - 1].end = part.start;
+            if (status == SQLITE_OK) {
+                status = sqlite3_open_v2(filename, &part.handle, SQLITE_OPEN_READONLY, NULL);
+            }
+            if (status == SQLITE_OK) {
+                sqlite3_busy_timeout(part.handle, 1000);
+                status = sqlite3_exec(part.handle, "BEGIN", NULL, NULL, NULL);
+            }
+#ifdef SQLITE_ENABLE_SNAPSHOT
+            if (status == SQLITE_OK && snapshot) {
+                status = sqlite3_snapshot_open(part.handle, "main", snapshot);
+            }
+#endif
+            if (status != SQLITE_OK && baton->status == SQLITE_OK) {
+                baton->status = status;
+                baton->message = std::string(part.handle ? sqlite3_errmsg(part.handle) : sqlite3_errstr(status));
+            }
+        }
+    }
+    if (max == INT64_MAX) {
+        parts[count - 1].end_overflow = true;
+    }
+    else {
+        parts[count - 1].end = max + 1;
+    }
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    if (snapshot) sqlite3_snapshot_free(snapshot);
+#endif
+
+    if (baton->status == SQLITE_OK) {
+        int threads = count < baton->threads ? count : baton->threads;
+        std::vector<PartitionScanner> scanners(threads);
+        for (int i = 0; i < threads; i++) {
+            scanners[i].parts = &parts;
+            scanners[i].first = i;
+            scanners[i].step = threads;
+            scanners[i].started = i > 0 &&
+                uv_thread_create(&scanners[i].thread, ScanPartitions, &scanners[i]) == 0;
+        }
+        // Partitions whose thread couldn't be started are scanned here.
+        for (int i = 0; i < threads; i++) {
+            if (!scanners[i].started) ScanPartitions(&scanners[i]);
+        }
+        for (int i = 1; i < threads; i++) {
+            if (scanners[i].started) uv_thread_join(&scanners[i].thread);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        Partition& part = parts[i];
+        if (baton->status == SQLITE_OK && part.status != SQLITE_OK) {
+            baton->status = part.status;
+            baton->message = part.message;
+        }
+        if (baton->status == SQLITE_OK) {
+            if (i == 0) {
+                baton->colNames = part.colNames;
+                baton->colData.resize(part.colData.size());
+            }
+            for (size_t j = 0; j < part.colData.size(); j++) {
+                if (part.colData[j].getBuffer().size()) {
+                    baton->colData[j].append(part.colData[j]);
+                }
+            }
+            baton->countRows += part.countRows;
+        }
+        sqlite3_close(part.handle);
+    }
+
+    if (baton->status == SQLITE_OK) {
+        for (size_t j = 0; j < baton->colData.size(); j++) {
+            baton->memory += baton->colData[j].getBuffer().size();
+        }
+        const char* exceeded = NULL;
+        sqlite3_int64 limit = 0;
+        if (baton->max_rows > 0 && baton->countRows > baton->max_rows) {
+            exceeded = "maxRows";
+            limit = baton->max_rows;
+        }
+        else if (baton->max_bytes > 0 && baton->memory > baton->max_bytes) {
+            exceeded = "maxBytes";
+            limit = baton->max_bytes;
+        }
+        if (exceeded) {
+            baton->status = SQLITE_TOOBIG;
+            baton->message = std::string("Result exceeds ") + exceeded + " limit of " +
+                std::to_string((long long)limit);
+        }
+        baton->db->AdjustExternalMemory(baton->memory);
+    }
+}
+
+void Database::Work_AfterAllMarshalPartitioned(napi_env e, napi_status status, void* data) {
+    PartitionBaton* baton = static_cast<PartitionBaton*>(data);
+
+    Database* db = baton->db;
+
+    Napi::Env env = db->Env();
+    Napi::HandleScope scope(env);
+
+    db->ReportExternalMemory();
+
+    Napi::Function cb = baton->callback.Value();
+
+    if (baton->status != SQLITE_OK) {
+        EXCEPTION(Napi::String::New(env, baton->message.c_str()), baton->status, exception);
+
+        if (!cb.IsUndefined() && cb.IsFunction()) {
+            Napi::Value argv[] = { exception };
+            TRY_CATCH_CALL(db->Value(), cb, 1, argv);
+        }
+        else {
+            Napi::Value info[] = { Napi::String::New(env, "error"), exception };
+            EMIT_EVENT(db->Value(), 2, info);
+        }
+    }
+    else if (!cb.IsUndefined() && cb.IsFunction()) {
+        Napi::Value result = Statement::MarshalResult(env, baton->colNames,
+            baton->colData, baton->countRows);
+        Napi::Value argv[] = { env.Null(), result };
+        TRY_CATCH_CALL(db->Value(), cb, 2, argv);
+    }
+
+    db->AdjustExternalMemory(-baton->memory);
+    db->ReportExternalMemory();
+
+    assert(db->pending);
+    db->pending--;
+    db->Process();
+
+    if (baton->request) napi_delete_async_work(e, baton->request);
+    delete baton;
 }
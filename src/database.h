@@ -4,24 +4,56 @@
 
 
 #include <assert.h>
+#include <atomic>
 #include <string>
+#include <deque>
+#include <unordered_map>
+#include <memory>
 #include <queue>
+#include <set>
+#include <vector>
 
 #include <sqlite3.h>
 #include <napi.h>
 
+#include "addon.h"
 #include "async.h"
+#include "cancellation.h"
+#include "executor.h"
+#include "marshal.h"
 
 using namespace Napi;
 
 namespace node_sqlite3 {
 
 class Database;
+class Session;
+
+// A call made through one of the promise-returning methods (runAsync(),
+// execAsync(), ...) keeps the deferred of its promise in the baton instead of
+// a callback. These settle it, if there is one, and clear it so that it is
+// only settled once.
+inline napi_value CreateDeferred(napi_env env, napi_deferred* deferred) {
+    napi_value promise = NULL;
+    if (napi_create_promise(env, deferred, &promise) != napi_ok) {
+        *deferred = NULL;
+    }
+    return promise;
+}
+
+inline void ResolveDeferred(napi_env env, napi_deferred& deferred, napi_value value) {
+    napi_resolve_deferred(env, deferred, value);
+    deferred = NULL;
+}
+
+inline void RejectDeferred(napi_env env, napi_deferred& deferred, napi_value error) {
+    napi_reject_deferred(env, deferred, error);
+    deferred = NULL;
+}
 
 
 class Database : public Napi::ObjectWrap<Database> {
 public:
-    static Napi::FunctionReference constructor;
     static Napi::Object Init(Napi::Env env, Napi::Object exports);
 
     static inline bool HasInstance(Napi::Value val) {
@@ -29,7 +61,7 @@ public:
         Napi::HandleScope scope(env);
         if (!val.IsObject()) return false;
         Napi::Object obj = val.As<Napi::Object>();
-        return obj.InstanceOf(constructor.Value());
+        return obj.InstanceOf(GetAddonData(env)->database.Value());
     }
 
     struct Baton {
@@ -38,9 +70,11 @@ public:
         Napi::FunctionReference callback;
         int status;
         std::string message;
+        std::shared_ptr<Cancellation::State> cancellation;
+        napi_deferred deferred;
 
         Baton(Database* db_, Napi::Function cb_) :
-                db(db_), status(SQLITE_OK) {
+                db(db_), status(SQLITE_OK), deferred(NULL) {
             db->Ref();
             if (!cb_.IsUndefined() && cb_.IsFunction()) {
                 callback.Reset(cb_, 1);
@@ -52,6 +86,16 @@ public:
         }
     };
 
+    struct DeferredWork;
+    struct AdmissionJob;
+
+    // How long an operation has been held back by DeferBusy() so far.
+    struct BusyRetry {
+        BusyRetry() : delay(0), waited(0) {}
+        int delay;
+        int waited;
+    };
+
     struct OpenBaton : Baton {
         std::string filename;
         int mode;
@@ -61,8 +105,11 @@ public:
 
     struct ExecBaton : Baton {
         std::string sql;
+        // Where in sql to go on from when the baton is run again.
+        size_t offset;
+        int extended_status;
         ExecBaton(Database* db_, Napi::Function cb_, const char* sql_) :
-            Baton(db_, cb_), sql(sql_) {}
+            Baton(db_, cb_), sql(sql_), offset(0), extended_status(SQLITE_OK) {}
     };
 
     struct LoadExtensionBaton : Baton {
@@ -71,14 +118,84 @@ public:
             Baton(db_, cb_), filename(filename_) {}
     };
 
+    struct SnapshotBaton : Baton {
+        sqlite3_snapshot* snapshot;
+        // Keeps the snapshot of openSnapshot() from being garbage collected
+        // and freed while the baton borrows it.
+        Napi::Reference<Napi::External<sqlite3_snapshot> > handle;
+        SnapshotBaton(Database* db_, Napi::Function cb_, sqlite3_snapshot* snapshot_ = NULL) :
+            Baton(db_, cb_), snapshot(snapshot_) {}
+    };
+
+#ifdef SQLITE_ENABLE_SESSION
+    struct ApplyChangesetBaton : Baton {
+        std::vector<char> changeset;
+        // What to do about each kind of conflict, indexed by
+        // SQLITE_CHANGESET_DATA and so on.
+        int actions[SQLITE_CHANGESET_FOREIGN_KEY + 1];
+        int conflicts;
+        // The kind of conflict that aborted applying the changeset, or 0.
+        int aborted;
+        ApplyChangesetBaton(Database* db_, Napi::Function cb_) :
+            Baton(db_, cb_), conflicts(0), aborted(0) {}
+    };
+#endif
+
+    struct PartitionBaton : Baton {
+        std::string sql;
+        std::string table;
+        std::string key;
+        int partitions;
+        // How many threads, including the worker's own, scan partitions.
+        int threads;
+        sqlite3_int64 max_rows;
+        sqlite3_int64 max_bytes;
+        std::vector<std::string> colNames;
+        std::vector<Marshaller> colData;
+        int countRows;
+        int64_t memory;
+        PartitionBaton(Database* db_, Napi::Function cb_) :
+            Baton(db_, cb_), partitions(1), threads(1), max_rows(0), max_bytes(0),
+            countRows(0), memory(0) {}
+    };
+
+    // One entry of Database#transaction(); defined in database.cc since it
+    // holds statement parameters and result rows.
+    struct TransactionOp;
+
+    struct TransactionBaton : Baton {
+        std::vector<TransactionOp*> ops;
+        // Index of the operation that failed, or -1.
+        int failed;
+        BusyRetry busy;
+        // Whether the failure was a table lock held by another connection
+        // sharing the same cache.
+        bool shared_cache_locked;
+        // Runs each operation in its own savepoint, so that a failing one
+        // is rolled back on its own and reported in its result instead.
+        bool isolate;
+        int64_t memory;
+        // The part of memory taken up by result rows.
+        int64_t rows_memory;
+        TransactionBaton(Database* db_, Napi::Function cb_) :
+            Baton(db_, cb_), failed(-1), shared_cache_locked(false),
+            isolate(false), memory(0), rows_memory(0) {}
+        virtual ~TransactionBaton();
+    };
+
     typedef void (*Work_Callback)(Baton* baton);
 
     struct Call {
         Call(Work_Callback cb_, Baton* baton_, bool exclusive_ = false) :
-            callback(cb_), exclusive(exclusive_), baton(baton_) {};
+            callback(cb_), exclusive(exclusive_), baton(baton_),
+            barrier(false), sequence(0) {};
         Work_Callback callback;
         bool exclusive;
         Baton* baton;
+        // Barriers such as close() and wait() also wait for the calls queued
+        // before them in the other lane; sequence tells which those are.
+        bool barrier;
+        uint64_t sequence;
     };
 
     struct ProfileInfo {
@@ -93,15 +210,84 @@ public:
         sqlite3_int64 rowid;
     };
 
+    // Changes made by a transaction, collected for the 'changes' event. The
+    // update hook appends to the arrays without allocating per row; table
+    // names are only copied the first time a table shows up.
+    struct ChangeKey {
+        uint32_t table;
+        sqlite3_int64 rowid;
+        bool operator==(const ChangeKey& other) const {
+            return table == other.table && rowid == other.rowid;
+        }
+    };
+    struct ChangeKeyHash {
+        size_t operator()(const ChangeKey& key) const {
+            return std::hash<sqlite3_int64>()(key.rowid) * 31 + key.table;
+        }
+    };
+    struct ChangeBatch {
+        ChangeBatch() : removed(0) {}
+        // "table" for tables of the main database, "schema.table" otherwise.
+        std::vector<std::string> tables;
+        // SQLITE_INSERT, SQLITE_UPDATE or SQLITE_DELETE, or 0 for a change
+        // that was cancelled out by a later one of the same row.
+        std::vector<uint8_t> types;
+        std::vector<uint32_t> table_indexes;
+        std::vector<sqlite3_int64> rowids;
+        size_t removed;
+        // Where each row's change is, when coalescing.
+        std::unordered_map<ChangeKey, size_t, ChangeKeyHash> positions;
+        // The types that coalesced changes had before, while one of the
+        // library's savepoints is open.
+        std::vector<std::pair<size_t, uint8_t> > undo;
+    };
+
+    // How far the batches had got when the library opened one of its
+    // savepoints. SQLite doesn't call the rollback hook for ROLLBACK TO, so
+    // the changes it undoes are dropped with RollbackChanges().
+    struct ChangeMark {
+        size_t tables;
+        size_t changes;
+        size_t undo;
+        size_t preupdate_tables;
+        size_t preupdate_changes;
+        size_t preupdate_values;
+    };
+
+    // Row values captured by the preupdate hook, for the 'preupdate' event.
+    // The values are copied with sqlite3_value_dup() so that they can be
+    // converted on the main thread after the transaction commits.
+    struct ValueDeleter {
+        void operator()(sqlite3_value* value) const { sqlite3_value_free(value); }
+    };
+    typedef std::unique_ptr<sqlite3_value, ValueDeleter> ValuePtr;
+    struct PreupdateChange {
+        int type;
+        uint32_t table;
+        sqlite3_int64 old_rowid;
+        sqlite3_int64 new_rowid;
+        int columns;
+        // Position of the old values, followed by the new ones, in the batch.
+        size_t first;
+    };
+    struct PreupdateBatch {
+        std::vector<std::string> tables;
+        std::vector<PreupdateChange> changes;
+        std::vector<ValuePtr> values;
+    };
+
     bool IsOpen() { return open; }
     bool IsLocked() { return locked; }
 
     typedef Async<std::string, Database> AsyncTrace;
     typedef Async<ProfileInfo, Database> AsyncProfile;
     typedef Async<UpdateInfo, Database> AsyncUpdate;
+    typedef Async<ChangeBatch, Database> AsyncChanges;
+    typedef Async<PreupdateBatch, Database> AsyncPreupdate;
 
     friend class Statement;
     friend class Backup;
+    friend class Session;
 
     void init() {
         _handle = NULL;
@@ -110,18 +296,104 @@ public:
         locked = false;
         pending = 0;
         serialize = false;
+        bulk = false;
+        bulk_skipped = 0;
+        queued_calls = 0;
+        max_rows = 0;
+        max_bytes = 0;
+        busy_timeout = 1000;
+        busy_retry = 0;
+        external_memory = 0;
+        executor = NULL;
+        unlock_watcher = NULL;
+        inline_threshold = 0;
+        inline_pending = 0;
+        inline_watcher = NULL;
+        running = 0;
+        deferred_work = 0;
+        admission_ready = false;
         debug_trace = NULL;
         debug_profile = NULL;
         update_event = NULL;
+        update_types = 0;
+        changes_event = NULL;
+        changes_enabled = false;
+        changes_coalesce = false;
+        committing = false;
+        preupdate_event = NULL;
+        preupdate_enabled = false;
     }
 
     Database(const Napi::CallbackInfo& info);
 
+    // Native memory held on behalf of this database (bound parameters and
+    // buffered results) is reported to V8 so that it can take it into
+    // account when scheduling garbage collection. Adjustments may be made
+    // from any thread; they are passed on to V8 on the main thread.
+    void AdjustExternalMemory(int64_t change) {
+        external_memory += change;
+    }
+    void ReportExternalMemory();
+
+    // Runs execute on a worker thread and complete on the main thread once
+    // it is done. This is the database's own thread when it was opened with
+    // the dedicatedThread option and the libuv threadpool otherwise, in which
+    // case *request is set to the napi async work item.
+    void QueueWork(napi_async_work* request, const char* name,
+                   napi_async_execute_callback execute,
+                   napi_async_complete_callback complete, void* data);
+
+    // Calls complete from the event loop for work that was run on the main
+    // thread, so that callbacks stay asynchronous.
+    void CompleteInline(napi_async_complete_callback complete, void* data);
+
+    static Napi::Value ConfigureModule(const Napi::CallbackInfo& info);
+
+    // With configure('busyRetry', ms), operations that can be retried don't
+    // wait in SQLite for locks held by other connections (see NoBusyWait)
+    // and fail with SQLITE_BUSY right away. Their completion callback hands
+    // them back here, and they are queued again after a backoff timer until
+    // they have waited for the configured time in total. Returns false when
+    // the error should be reported.
+    bool DeferBusy(BusyRetry* retry, napi_async_work* request, const char* name,
+                   napi_async_execute_callback execute,
+                   napi_async_complete_callback complete, void* data);
+
+    // While one of these exists, the operation running on this thread gets
+    // SQLITE_BUSY right away instead of waiting for the busy timeout.
+    class NoBusyWait {
+    public:
+        NoBusyWait(bool enabled);
+        ~NoBusyWait();
+    private:
+        bool previous;
+    };
+
+    // In shared-cache mode, operations that fail because another connection
+    // holds a table lock (SQLITE_LOCKED_SHAREDCACHE) are parked here and
+    // queued again as soon as that connection ends its transaction. Returns
+    // false when waiting isn't possible and the error should be reported.
+    // Statement#each() and #fetch() still report the error, as they may
+    // already have handed out rows.
+    bool DeferLocked(napi_async_work* request, const char* name,
+                     napi_async_execute_callback execute,
+                     napi_async_complete_callback complete, void* data);
+
+    void Shutdown();
+
     ~Database() {
+        GetAddonData(Env())->databases.erase(this);
         RemoveCallbacks();
+        CloseSessions(true);
         sqlite3_close(_handle);
         _handle = NULL;
         open = false;
+        if (executor) {
+            delete executor;
+            executor = NULL;
+        }
+        CloseUnlockWatcher();
+        CloseInlineWatcher();
     }
 
 protected:
@@ -130,15 +402,47 @@ protected:
     static void Work_AfterOpen(napi_env env, napi_status status, void* data);
 
     Napi::Value OpenGetter(const Napi::CallbackInfo& info);
+    Napi::Value IdleGetter(const Napi::CallbackInfo& info);
+    Napi::Value InTransactionGetter(const Napi::CallbackInfo& info);
 
     void Schedule(Work_Callback callback, Baton* baton, bool exclusive = false);
+    static bool Sheddable(Work_Callback callback);
+    static bool Barrier(Work_Callback callback);
+    std::queue<Call*>* NextLane();
     void Process();
+    void Cancel(Baton* baton);
 
     Napi::Value Exec(const Napi::CallbackInfo& info);
+    Napi::Value ExecAsync(const Napi::CallbackInfo& info);
     static void Work_BeginExec(Baton* baton);
     static void Work_Exec(napi_env env, void* data);
     static void Work_AfterExec(napi_env env, napi_status status, void* data);
 
+    Napi::Value Transaction(const Napi::CallbackInfo& info);
+    static void Work_BeginTransaction(Baton* baton);
+    static void Work_Transaction(napi_env env, void* data);
+    static void Work_AfterTransaction(napi_env env, napi_status status, void* data);
+
+    Napi::Value Snapshot(const Napi::CallbackInfo& info);
+    static void Work_BeginSnapshot(Baton* baton);
+    static void Work_Snapshot(napi_env env, void* data);
+    static void Work_AfterSnapshot(napi_env env, napi_status status, void* data);
+
+    Napi::Value OpenSnapshot(const Napi::CallbackInfo& info);
+    static void Work_BeginOpenSnapshot(Baton* baton);
+    static void Work_OpenSnapshot(napi_env env, void* data);
+    static void Work_AfterOpenSnapshot(napi_env env, napi_status status, void* data);
+
+    Napi::Value ApplyChangeset(const Napi::CallbackInfo& info);
+    static void Work_BeginApplyChangeset(Baton* baton);
+    static void Work_ApplyChangeset(napi_env env, void* data);
+    static void Work_AfterApplyChangeset(napi_env env, napi_status status, void* data);
+
+    Napi::Value AllMarshalPartitioned(const Napi::CallbackInfo& info);
+    static void Work_BeginAllMarshalPartitioned(Baton* baton);
+    static void Work_AllMarshalPartitioned(napi_env env, void* data);
+    static void Work_AfterAllMarshalPartitioned(napi_env env, napi_status status, void* data);
+
     Napi::Value Wait(const Napi::CallbackInfo& info);
     static void Work_Wait(Baton* baton);
 
@@ -154,12 +458,19 @@ protected:
 
     Napi::Value Serialize(const Napi::CallbackInfo& info);
     Napi::Value Parallelize(const Napi::CallbackInfo& info);
+    Napi::Value Bulk(const Napi::CallbackInfo& info);
+    Napi::Value Interactive(const Napi::CallbackInfo& info);
 
     Napi::Value Configure(const Napi::CallbackInfo& info);
 
     Napi::Value Interrupt(const Napi::CallbackInfo& info);
 
-    static void SetBusyTimeout(Baton* baton);
+    Napi::Value ExecSync(const Napi::CallbackInfo& info);
+    bool CheckSync(Napi::Env env);
+    int ExecScript(const std::string& sql, size_t* offset, std::string& message,
+                   int* extended_status);
+
+    static int BusyHandler(void* db, int count);
 
     static void RegisterTraceCallback(Baton* baton);
     static void TraceCallback(void* db, const char* sql);
@@ -172,8 +483,38 @@ protected:
     static void RegisterUpdateCallback(Baton* baton);
     static void UpdateCallback(void* db, int type, const char* database, const char* table, sqlite3_int64 rowid);
     static void UpdateCallback(Database* db, UpdateInfo* info);
+    void AddChange(int type, const char* database, const char* table, sqlite3_int64 rowid);
+    static int CommitCallback(void* db);
+    static void RollbackCallback(void* db);
+    void ConfirmCommit();
+    static void ChangesCallback(Database* db, ChangeBatch* batch);
+    void MarkChanges();
+    void ReleaseChanges();
+    void RollbackChanges();
+    bool WantsChanges(const char* database, const char* table);
+    static uint32_t TableIndex(std::vector<std::string>& tables, const char* database, const char* table);
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+    static void PreupdateCallback(void* db, sqlite3* handle, int type, const char* database,
+        const char* table, sqlite3_int64 old_rowid, sqlite3_int64 new_rowid);
+#endif
+    static void PreupdateCallback(Database* db, PreupdateBatch* batch);
+    sqlite3_mutex* HookMutex();
 
     void RemoveCallbacks();
+    void CloseSessions(bool detach = false);
+
+#ifdef SQLITE_ENABLE_UNLOCK_NOTIFY
+    static void UnlockNotify(void** args, int count);
+    static void UnlockWatcher(uv_async_t* handle);
+#endif
+    void CloseUnlockWatcher();
+    static void InlineWatcher(uv_async_t* handle);
+    void CloseInlineWatcher();
+
+    static void Admit(AddonData* addon);
+    void Dispatch(AdmissionJob* job);
+    static void ExecuteAdmitted(napi_env env, void* data);
+    static void CompleteAdmitted(napi_env env, napi_status status, void* data);
 
 protected:
     sqlite3* _handle;
@@ -184,12 +525,79 @@ protected:
     unsigned int pending;
 
     bool serialize;
-
+    // Whether calls are currently queued in the bulk lane.
+    bool bulk;
+
+    // Result size caps for all()/allMarshal()/allJSON(); zero is unlimited.
+    sqlite3_int64 max_rows;
+    sqlite3_int64 max_bytes;
+
+    // Timeout set with configure('busyTimeout'), and the total time to retry
+    // for set with configure('busyRetry'). Read by BusyHandler() on workers.
+    std::atomic<int> busy_timeout;
+    std::atomic<int> busy_retry;
+
+    // Adjustments that have not been reported to V8 yet.
+    std::atomic<int64_t> external_memory;
+
+    Executor* executor;
+
+    // Worker jobs of this database that are running, and those waiting to be
+    // admitted; admission_ready is set while it is in line for admission.
+    unsigned int running;
+    std::queue<AdmissionJob*> admission;
+    bool admission_ready;
+    // Operations waiting in DeferBusy() or DeferLocked().
+    unsigned int deferred_work;
+
+    // Operations waiting for DeferLocked(), and the handle that wakes them.
+    uv_async_t* unlock_watcher;
+    std::vector<DeferredWork*> unlock_waiters;
+
+    // Statements whose recent runs took less than inline_threshold
+    // nanoseconds run on the main thread, see configure('inlineThreshold').
+    // inline_pending counts those still waiting for their completion.
+    uint64_t inline_threshold;
+    unsigned int inline_pending;
+    uv_async_t* inline_watcher;
+    std::vector<std::pair<napi_async_complete_callback, void*> > inline_completions;
+
+    // The interactive and bulk lanes, see Database#bulk(). bulk_skipped
+    // counts the interactive calls started while bulk work was waiting, and
+    // queued_calls numbers the calls as they are queued in either lane.
     std::queue<Call*> queue;
+    std::queue<Call*> bulk_queue;
+    unsigned int bulk_skipped;
+    uint64_t queued_calls;
 
     AsyncTrace* debug_trace;
     AsyncProfile* debug_profile;
     AsyncUpdate* update_event;
+    // Bits (1 << type) of the kinds of change emitted one by one as 'insert',
+    // 'update' and 'delete' events.
+    int update_types;
+
+    // The 'changes' event, see configure('changes'). The hooks read these
+    // while holding the connection's mutex, so they are only changed while
+    // holding it too.
+    AsyncChanges* changes_event;
+    bool changes_enabled;
+    ChangeBatch changes;
+    std::vector<std::string> changes_tables;
+    bool changes_coalesce;
+    std::vector<ChangeMark> change_marks;
+    // Set by the commit hook until ConfirmCommit() sees how the commit went.
+    bool committing;
+
+    // The 'preupdate' event, see configure('preupdate'); guarded like the
+    // above.
+    AsyncPreupdate* preupdate_event;
+    bool preupdate_enabled;
+    PreupdateBatch preupdates;
+
+    // Sessions recording changes made through this connection, see
+    // Database#session().
+    std::set<Session*> sessions;
 };
 
 }
@@ -0,0 +1,130 @@
+#include <assert.h>
+
+#include "executor.h"
+#include "macros.h"
+
+using namespace node_sqlite3;
+
+Executor::Executor(napi_env env_) :
+        env(env_), started(false), stopping(false), outstanding(0) {
+    uv_mutex_init(&mutex);
+    uv_cond_init(&cond);
+
+    uv_loop_t* loop;
+    napi_get_uv_event_loop(env, &loop);
+    watcher = new uv_async_t;
+    watcher->data = this;
+    uv_async_init(loop, watcher, Completed);
+    uv_unref(reinterpret_cast<uv_handle_t*>(watcher));
+}
+
+Executor::~Executor() {
+    Stop();
+    // Nothing can be outstanding anymore since every job holds a reference
+    // to the database that owns this executor.
+    watcher->data = NULL;
+    uv_close(reinterpret_cast<uv_handle_t*>(watcher), Closed);
+    uv_cond_destroy(&cond);
+    uv_mutex_destroy(&mutex);
+}
+
+void Executor::Queue(napi_async_execute_callback execute,
+                     napi_async_complete_callback complete, void* data) {
+    if (outstanding++ == 0) {
+        uv_ref(reinterpret_cast<uv_handle_t*>(watcher));
+    }
+
+    uv_mutex_lock(&mutex);
+    jobs.push(Job(execute, complete, data));
+    uv_cond_signal(&cond);
+    uv_mutex_unlock(&mutex);
+
+    if (!started) {
+        stopping = false;
+        int status = uv_thread_create(&thread, Run, this);
+        UNUSED(status);
+        assert(status == 0);
+        started = true;
+    }
+}
+
+void Executor::Stop() {
+    if (!started) return;
+
+    uv_mutex_lock(&mutex);
+    stopping = true;
+    uv_cond_signal(&cond);
+    uv_mutex_unlock(&mutex);
+
+    uv_thread_join(&thread);
+    started = false;
+}
+
+void Executor::Run(void* arg) {
+    Executor* executor = static_cast<Executor*>(arg);
+
+    uv_mutex_lock(&executor->mutex);
+    while (true) {
+        while (executor->jobs.empty() && !executor->stopping) {
+            uv_cond_wait(&executor->cond, &executor->mutex);
+        }
+        if (executor->jobs.empty()) {
+            break;
+        }
+
+        Job job = executor->jobs.front();
+        executor->jobs.pop();
+        uv_mutex_unlock(&executor->mutex);
+
+        job.execute(executor->env, job.data);
+
+        uv_mutex_lock(&executor->mutex);
+        executor->done.push(job);
+        uv_async_send(executor->watcher);
+    }
+    uv_mutex_unlock(&executor->mutex);
+}
+
+void node_sqlite3::CallComplete(napi_env env, const char* name,
+                                napi_async_complete_callback complete, void* data) {
+    Napi::HandleScope scope(env);
+
+    napi_value resource;
+    napi_value resource_name;
+    napi_async_context context;
+    napi_callback_scope callback_scope;
+    napi_create_object(env, &resource);
+    napi_create_string_utf8(env, name, NAPI_AUTO_LENGTH, &resource_name);
+    napi_async_init(env, resource, resource_name, &context);
+    napi_open_callback_scope(env, resource, context, &callback_scope);
+
+    complete(env, napi_ok, data);
+
+    napi_close_callback_scope(env, callback_scope);
+    napi_async_destroy(env, context);
+}
+
+void Executor::Completed(uv_async_t* handle) {
+    Executor* executor = static_cast<Executor*>(handle->data);
+    if (executor == NULL) return;
+
+    std::queue<Job> done;
+    uv_mutex_lock(&executor->mutex);
+    done.swap(executor->done);
+    uv_mutex_unlock(&executor->mutex);
+
+    Napi::HandleScope scope(executor->env);
+    while (!done.empty()) {
+        Job job = done.front();
+        done.pop();
+
+        if (--executor->outstanding == 0) {
+            uv_unref(reinterpret_cast<uv_handle_t*>(executor->watcher));
+        }
+        CallComplete(executor->env, "sqlite3.Executor", job.complete, job.data);
+    }
+}
+
+void Executor::Closed(uv_handle_t* handle) {
+    delete reinterpret_cast<uv_async_t*>(handle);
+}
@@ -0,0 +1,66 @@
+#ifndef NODE_SQLITE3_SRC_EXECUTOR_H
+#define NODE_SQLITE3_SRC_EXECUTOR_H
+
+#include <queue>
+
+#include <napi.h>
+#include <uv.h>
+
+namespace node_sqlite3 {
+
+// Calls the completion callback of work that wasn't run as napi async work,
+// from a libuv callback on the main thread. Like napi does for async work,
+// it is called inside a callback scope, so that promises it settles have
+// their reactions run as soon as it returns.
+void CallComplete(napi_env env, const char* name,
+                  napi_async_complete_callback complete, void* data);
+
+// Runs the work of a single Database on a thread of its own instead of the
+// libuv threadpool. Work runs in the order it was queued, and the completion
+// callbacks are called on the main thread just like those of napi async work.
+class Executor {
+public:
+    Executor(napi_env env_);
+    ~Executor();
+
+    // Must be called from the main thread.
+    void Queue(napi_async_execute_callback execute,
+               napi_async_complete_callback complete, void* data);
+
+    // Lets the thread finish the queued work and waits for it to exit. The
+    // thread is started again if more work is queued afterwards.
+    void Stop();
+
+protected:
+    struct Job {
+        Job(napi_async_execute_callback execute_,
+            napi_async_complete_callback complete_, void* data_) :
+            execute(execute_), complete(complete_), data(data_) {}
+        napi_async_execute_callback execute;
+        napi_async_complete_callback complete;
+        void* data;
+    };
+
+    static void Run(void* arg);
+    static void Completed(uv_async_t* handle);
+    static void Closed(uv_handle_t* handle);
+
+    napi_env env;
+    uv_thread_t thread;
+    bool started;
+    bool stopping;
+
+    uv_mutex_t mutex;
+    uv_cond_t cond;
+    std::queue<Job> jobs;
+    std::queue<Job> done;
+
+    // Only referenced while there is work outstanding, so that an idle
+    // database doesn't keep the event loop alive.
+    uv_async_t* watcher;
+    unsigned int outstanding;
+};
+
+}
+
+#endif
@@ -0,0 +1,119 @@
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+
+static const int64_t MAX_SAFE_INTEGER = 9007199254740991LL;
+
+void JSONEncoder::encodeInteger(int64_t value) {
+  if (value > MAX_SAFE_INTEGER || value < -MAX_SAFE_INTEGER) {
+    encodeDouble((double)value);
+    return;
+  }
+  char text[24];
+  int length = snprintf(text, sizeof(text), "%lld", (long long)value);
+  buffer.append(text, length);
+}
+
+void JSONEncoder::encodeDouble(double value) {
+  if (value != value || value - value != 0) {
+    // NaN and +/-Infinity.
+    encodeNull();
+    return;
+  }
+  if (value == 0) {
+    // Covers -0 as well, which JS prints as "0".
+    buffer.push_back('0');
+    return;
+  }
+
+  // Find the shortest representation that reads back as the same double.
+  // For normal numbers fifteen significant digits are always exact enough to
+  // strip down to the shortest form; beyond that we need sixteen or seventeen.
+  // Subnormals have less precision, so search them from one digit up.
+  char scientific[32];
+  int first = (value < DBL_MIN && value > -DBL_MIN) ? 1 : 15;
+  for (int precision = first; precision <= 17; precision++) {
+    snprintf(scientific, sizeof(scientific), "%.*e", precision - 1, value);
+    if (strtod(scientific, NULL) == value) break;
+  }
+
+  // Split "-d.ddddde+XX" into sign, digits and exponent.
+  const char *p = scientific;
+  if (*p == '-') {
+    buffer.push_back('-');
+    p++;
+  }
+  char digits[20];
+  int k = 0;
+  for (; *p && *p != 'e'; p++) {
+    if (*p != '.') digits[k++] = *p;
+  }
+  int exponent = (*p == 'e') ? atoi(p + 1) : 0;
+  while (k > 1 && digits[k - 1] == '0') k--;
+
+  // Lay the digits out following the ECMAScript Number::toString rules.
+  int n = exponent + 1;
+  if (k <= n && n <= 21) {
+    buffer.append(digits, k);
+    buffer.append(n - k, '0');
+  }
+  else if (0 < n && n <= 21) {
+    buffer.append(digits, n);
+    buffer.push_back('.');
+    buffer.append(digits + n, k - n);
+  }
+  else if (-6 < n && n <= 0) {
+    buffer.append("0.", 2);
+    buffer.append(-n, '0');
+    buffer.append(digits, k);
+  }
+  else {
+    buffer.push_back(digits[0]);
+    if (k > 1) {
+      buffer.push_back('.');
+      buffer.append(digits + 1, k - 1);
+    }
+    char text[8];
+    int length = snprintf(text, sizeof(text), "e%c%d", n - 1 < 0 ? '-' : '+', abs(n - 1));
+    buffer.append(text, length);
+  }
+}
+
+void JSONEncoder::encodeString(const char *value, size_t length) {
+  static const char hex[] = "0123456789abcdef";
+  buffer.push_back('"');
+  size_t start = 0;
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = value[i];
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    buffer.append(value + start, i - start);
+    start = i + 1;
+    switch (c) {
+      case '"':  buffer.append("\\\"", 2); break;
+      case '\\': buffer.append("\\\\", 2); break;
+      case '\b': buffer.append("\\b", 2); break;
+      case '\f': buffer.append("\\f", 2); break;
+      case '\n': buffer.append("\\n", 2); break;
+      case '\r': buffer.append("\\r", 2); break;
+      case '\t': buffer.append("\\t", 2); break;
+      default:
+        buffer.append("\\u00", 4);
+        buffer.push_back(hex[c >> 4]);
+        buffer.push_back(hex[c & 0xf]);
+    }
+  }
+  buffer.append(value + start, length - start);
+  buffer.push_back('"');
+}
+
+void JSONEncoder::encodeBlob(const unsigned char *value, size_t length) {
+  buffer.append("{\"type\":\"Buffer\",\"data\":[");
+  for (size_t i = 0; i < length; i++) {
+    if (i) buffer.push_back(',');
+    encodeInteger(value[i]);
+  }
+  buffer.append("]}");
+}
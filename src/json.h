@@ -0,0 +1,52 @@
+#ifndef NODE_SQLITE3_SRC_JSON_H
+#define NODE_SQLITE3_SRC_JSON_H
+
+#include <stdint.h>
+#include <string>
+
+// Builds JSON text directly from SQLite column values, producing the same
+// output JSON.stringify() would for the objects RowToJS() creates. This lets
+// result sets be serialized in the worker thread without creating any JS
+// objects.
+class JSONEncoder {
+  private:
+    std::string buffer;
+
+  public:
+    JSONEncoder() {
+      buffer.reserve(256);
+    }
+
+    std::string &getBuffer() {
+      return buffer;
+    }
+
+    size_t size() const {
+      return buffer.size();
+    }
+
+    void raw(char c) {
+      buffer.push_back(c);
+    }
+
+    void raw(const std::string &text) {
+      buffer.append(text);
+    }
+
+    void encodeNull() {
+      buffer.append("null", 4);
+    }
+
+    // Integers beyond 2^53 are formatted as the double JS would see.
+    void encodeInteger(int64_t value);
+
+    // Formats like Number.prototype.toString(); NaN and infinities become null.
+    void encodeDouble(double value);
+
+    void encodeString(const char *value, size_t length);
+
+    // Blobs come out the way Buffer#toJSON() represents them.
+    void encodeBlob(const unsigned char *value, size_t length);
+};
+
+#endif
@@ -141,17 +141,29 @@ inline bool OtherIsInt(Napi::Number source) {
     assert(baton->stmt->prepared);                                             \
     baton->stmt->locked = true;                                                \
     baton->stmt->db->pending++;                                                \
-    Napi::Env env = baton->stmt->Env();                                        \
-    int status = napi_create_async_work(                                       \
-        env, NULL, Napi::String::New(env, "sqlite3.Statement."#type),          \
-        Work_##type, Work_After##type, baton, &baton->request                  \
-    );                                                                         \
-    assert(status == 0);                                                       \
-    napi_queue_async_work(env, baton->request);
+    baton->stmt->Queue(baton, "sqlite3.Statement."#type,                       \
+        Work_Timed<Work_##type>, Work_After##type);
 
+// On worker threads, the scope lets the progress handler and Statement::Bind()
+// see the operation's cancellation.
 #define STATEMENT_INIT(type)                                                   \
     type* baton = static_cast<type*>(data);                                    \
-    Statement* stmt = baton->stmt;
+    Statement* stmt = baton->stmt;                                             \
+    Cancellation::Scope cancellation_scope(baton->cancellation.get());
+
+// Hands an operation that found the database busy or, in shared-cache mode,
+// a table locked by another connection back to the database to be run again
+// later, see Database::DeferBusy() and Database::DeferLocked().
+#define STATEMENT_RETRY(type)                                                  \
+    if ((stmt->status == SQLITE_BUSY && stmt->db->DeferBusy(&baton->busy,      \
+            &baton->request, "sqlite3.Statement."#type,                        \
+            Work_##type, Work_After##type, baton)) ||                          \
+        (stmt->status == SQLITE_LOCKED &&                                      \
+            stmt->extended_status == SQLITE_LOCKED_SHAREDCACHE &&              \
+            stmt->db->DeferLocked(&baton->request, "sqlite3.Statement."#type,  \
+            Work_##type, Work_After##type, baton))) {                          \
+        return;                                                                \
+    }
 
 #define STATEMENT_END()                                                        \
     assert(stmt->locked);                                                      \
@@ -160,7 +172,7 @@ inline bool OtherIsInt(Napi::Number source) {
     stmt->db->pending--;                                                       \
     stmt->Process();                                                           \
     stmt->db->Process();                                                       \
-    napi_delete_async_work(e, baton->request);                                 \
+    if (baton->request) napi_delete_async_work(e, baton->request);             \
     delete baton;
 
 #define BACKUP_BEGIN(type)                                                     \
@@ -171,13 +183,8 @@ inline bool OtherIsInt(Napi::Number source) {
     assert(baton->backup->inited);                                             \
     baton->backup->locked = true;                                              \
     baton->backup->db->pending++;                                              \
-    Napi::Env env = baton->backup->Env();                                      \
-    int status = napi_create_async_work(                                       \
-        env, NULL, Napi::String::New(env, "sqlite3.Backup."#type),             \
-        Work_##type, Work_After##type, baton, &baton->request                  \
-    );                                                                         \
-    assert(status == 0);                                                       \
-    napi_queue_async_work(env, baton->request);
+    baton->backup->db->QueueWork(&baton->request, "sqlite3.Backup."#type,     \
+        Work_##type, Work_After##type, baton);
 
 #define BACKUP_INIT(type)                                                      \
     type* baton = static_cast<type*>(data);                                    \
@@ -190,7 +197,7 @@ inline bool OtherIsInt(Napi::Number source) {
     backup->db->pending--;                                                     \
     backup->Process();                                                         \
     backup->db->Process();                                                     \
-    napi_delete_async_work(e, baton->request);                                 \
+    if (baton->request) napi_delete_async_work(e, baton->request);             \
     delete baton;
 
 #define DELETE_FIELD(field)                                                    \
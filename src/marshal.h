@@ -1,3 +1,6 @@
+#ifndef NODE_SQLITE3_SRC_MARSHAL_H
+#define NODE_SQLITE3_SRC_MARSHAL_H
+
 #include <stdlib.h>
 #include <vector>
 #include <string>
@@ -170,3 +173,5 @@ class Unmarshaller {
 // call switches our notion of the host endianness resulting in all incorrect
 // marshalling. Obviously, this is only for testing, and is not exposed to JS.
 void marshalTestOppositeEndianness(bool useOpposite);
+
+#endif
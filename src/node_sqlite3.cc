@@ -5,20 +5,43 @@
 #include <sqlite3.h>
 
 #include "macros.h"
+#include "addon.h"
 #include "database.h"
 #include "statement.h"
 #include "backup.h"
+#include "session.h"
+#include "cancellation.h"
 
 using namespace node_sqlite3;
 
 namespace {
 
+void CleanupEnvironment(void* arg) {
+    AddonData* addon = static_cast<AddonData*>(arg);
+    std::set<Database*>::iterator it = addon->databases.begin();
+    for (; it != addon->databases.end(); ++it) {
+        (*it)->Shutdown();
+    }
+}
+
 Napi::Object RegisterModule(Napi::Env env, Napi::Object exports) {
     Napi::HandleScope scope(env);
 
+#if NAPI_VERSION >= 6
+    // Deleted along with the environment.
+    env.SetInstanceData(new AddonData());
+#endif
+    napi_add_env_cleanup_hook(env, CleanupEnvironment, GetAddonData(env));
+
     Database::Init(env, exports);
     Statement::Init(env, exports);
     Backup::Init(env, exports);
+#ifdef SQLITE_ENABLE_SESSION
+    Session::Init(env, exports);
+#endif
+    Cancellation::Init(env, exports);
+
+    exports.Set("configure", Napi::Function::New(env, Database::ConfigureModule, "configure"));
 
     exports.DefineProperties({
         DEFINE_CONSTANT_INTEGER(exports, SQLITE_OPEN_READONLY, OPEN_READONLY)
@@ -33,6 +56,9 @@ Napi::Object RegisterModule(Napi::Env env, Napi::Object exports) {
         DEFINE_CONSTANT_STRING(exports, SQLITE_SOURCE_ID, SOURCE_ID)
 #endif
         DEFINE_CONSTANT_INTEGER(exports, SQLITE_VERSION_NUMBER, VERSION_NUMBER)
+        // The Node-API version the addon was built for; from 6 on, each
+        // thread that loads it gets its own instance data.
+        DEFINE_CONSTANT_INTEGER(exports, NAPI_VERSION, NAPI_VERSION)
 
         DEFINE_CONSTANT_INTEGER(exports, SQLITE_OK, OK)
         DEFINE_CONSTANT_INTEGER(exports, SQLITE_ERROR, ERROR)
@@ -61,6 +87,10 @@ Napi::Object RegisterModule(Napi::Env env, Napi::Object exports) {
         DEFINE_CONSTANT_INTEGER(exports, SQLITE_FORMAT, FORMAT)
         DEFINE_CONSTANT_INTEGER(exports, SQLITE_RANGE, RANGE)
         DEFINE_CONSTANT_INTEGER(exports, SQLITE_NOTADB, NOTADB)
+
+        DEFINE_CONSTANT_INTEGER(exports, SQLITE_INSERT, INSERT)
+        DEFINE_CONSTANT_INTEGER(exports, SQLITE_UPDATE, UPDATE)
+        DEFINE_CONSTANT_INTEGER(exports, SQLITE_DELETE, DELETE)
     });
 
     return exports;
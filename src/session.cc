@@ -0,0 +1,270 @@
+#include <string.h>
+#include <napi.h>
+
+#include "macros.h"
+#include "addon.h"
+#include "database.h"
+#include "session.h"
+
+#ifdef SQLITE_ENABLE_SESSION
+
+using namespace node_sqlite3;
+
+
+Napi::Object Session::Init(Napi::Env env, Napi::Object exports) {
+    Napi::HandleScope scope(env);
+
+    Napi::Function t = DefineClass(env, "Session", {
+        InstanceMethod("changeset", &Session::Changeset),
+        InstanceMethod("patchset", &Session::Patchset),
+        InstanceMethod("close", &Session::Close),
+        InstanceAccessor("closed", &Session::ClosedGetter, nullptr),
+    });
+
+    GetAddonData(env)->session = Napi::Persistent(t);
+
+    exports.Set("Session", t);
+    return exports;
+}
+
+void Session::Error(Baton* baton) {
+    Session* session = baton->session;
+    Napi::Env env = session->Env();
+    Napi::HandleScope scope(env);
+
+    // Fail hard on logic errors.
+    assert(baton->status != 0);
+    EXCEPTION(Napi::String::New(env, baton->message.c_str()), baton->status, exception);
+
+    Napi::Function cb = baton->callback.Value();
+
+    if (!cb.IsUndefined() && cb.IsFunction()) {
+        Napi::Value argv[] = { exception };
+        TRY_CATCH_CALL(session->Value(), cb, 1, argv);
+    }
+    else {
+        Napi::Value argv[] = { Napi::String::New(env, "error"), exception };
+        EMIT_EVENT(session->Value(), 2, argv);
+    }
+}
+
+// new Session(db, tables, [callback])
+Session::Session(const Napi::CallbackInfo& info) : Napi::ObjectWrap<Session>(info) {
+    Napi::Env env = info.Env();
+    if (!info.IsConstructCall()) {
+        Napi::TypeError::New(env, "Use the new operator to create new Session objects").ThrowAsJavaScriptException();
+        return;
+    }
+
+    int length = info.Length();
+
+    if (length <= 0 || !Database::HasInstance(info[0])) {
+        Napi::TypeError::New(env, "Database object expected").ThrowAsJavaScriptException();
+        return;
+    }
+    else if (length > 1 && !info[1].IsUndefined() && !info[1].IsNull() && !info[1].IsArray()) {
+        Napi::TypeError::New(env, "Array of table names expected").ThrowAsJavaScriptException();
+        return;
+    }
+    else if (length > 2 && !info[2].IsUndefined() && !info[2].IsFunction()) {
+        Napi::TypeError::New(env, "Callback expected").ThrowAsJavaScriptException();
+        return;
+    }
+
+    std::vector<std::string> tables;
+    if (length > 1 && info[1].IsArray()) {
+        Napi::Array array = info[1].As<Napi::Array>();
+        for (uint32_t i = 0; i < array.Length(); i++) {
+            Napi::Value table = array.Get(i);
+            if (!table.IsString()) {
+                Napi::TypeError::New(env, "Table names must be strings").ThrowAsJavaScriptException();
+                return;
+            }
+            tables.push_back(table.As<Napi::String>().Utf8Value());
+        }
+    }
+
+    Database* db = Napi::ObjectWrap<Database>::Unwrap(info[0].As<Napi::Object>());
+    init(db);
+
+    Napi::Function callback;
+    if (length > 2 && info[2].IsFunction()) {
+        callback = info[2].As<Napi::Function>();
+    }
+    CreateBaton* baton = new CreateBaton(db, callback, this);
+    baton->tables.swap(tables);
+    db->Schedule(Work_Create, baton, true);
+}
+
+// Runs on the main thread: creating a session and attaching tables to it
+// only sets up bookkeeping, tables are looked up when they are first changed.
+void Session::Work_Create(Database::Baton* b) {
+    CreateBaton* baton = static_cast<CreateBaton*>(b);
+    Session* session = baton->session;
+    Database* db = baton->db;
+
+    Napi::Env env = session->Env();
+    Napi::HandleScope scope(env);
+
+    assert(db->locked);
+    assert(db->open);
+    assert(db->_handle);
+    assert(db->pending == 0);
+
+    int status = sqlite3session_create(db->_handle, "main", &session->_handle);
+    if (status == SQLITE_OK && baton->tables.empty()) {
+        status = sqlite3session_attach(session->_handle, NULL);
+    }
+    for (size_t i = 0; status == SQLITE_OK && i < baton->tables.size(); i++) {
+        status = sqlite3session_attach(session->_handle, baton->tables[i].c_str());
+    }
+
+    if (status != SQLITE_OK) {
+        baton->status = status;
+        baton->message = std::string(sqlite3_errstr(status));
+        session->Delete();
+        Error(baton);
+    }
+    else {
+        Napi::Function cb = baton->callback.Value();
+        if (!cb.IsUndefined() && cb.IsFunction()) {
+            Napi::Value argv[] = { env.Null() };
+            TRY_CATCH_CALL(session->Value(), cb, 1, argv);
+        }
+    }
+
+    db->Process();
+
+    delete baton;
+}
+
+Napi::Value Session::Changeset(const Napi::CallbackInfo& info) {
+    return ScheduleChangeset(info, false);
+}
+
+Napi::Value Session::Patchset(const Napi::CallbackInfo& info) {
+    return ScheduleChangeset(info, true);
+}
+
+Napi::Value Session::ScheduleChangeset(const Napi::CallbackInfo& info, bool patchset) {
+    Napi::Env env = info.Env();
+
+    OPTIONAL_ARGUMENT_FUNCTION(0, callback);
+
+    Baton* baton = new ChangesetBaton(db, callback, this, patchset);
+    db->Schedule(Work_BeginChangeset, baton, true);
+    return info.This();
+}
+
+void Session::Work_BeginChangeset(Database::Baton* baton) {
+    assert(baton->db->locked);
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    assert(baton->db->pending == 0);
+    baton->db->QueueWork(&baton->request, "sqlite3.Session.Changeset",
+        Work_Changeset, Work_AfterChangeset, baton);
+}
+
+void Session::Work_Changeset(napi_env e, void* data) {
+    ChangesetBaton* baton = static_cast<ChangesetBaton*>(data);
+    Session* session = baton->session;
+
+    if (!session->_handle) {
+        baton->status = SQLITE_MISUSE;
+        baton->message = "Session is closed";
+        return;
+    }
+
+    baton->status = baton->patchset
+        ? sqlite3session_patchset(session->_handle, &baton->size, &baton->buffer)
+        : sqlite3session_changeset(session->_handle, &baton->size, &baton->buffer);
+
+    if (baton->status != SQLITE_OK) {
+        // Errors aren't associated with the connection.
+        baton->message = std::string(sqlite3_errstr(baton->status));
+    }
+}
+
+static void FreeChangeset(Napi::Env env, char* data) {
+    sqlite3_free(data);
+}
+
+void Session::Work_AfterChangeset(napi_env e, napi_status status, void* data) {
+    ChangesetBaton* baton = static_cast<ChangesetBaton*>(data);
+    Session* session = baton->session;
+    Database* db = baton->db;
+
+    Napi::Env env = session->Env();
+    Napi::HandleScope scope(env);
+
+    if (baton->status != SQLITE_OK) {
+        Error(baton);
+    }
+    else {
+        Napi::Function cb = baton->callback.Value();
+        if (!cb.IsUndefined() && cb.IsFunction()) {
+            Napi::Value result;
+            if (baton->size > 0) {
+                // Hand sqlite's buffer over to the Buffer without copying it.
+                result = Napi::Buffer<char>::New(env, static_cast<char*>(baton->buffer),
+                    baton->size, FreeChangeset);
+                baton->buffer = NULL;
+            }
+            else {
+                result = Napi::Buffer<char>::New(env, 0);
+            }
+            Napi::Value argv[] = { env.Null(), result };
+            TRY_CATCH_CALL(session->Value(), cb, 2, argv);
+        }
+    }
+
+    db->Process();
+
+    if (baton->request) napi_delete_async_work(e, baton->request);
+    delete baton;
+}
+
+Napi::Value Session::Close(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+
+    OPTIONAL_ARGUMENT_FUNCTION(0, callback);
+
+    Baton* baton = new Baton(db, callback, this);
+    db->Schedule(Work_Close, baton, true);
+    return info.This();
+}
+
+void Session::Work_Close(Database::Baton* b) {
+    Baton* baton = static_cast<Baton*>(b);
+    Session* session = baton->session;
+    Database* db = baton->db;
+
+    Napi::Env env = session->Env();
+    Napi::HandleScope scope(env);
+
+    session->Delete();
+
+    Napi::Function cb = baton->callback.Value();
+    if (!cb.IsUndefined() && cb.IsFunction()) {
+        Napi::Value argv[] = { env.Null() };
+        TRY_CATCH_CALL(session->Value(), cb, 1, argv);
+    }
+
+    db->Process();
+
+    delete baton;
+}
+
+void Session::Delete() {
+    if (_handle) {
+        sqlite3session_delete(_handle);
+        _handle = NULL;
+    }
+    closed = true;
+}
+
+Napi::Value Session::ClosedGetter(const Napi::CallbackInfo& info) {
+    return Napi::Boolean::New(this->Env(), closed);
+}
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef NODE_SQLITE3_SRC_SESSION_H
+#define NODE_SQLITE3_SRC_SESSION_H
+
+#include "database.h"
+
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+#include <napi.h>
+
+using namespace Napi;
+
+#ifdef SQLITE_ENABLE_SESSION
+
+namespace node_sqlite3 {
+
+/**
+ *
+ * A class for managing an sqlite3_session object, which records the changes
+ * made through a database connection so that they can be replayed on
+ * another database with `db.applyChangeset()`.
+ *
+ * Intended usage from node:
+ *
+ *   var session = db.session(['docs', 'tags']);
+ *   db.run("UPDATE docs SET ...");
+ *   ...
+ *   session.changeset(function(err, changeset) {
+ *       replica.applyChangeset(changeset, 'replace', function(err, conflicts) { ... });
+ *   });
+ *
+ * Here is how sqlite's session api is exposed:
+ *
+ *   - `sqlite3session_create` and `sqlite3session_attach`:
+ *     `db.session([tables], [callback])`, recording all tables of the main
+ *     database when no table names are given.
+ *   - `sqlite3session_changeset`: `session.changeset([callback])`.
+ *   - `sqlite3session_patchset`: `session.patchset([callback])`.
+ *   - `sqlite3session_delete`: `session.close([callback])`.
+ *
+ * The calls go through the database's queue and wait for the calls made
+ * before them, so a changeset covers exactly the changes queued ahead of
+ * it. Changesets and patchsets are built on a worker thread and passed to
+ * the callback as a Buffer. A session is closed along with its database.
+ *
+ */
+class Session : public Napi::ObjectWrap<Session> {
+public:
+    static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+    struct Baton : Database::Baton {
+        Session* session;
+        Baton(Database* db_, Napi::Function cb_, Session* session_) :
+            Database::Baton(db_, cb_), session(session_) {
+            session->Ref();
+        }
+        virtual ~Baton() {
+            session->Unref();
+        }
+    };
+
+    struct CreateBaton : Baton {
+        // Empty to record all tables.
+        std::vector<std::string> tables;
+        CreateBaton(Database* db_, Napi::Function cb_, Session* session_) :
+            Baton(db_, cb_, session_) {}
+    };
+
+    struct ChangesetBaton : Baton {
+        bool patchset;
+        int size;
+        void* buffer;
+        ChangesetBaton(Database* db_, Napi::Function cb_, Session* session_, bool patchset_) :
+            Baton(db_, cb_, session_), patchset(patchset_), size(0), buffer(NULL) {}
+        virtual ~ChangesetBaton() {
+            sqlite3_free(buffer);
+        }
+    };
+
+    void init(Database* db_) {
+        db = db_;
+        _handle = NULL;
+        closed = false;
+        db->Ref();
+        db->sessions.insert(this);
+    }
+
+    Session(const Napi::CallbackInfo& info);
+
+    ~Session() {
+        Delete();
+        if (db) {
+            db->sessions.erase(this);
+            db->Unref();
+        }
+    }
+
+    Napi::Value Changeset(const Napi::CallbackInfo& info);
+    Napi::Value Patchset(const Napi::CallbackInfo& info);
+    Napi::Value Close(const Napi::CallbackInfo& info);
+    Napi::Value ClosedGetter(const Napi::CallbackInfo& info);
+
+    // Frees the sqlite3_session; must be called before the connection that
+    // it records is closed.
+    void Delete();
+
+    friend class Database;
+
+protected:
+    static void Work_Create(Database::Baton* baton);
+
+    Napi::Value ScheduleChangeset(const Napi::CallbackInfo& info, bool patchset);
+    static void Work_BeginChangeset(Database::Baton* baton);
+    static void Work_Changeset(napi_env env, void* data);
+    static void Work_AfterChangeset(napi_env env, napi_status status, void* data);
+
+    static void Work_Close(Database::Baton* baton);
+
+    static void Error(Baton* baton);
+
+    Database* db;
+
+    sqlite3_session* _handle;
+    bool closed;
+};
+
+}
+
+#endif
+
+#endif
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <algorithm>
 #include <napi.h>
 #include <uv.h>
 
@@ -8,8 +9,6 @@
 
 using namespace node_sqlite3;
 
-Napi::FunctionReference Statement::constructor;
-
 Napi::Object Statement::Init(Napi::Env env, Napi::Object exports) {
     Napi::HandleScope scope(env);
 
@@ -19,13 +18,24 @@ Napi::Object Statement::Init(Napi::Env env, Napi::Object exports) {
       InstanceMethod("run", &Statement::Run),
       InstanceMethod("all", &Statement::All),
       InstanceMethod("allMarshal", &Statement::AllMarshal),
+      InstanceMethod("allJSON", &Statement::AllJSON),
+      InstanceMethod("allNDJSON", &Statement::AllNDJSON),
       InstanceMethod("each", &Statement::Each),
+      InstanceMethod("fetch", &Statement::Fetch),
       InstanceMethod("reset", &Statement::Reset),
+      InstanceMethod("runSync", &Statement::RunSync),
+      InstanceMethod("getSync", &Statement::GetSync),
+      InstanceMethod("allSync", &Statement::AllSync),
+      InstanceMethod("runAsync", &Statement::RunAsync),
+      InstanceMethod("getAsync", &Statement::GetAsync),
+      InstanceMethod("allAsync", &Statement::AllAsync),
       InstanceMethod("finalize", &Statement::Finalize_),
+      InstanceAccessor("readonly", &Statement::ReadonlyGetter, nullptr),
+      InstanceAccessor("inlineRuns", &Statement::InlineRunsGetter, nullptr),
+      InstanceAccessor("database", &Statement::DatabaseGetter, nullptr),
     });
 
-    constructor = Napi::Persistent(t);
-    constructor.SuppressDestruct();
+    GetAddonData(env)->statement = Napi::Persistent(t);
 
     exports.Set("Statement", t);
     return exports;
@@ -51,7 +61,12 @@ void Statement::Process() {
         Call* call = queue.front();
         queue.pop();
 
-        call->callback(call->baton);
+        if (call->baton->cancellation && call->baton->cancellation->Cancelled()) {
+            Cancel(call->baton);
+        }
+        else {
+            call->callback(call->baton);
+        }
         delete call;
     }
 }
@@ -64,11 +79,85 @@ void Statement::Schedule(Work_Callback callback, Baton* baton) {
     else if (!prepared || locked) {
         queue.push(new Call(callback, baton));
     }
+    else if (baton->cancellation && baton->cancellation->Cancelled()) {
+        Cancel(baton);
+    }
     else {
         callback(baton);
     }
 }
 
+// Fails a call whose cancellation fired while it was queued.
+void Statement::Cancel(Baton* baton) {
+    Napi::Env env = Env();
+    Napi::HandleScope scope(env);
+
+    EXCEPTION(Napi::String::New(env, "interrupted"), SQLITE_INTERRUPT, exception);
+    Napi::Function cb = baton->callback.Value();
+    if (baton->deferred) {
+        RejectDeferred(env, baton->deferred, exception);
+    }
+    else if (!cb.IsUndefined() && cb.IsFunction()) {
+        Napi::Value argv[] = { exception };
+        TRY_CATCH_CALL(Value(), cb, 1, argv);
+    }
+    else {
+        Napi::Value argv[] = { Napi::String::New(env, "error"), exception };
+        EMIT_EVENT(Value(), 2, argv);
+    }
+    delete baton;
+}
+
+// Runs at least this many times on a worker before a statement may run inline.
+static const unsigned int INLINE_SAMPLES = 4;
+
+template <napi_async_execute_callback work>
+void Statement::Work_Timed(napi_env e, void* data) {
+    Statement* stmt = static_cast<Baton*>(data)->stmt;
+    uint64_t start = uv_hrtime();
+    work(e, data);
+    uint64_t elapsed = uv_hrtime() - start;
+
+    // Only one operation of a statement runs at a time.
+    stmt->elapsed = stmt->timed_runs ? (stmt->elapsed * 3 + elapsed) / 4 : elapsed;
+    if (stmt->timed_runs < INLINE_SAMPLES) stmt->timed_runs++;
+}
+
+// With configure('inlineThreshold'), an operation of a statement whose recent
+// runs took less than the threshold on average runs right away on the main
+// thread, saving the trip to the threadpool. That only happens when no other
+// work is using the connection, so it can't wait for the database mutex. Nor
+// does it wait for locks held by other connections: a run that gets
+// SQLITE_BUSY is queued again on a worker, which waits for the busy timeout as
+// usual. SQLITE_BUSY comes from the first step or the commit, before any rows
+// are handed out, so running it again is safe. The callback is still called
+// asynchronously, and a run that is slow pushes the average up so that the
+// next ones go to a worker again.
+void Statement::Queue(Baton* baton, const char* name,
+                      napi_async_execute_callback execute,
+                      napi_async_complete_callback complete) {
+    if (db->inline_threshold && timed_runs >= INLINE_SAMPLES &&
+            elapsed < db->inline_threshold &&
+            db->pending == db->inline_pending + 1 &&
+            db->running == 0 && db->admission.empty()) {
+        baton->request = NULL;
+        {
+            Database::NoBusyWait busy_scope(true);
+            execute(Env(), baton);
+        }
+        if (status == SQLITE_BUSY) {
+            db->QueueWork(&baton->request, name, execute, complete, baton);
+        }
+        else {
+            inline_runs++;
+            db->CompleteInline(complete, baton);
+        }
+    }
+    else {
+        db->QueueWork(&baton->request, name, execute, complete, baton);
+    }
+}
+
 template <class T> void Statement::Error(T* baton) {
     Statement* stmt = baton->stmt;
 
@@ -81,7 +170,10 @@ template <class T> void Statement::Error(T* baton) {
 
     Napi::Function cb = baton->callback.Value();
 
-    if (!cb.IsUndefined() && cb.IsFunction()) {
+    if (baton->deferred) {
+        RejectDeferred(env, baton->deferred, exception);
+    }
+    else if (!cb.IsUndefined() && cb.IsFunction()) {
         Napi::Value argv[] = { exception };
         TRY_CATCH_CALL(stmt->Value(), cb, 1, argv);
     }
@@ -91,7 +183,39 @@ template <class T> void Statement::Error(T* baton) {
     }
 }
 
-// { Database db, String sql, Array params, Function callback }
+template <class T> T* Statement::WithLimits(T* baton) {
+    if (baton != NULL) {
+        baton->max_rows = db->max_rows;
+        baton->max_bytes = db->max_bytes;
+    }
+    return baton;
+}
+
+// Called from the worker with the size of the result so far. When a limit is
+// exceeded, the statement is reset and left in an SQLITE_TOOBIG error state.
+bool Statement::ExceedsLimits(const ResultLimits* limits, sqlite3_int64 rows, sqlite3_int64 bytes) {
+    const char* exceeded = NULL;
+    sqlite3_int64 limit = 0;
+    if (limits->max_rows > 0 && rows > limits->max_rows) {
+        exceeded = "maxRows";
+        limit = limits->max_rows;
+    }
+    else if (limits->max_bytes > 0 && bytes > limits->max_bytes) {
+        exceeded = "maxBytes";
+        limit = limits->max_bytes;
+    }
+    if (exceeded == NULL) {
+        return false;
+    }
+
+    sqlite3_reset(_handle);
+    status = SQLITE_TOOBIG;
+    message = std::string("Result exceeds ") + exceeded + " limit of " +
+        std::to_string((long long)limit);
+    return true;
+}
+
+// { Database db, String sql, Function callback, Boolean persistent }
 Statement::Statement(const Napi::CallbackInfo& info) : Napi::ObjectWrap<Statement>(info) {
     Napi::Env env = info.Env();
     int length = info.Length();
@@ -119,19 +243,34 @@ Statement::Statement(const Napi::CallbackInfo& info) : Napi::ObjectWrap<Statemen
 
     PrepareBaton* baton = new PrepareBaton(db, info[2].As<Napi::Function>(), stmt);
     baton->sql = std::string(sql.As<Napi::String>().Utf8Value().c_str());
+    baton->persistent = length > 3 && info[3].IsBoolean() &&
+        info[3].As<Napi::Boolean>().Value();
+
+    if (length > 4 && info[4].IsBoolean() && info[4].As<Napi::Boolean>().Value()) {
+        // Prepared right away, see Database#prepareSync().
+        if (db->CheckSync(env)) {
+            Work_Prepare(env, baton);
+            if (status == SQLITE_OK) {
+                prepared = true;
+                locked = false;
+            }
+            else {
+                ThrowSync(env);
+            }
+        }
+        // Finalizes the statement unless it was prepared.
+        delete baton;
+        return;
+    }
+
     db->Schedule(Work_BeginPrepare, baton);
 }
 
 void Statement::Work_BeginPrepare(Database::Baton* baton) {
     assert(baton->db->open);
     baton->db->pending++;
-    Napi::Env env = baton->db->Env();
-    int status = napi_create_async_work(
-        env, NULL, Napi::String::New(env, "sqlite3.Statement.Prepare"),
-        Work_Prepare, Work_AfterPrepare, baton, &baton->request
-    );
-    assert(status == 0);
-    napi_queue_async_work(env, baton->request);
+    baton->db->QueueWork(&baton->request, "sqlite3.Statement.Prepare",
+        Work_Prepare, Work_AfterPrepare, baton);
 }
 
 void Statement::Work_Prepare(napi_env e, void* data) {
@@ -142,6 +281,16 @@ void Statement::Work_Prepare(napi_env e, void* data) {
     sqlite3_mutex* mtx = sqlite3_db_mutex(baton->db->_handle);
     sqlite3_mutex_enter(mtx);
 
+#if SQLITE_VERSION_NUMBER >= 3020000
+    stmt->status = sqlite3_prepare_v3(
+        baton->db->_handle,
+        baton->sql.c_str(),
+        baton->sql.size(),
+        baton->persistent ? SQLITE_PREPARE_PERSISTENT : 0,
+        &stmt->_handle,
+        NULL
+    );
+#else
     stmt->status = sqlite3_prepare_v2(
         baton->db->_handle,
         baton->sql.c_str(),
@@ -149,9 +298,11 @@ void Statement::Work_Prepare(napi_env e, void* data) {
         &stmt->_handle,
         NULL
     );
+#endif
 
     if (stmt->status != SQLITE_OK) {
         stmt->message = std::string(sqlite3_errmsg(baton->db->_handle));
+        stmt->extended_status = sqlite3_extended_errcode(baton->db->_handle);
         stmt->_handle = NULL;
     }
 
@@ -161,6 +312,14 @@ void Statement::Work_Prepare(napi_env e, void* data) {
 void Statement::Work_AfterPrepare(napi_env e, napi_status status, void* data) {
     STATEMENT_INIT(PrepareBaton);
 
+    // Another connection sharing the cache is changing the schema.
+    if (stmt->status == SQLITE_LOCKED &&
+            stmt->extended_status == SQLITE_LOCKED_SHAREDCACHE &&
+            baton->db->DeferLocked(&baton->request, "sqlite3.Statement.Prepare",
+            Work_Prepare, Work_AfterPrepare, baton)) {
+        return;
+    }
+
     Napi::Env env = stmt->Env();
     Napi::HandleScope scope(env);
 
@@ -224,6 +383,10 @@ template <class T> T* Statement::Bind(const Napi::CallbackInfo& info, int start,
     Napi::HandleScope scope(env);
 
     if (last < 0) last = info.Length();
+    std::shared_ptr<Cancellation::State> cancellation;
+    if (last > start && (cancellation = Cancellation::From(info[last - 1]))) {
+        last--;
+    }
     Napi::Function callback;
     if (last > start && info[last - 1].IsFunction()) {
         callback = info[last - 1].As<Napi::Function>();
@@ -231,56 +394,104 @@ template <class T> T* Statement::Bind(const Napi::CallbackInfo& info, int start,
     }
 
     T* baton = new T(this, callback);
+    baton->cancellation = cancellation;
 
     if (start < last) {
-        if (info[start].IsArray()) {
-            Napi::Array array = info[start].As<Napi::Array>();
-            int length = array.Length();
-            // Note: bind parameters start with 1.
-            for (int i = 0, pos = 1; i < length; i++, pos++) {
-                baton->parameters.push_back(BindParameter((array).Get(i), pos));
-            }
-        }
-        else if (!info[start].IsObject() || OtherInstanceOf(info[start].As<Object>(), "RegExp") || OtherInstanceOf(info[start].As<Object>(), "Date") || info[start].IsBuffer()) {
+        if (!info[start].IsObject() || OtherInstanceOf(info[start].As<Object>(), "RegExp") || OtherInstanceOf(info[start].As<Object>(), "Date") || info[start].IsBuffer()) {
             // Parameters directly in array.
             // Note: bind parameters start with 1.
             for (int i = start, pos = 1; i < last; i++, pos++) {
                 baton->parameters.push_back(BindParameter(info[i], pos));
             }
         }
-        else if (info[start].IsObject()) {
-            Napi::Object object = info[start].As<Napi::Object>();
-            Napi::Array array = object.GetPropertyNames();
-            int length = array.Length();
-            for (int i = 0; i < length; i++) {
-                Napi::Value name = (array).Get(i);
-                Napi::Number num = name.ToNumber();
-
-                if (num.Int32Value() == num.DoubleValue()) {
-                    baton->parameters.push_back(
-                        BindParameter((object).Get(name), num.Int32Value()));
-                }
-                else {
-                    baton->parameters.push_back(BindParameter((object).Get(name),
-                        name.As<Napi::String>().Utf8Value().c_str()));
-                }
-            }
-        }
         else {
-            return NULL;
+            ParseParameters(info[start], baton->parameters);
         }
     }
 
+    // Strings and buffers are copied, so the parameters may be holding on to
+    // a significant amount of memory until the statement runs.
+    size_t bytes = ParameterBytes(baton->parameters);
+    if (bytes) {
+        baton->Track(bytes);
+        db->ReportExternalMemory();
+    }
+
     return baton;
 }
 
+// Parameters given as an array are bound by position, parameters given as an
+// object by name, or by position for numeric keys.
+void Statement::ParseParameters(const Napi::Value source, Parameters& parameters) {
+    if (source.IsArray()) {
+        Napi::Array array = source.As<Napi::Array>();
+        int length = array.Length();
+        // Note: bind parameters start with 1.
+        for (int i = 0, pos = 1; i < length; i++, pos++) {
+            parameters.push_back(BindParameter((array).Get(i), pos));
+        }
+    }
+    else {
+        Napi::Object object = source.As<Napi::Object>();
+        Napi::Array array = object.GetPropertyNames();
+        int length = array.Length();
+        for (int i = 0; i < length; i++) {
+            Napi::Value name = (array).Get(i);
+            Napi::Number num = name.ToNumber();
+
+            if (num.Int32Value() == num.DoubleValue()) {
+                parameters.push_back(
+                    BindParameter((object).Get(name), num.Int32Value()));
+            }
+            else {
+                parameters.push_back(BindParameter((object).Get(name),
+                    name.As<Napi::String>().Utf8Value().c_str()));
+            }
+        }
+    }
+}
+
+size_t Statement::ParameterBytes(const Parameters& parameters) {
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < parameters.size(); i++) {
+        Values::Field* field = parameters[i];
+        if (field == NULL) continue;
+        if (field->type == SQLITE_TEXT) {
+            bytes += ((Values::Text*)field)->value.size();
+        }
+        else if (field->type == SQLITE_BLOB) {
+            bytes += ((Values::Blob*)field)->length;
+        }
+    }
+    return bytes;
+}
+
 bool Statement::Bind(const Parameters & parameters) {
+    if (Cancellation::Cancelled()) {
+        // Cancelled while waiting for a worker; don't start stepping.
+        status = SQLITE_INTERRUPT;
+        message = "interrupted";
+        return false;
+    }
+
     if (parameters.size() == 0) {
         return true;
     }
 
-    sqlite3_reset(_handle);
-    sqlite3_clear_bindings(_handle);
+    status = BindParameters(_handle, parameters);
+    if (status != SQLITE_OK) {
+        message = std::string(sqlite3_errmsg(db->_handle));
+        return false;
+    }
+
+    return true;
+}
+
+int Statement::BindParameters(sqlite3_stmt* handle, const Parameters& parameters) {
+    int status = SQLITE_OK;
+
+    sqlite3_reset(handle);
+    sqlite3_clear_bindings(handle);
 
     Parameters::const_iterator it = parameters.begin();
     Parameters::const_iterator end = parameters.end();
@@ -294,41 +505,40 @@ bool Statement::Bind(const Parameters & parameters) {
                 pos = field->index;
             }
             else {
-                pos = sqlite3_bind_parameter_index(_handle, field->name.c_str());
+                pos = sqlite3_bind_parameter_index(handle, field->name.c_str());
             }
 
             switch (field->type) {
                 case SQLITE_INTEGER: {
-                    status = sqlite3_bind_int(_handle, pos,
+                    status = sqlite3_bind_int(handle, pos,
                         ((Values::Integer*)field)->value);
                 } break;
                 case SQLITE_FLOAT: {
-                    status = sqlite3_bind_double(_handle, pos,
+                    status = sqlite3_bind_double(handle, pos,
                         ((Values::Float*)field)->value);
                 } break;
                 case SQLITE_TEXT: {
-                    status = sqlite3_bind_text(_handle, pos,
+                    status = sqlite3_bind_text(handle, pos,
                         ((Values::Text*)field)->value.c_str(),
                         ((Values::Text*)field)->value.size(), SQLITE_TRANSIENT);
                 } break;
                 case SQLITE_BLOB: {
-                    status = sqlite3_bind_blob(_handle, pos,
+                    status = sqlite3_bind_blob(handle, pos,
                         ((Values::Blob*)field)->value,
                         ((Values::Blob*)field)->length, SQLITE_TRANSIENT);
                 } break;
                 case SQLITE_NULL: {
-                    status = sqlite3_bind_null(_handle, pos);
+                    status = sqlite3_bind_null(handle, pos);
                 } break;
             }
 
             if (status != SQLITE_OK) {
-                message = std::string(sqlite3_errmsg(db->_handle));
-                return false;
+                return status;
             }
         }
     }
 
-    return true;
+    return SQLITE_OK;
 }
 
 Napi::Value Statement::Bind(const Napi::CallbackInfo& info) {
@@ -403,6 +613,7 @@ void Statement::Work_BeginGet(Baton* baton) {
 
 void Statement::Work_Get(napi_env e, void* data) {
     STATEMENT_INIT(RowBaton);
+    Database::NoBusyWait busy_scope(stmt->db->busy_retry > 0);
 
     if (stmt->status != SQLITE_DONE || baton->parameters.size()) {
         sqlite3_mutex* mtx = sqlite3_db_mutex(stmt->db->_handle);
@@ -413,20 +624,24 @@ void Statement::Work_Get(napi_env e, void* data) {
 
             if (!(stmt->status == SQLITE_ROW || stmt->status == SQLITE_DONE)) {
                 stmt->message = std::string(sqlite3_errmsg(stmt->db->_handle));
+                stmt->extended_status = sqlite3_extended_errcode(stmt->db->_handle);
             }
         }
 
+        stmt->db->ConfirmCommit();
         sqlite3_mutex_leave(mtx);
 
         if (stmt->status == SQLITE_ROW) {
             // Acquire one result row before returning.
-            GetRow(&baton->row, stmt->_handle);
+            baton->Track(GetRow(&baton->row, stmt->_handle));
         }
     }
 }
 
 void Statement::Work_AfterGet(napi_env e, napi_status status, void* data) {
     STATEMENT_INIT(RowBaton);
+    STATEMENT_RETRY(Get);
+    stmt->db->ReportExternalMemory();
 
     Napi::Env env = stmt->Env();
     Napi::HandleScope scope(env);
@@ -437,7 +652,11 @@ void Statement::Work_AfterGet(napi_env e, napi_status status, void* data) {
     else {
         // Fire callbacks.
         Napi::Function cb = baton->callback.Value();
-        if (!cb.IsUndefined() && cb.IsFunction()) {
+        if (baton->deferred) {
+            ResolveDeferred(env, baton->deferred, stmt->status == SQLITE_ROW ?
+                RowToJS(env, &baton->row) : env.Undefined());
+        }
+        else if (!cb.IsUndefined() && cb.IsFunction()) {
             if (stmt->status == SQLITE_ROW) {
                 // Create the result array from the data we acquired.
                 Napi::Value argv[] = { env.Null(), RowToJS(env, &baton->row) };
@@ -474,6 +693,7 @@ void Statement::Work_BeginRun(Baton* baton) {
 
 void Statement::Work_Run(napi_env e, void* data) {
     STATEMENT_INIT(RunBaton);
+    Database::NoBusyWait busy_scope(stmt->db->busy_retry > 0);
 
     sqlite3_mutex* mtx = sqlite3_db_mutex(stmt->db->_handle);
     sqlite3_mutex_enter(mtx);
@@ -488,6 +708,7 @@ void Statement::Work_Run(napi_env e, void* data) {
 
         if (!(stmt->status == SQLITE_ROW || stmt->status == SQLITE_DONE)) {
             stmt->message = std::string(sqlite3_errmsg(stmt->db->_handle));
+            stmt->extended_status = sqlite3_extended_errcode(stmt->db->_handle);
         }
         else {
             baton->inserted_id = sqlite3_last_insert_rowid(stmt->db->_handle);
@@ -495,11 +716,13 @@ void Statement::Work_Run(napi_env e, void* data) {
         }
     }
 
+    stmt->db->ConfirmCommit();
     sqlite3_mutex_leave(mtx);
 }
 
 void Statement::Work_AfterRun(napi_env e, napi_status status, void* data) {
     STATEMENT_INIT(RunBaton);
+    STATEMENT_RETRY(Run);
 
     Napi::Env env = stmt->Env();
     Napi::HandleScope scope(env);
@@ -510,7 +733,15 @@ void Statement::Work_AfterRun(napi_env e, napi_status status, void* data) {
     else {
         // Fire callbacks.
         Napi::Function cb = baton->callback.Value();
-        if (!cb.IsUndefined() && cb.IsFunction()) {
+        if (baton->deferred) {
+            // Concurrent calls would race on the statement's properties, so
+            // the promise gets its own result object.
+            Napi::Object result = Napi::Object::New(env);
+            result.Set(Napi::String::New(env, "lastID"), Napi::Number::New(env, baton->inserted_id));
+            result.Set(Napi::String::New(env, "changes"), Napi::Number::New(env, baton->changes));
+            ResolveDeferred(env, baton->deferred, result);
+        }
+        else if (!cb.IsUndefined() && cb.IsFunction()) {
             (stmt->Value()).Set(Napi::String::New(env, "lastID"), Napi::Number::New(env, baton->inserted_id));
             (stmt->Value()).Set( Napi::String::New(env, "changes"), Napi::Number::New(env, baton->changes));
 
@@ -526,7 +757,7 @@ Napi::Value Statement::All(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
     Statement* stmt = this;
 
-    Baton* baton = stmt->Bind<RowsBaton>(info);
+    Baton* baton = stmt->WithLimits(stmt->Bind<RowsBaton>(info));
     if (baton == NULL) {
         Napi::Error::New(env, "Data type is not supported").ThrowAsJavaScriptException();
         return env.Null();
@@ -543,6 +774,7 @@ void Statement::Work_BeginAll(Baton* baton) {
 
 void Statement::Work_All(napi_env e, void* data) {
     STATEMENT_INIT(RowsBaton);
+    Database::NoBusyWait busy_scope(stmt->db->busy_retry > 0);
 
     sqlite3_mutex* mtx = sqlite3_db_mutex(stmt->db->_handle);
     sqlite3_mutex_enter(mtx);
@@ -553,22 +785,39 @@ void Statement::Work_All(napi_env e, void* data) {
     }
 
     if (stmt->Bind(baton->parameters)) {
+        sqlite3_int64 bytes = 0;
         while ((stmt->status = sqlite3_step(stmt->_handle)) == SQLITE_ROW) {
+            if (stmt->ExceedsLimits(baton, baton->rows.size() + 1, bytes)) {
+                break;
+            }
             Row* row = new Row();
-            GetRow(row, stmt->_handle);
+            bytes += GetRow(row, stmt->_handle);
             baton->rows.push_back(row);
+            if (stmt->ExceedsLimits(baton, baton->rows.size(), bytes)) {
+                break;
+            }
         }
+        baton->Track(bytes);
 
-        if (stmt->status != SQLITE_DONE) {
+        if (stmt->status != SQLITE_DONE && stmt->status != SQLITE_TOOBIG) {
             stmt->message = std::string(sqlite3_errmsg(stmt->db->_handle));
+            stmt->extended_status = sqlite3_extended_errcode(stmt->db->_handle);
         }
     }
 
+    stmt->db->ConfirmCommit();
     sqlite3_mutex_leave(mtx);
 }
 
 void Statement::Work_AfterAll(napi_env e, napi_status status, void* data) {
     STATEMENT_INIT(RowsBaton);
+    // Rows already returned can't be taken back, so only an empty result is
+    // retried.
+    if (baton->rows.empty()) {
+        STATEMENT_RETRY(All);
+    }
+    // Let V8 know about the result data before converting it.
+    stmt->db->ReportExternalMemory();
 
     Napi::Env env = stmt->Env();
     Napi::HandleScope scope(env);
@@ -579,26 +828,22 @@ void Statement::Work_AfterAll(napi_env e, napi_status status, void* data) {
     else {
         // Fire callbacks.
         Napi::Function cb = baton->callback.Value();
-        if (!cb.IsUndefined() && cb.IsFunction()) {
-            if (baton->rows.size()) {
-                // Create the result array from the data we acquired.
-                Napi::Array result(Napi::Array::New(env, baton->rows.size()));
-                Rows::const_iterator it = baton->rows.begin();
-                Rows::const_iterator end = baton->rows.end();
-                for (int i = 0; it < end; ++it, i++) {
-                    (result).Set(i, RowToJS(env,*it));
-                    delete *it;
-                }
+        if (baton->deferred || (!cb.IsUndefined() && cb.IsFunction())) {
+            // Create the result array from the data we acquired.
+            Napi::Array result(Napi::Array::New(env, baton->rows.size()));
+            Rows::const_iterator it = baton->rows.begin();
+            Rows::const_iterator end = baton->rows.end();
+            for (int i = 0; it < end; ++it, i++) {
+                (result).Set(i, RowToJS(env,*it));
+                delete *it;
+            }
+            baton->rows.clear();
 
-                Napi::Value argv[] = { env.Null(), result };
-                TRY_CATCH_CALL(stmt->Value(), cb, 2, argv);
+            if (baton->deferred) {
+                ResolveDeferred(env, baton->deferred, result);
             }
             else {
-                // There were no result rows.
-                Napi::Value argv[] = {
-                    env.Null(),
-                    Napi::Array::New(env, 0)
-                };
+                Napi::Value argv[] = { env.Null(), result };
                 TRY_CATCH_CALL(stmt->Value(), cb, 2, argv);
             }
         }
@@ -607,12 +852,158 @@ void Statement::Work_AfterAll(napi_env e, napi_status status, void* data) {
     STATEMENT_END();
 }
 
+// Statement#runSync, #getSync and #allSync([bind1, bind2, ...]) run the
+// statement right away on the main thread using the same work functions as
+// the asynchronous calls. They can only be used while the database is idle,
+// see Database::CheckSync(), and throw on errors.
+bool Statement::CheckSync(Napi::Env env) {
+    if (finalized) {
+        EXCEPTION(Napi::String::New(env, "Statement is already finalized"), SQLITE_MISUSE, exception);
+        Napi::Error(env, exception).ThrowAsJavaScriptException();
+        return false;
+    }
+    if (!db->CheckSync(env)) {
+        return false;
+    }
+    if (!prepared || locked || !queue.empty()) {
+        EXCEPTION(Napi::String::New(env, "Statement is busy"), SQLITE_BUSY, exception);
+        Napi::Error(env, exception).ThrowAsJavaScriptException();
+        return false;
+    }
+    return true;
+}
+
+void Statement::ThrowSync(Napi::Env env) {
+    EXCEPTION(Napi::String::New(env, message.c_str()), status, exception);
+    Napi::Error(env, exception).ThrowAsJavaScriptException();
+}
+
+// Returns the statement, with lastID and changes set as for run().
+Napi::Value Statement::RunSync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (!CheckSync(env)) {
+        return env.Null();
+    }
+
+    RunBaton* baton = Bind<RunBaton>(info);
+    if (baton == NULL) {
+        Napi::Error::New(env, "Data type is not supported").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    Work_Run(env, baton);
+
+    Napi::Value result = info.This();
+    if (status != SQLITE_ROW && status != SQLITE_DONE) {
+        ThrowSync(env);
+        result = env.Null();
+    }
+    else {
+        Value().Set(Napi::String::New(env, "lastID"), Napi::Number::New(env, baton->inserted_id));
+        Value().Set(Napi::String::New(env, "changes"), Napi::Number::New(env, baton->changes));
+    }
+    delete baton;
+    return result;
+}
+
+// Returns the first row, or undefined when there is none.
+Napi::Value Statement::GetSync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (!CheckSync(env)) {
+        return env.Null();
+    }
+
+    RowBaton* baton = Bind<RowBaton>(info);
+    if (baton == NULL) {
+        Napi::Error::New(env, "Data type is not supported").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    Work_Get(env, baton);
+
+    Napi::Value result = env.Undefined();
+    if (status == SQLITE_ROW) {
+        result = RowToJS(env, &baton->row);
+    }
+    else if (status != SQLITE_DONE) {
+        ThrowSync(env);
+        result = env.Null();
+    }
+    delete baton;
+    return result;
+}
+
+// Returns all rows as an array.
+Napi::Value Statement::AllSync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (!CheckSync(env)) {
+        return env.Null();
+    }
+
+    RowsBaton* baton = WithLimits(Bind<RowsBaton>(info));
+    if (baton == NULL) {
+        Napi::Error::New(env, "Data type is not supported").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    Work_All(env, baton);
+
+    Napi::Value result;
+    if (status != SQLITE_DONE) {
+        ThrowSync(env);
+        result = env.Null();
+    }
+    else {
+        Napi::Array rows = Napi::Array::New(env, baton->rows.size());
+        for (size_t i = 0; i < baton->rows.size(); i++) {
+            rows.Set(i, RowToJS(env, baton->rows[i]));
+        }
+        result = rows;
+    }
+    delete baton;
+    return result;
+}
+
+// Statement#runAsync, #getAsync and #allAsync([bind1, bind2, ...]) return a
+// promise instead of taking a callback. The promise is created here and
+// settled directly when the call completes, without a JS callback in
+// between. runAsync() resolves with { lastID, changes } rather than setting
+// them on the statement, since several calls may be in flight at once.
+Napi::Value Statement::RunAsync(const Napi::CallbackInfo& info) {
+    return SchedulePromise(info.Env(), Bind<RunBaton>(info), Work_BeginRun);
+}
+
+Napi::Value Statement::GetAsync(const Napi::CallbackInfo& info) {
+    return SchedulePromise(info.Env(), Bind<RowBaton>(info), Work_BeginGet);
+}
+
+Napi::Value Statement::AllAsync(const Napi::CallbackInfo& info) {
+    return SchedulePromise(info.Env(), WithLimits(Bind<RowsBaton>(info)), Work_BeginAll);
+}
+
+Napi::Value Statement::SchedulePromise(Napi::Env env, Baton* baton, Work_Callback callback) {
+    if (baton == NULL) {
+        Napi::Error::New(env, "Data type is not supported").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    napi_value promise = CreateDeferred(env, &baton->deferred);
+    if (promise == NULL) {
+        delete baton;
+        Napi::Error::New(env).ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    Schedule(callback, baton);
+    return Napi::Value(env, promise);
+}
+
 //----------------------------------------------------------------------
 Napi::Value Statement::AllMarshal(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
     Statement* stmt = this;
 
-    Baton* baton = stmt->Bind<MarshalBaton>(info);
+    Baton* baton = stmt->WithLimits(stmt->Bind<MarshalBaton>(info));
     if (baton == NULL) {
         Napi::Error::New(env, "Data type is not supported").ThrowAsJavaScriptException();
         return env.Null();
@@ -628,6 +1019,7 @@ void Statement::Work_BeginAllMarshal(Baton* baton) {
 
 void Statement::Work_AllMarshal(napi_env e, void* data) {
     STATEMENT_INIT(MarshalBaton);
+    Database::NoBusyWait busy_scope(stmt->db->busy_retry > 0);
 
     sqlite3_mutex* mtx = sqlite3_db_mutex(stmt->db->_handle);
     sqlite3_mutex_enter(mtx);
@@ -647,54 +1039,93 @@ void Statement::Work_AllMarshal(napi_env e, void* data) {
     }
 
     if (stmt->Bind(baton->parameters)) {
+        sqlite3_int64 bytes = 0;
         while ((stmt->status = sqlite3_step(sqstmt)) == SQLITE_ROW) {
+          if (stmt->ExceedsLimits(baton, baton->countRows + 1, bytes)) {
+            break;
+          }
           baton->countRows++;
+          MarshalRow(sqstmt, baton->colData);
+          bytes = 0;
           for (int i = 0; i < columns; i++) {
-            int type = sqlite3_column_type(sqstmt, i);
-            switch (type) {
-                case SQLITE_INTEGER: {
-                    int64_t value = sqlite3_column_int64(sqstmt, i);
-                    int32_t smallValue = int32_t(value);
-                    if (value == smallValue) {
-                      baton->colData[i].marshalInt(smallValue);
-                    } else {
-                      baton->colData[i].marshalDouble(value);
-                    }
-                    break;
-                }
-                case SQLITE_FLOAT:
-                    baton->colData[i].marshalDouble(sqlite3_column_double(sqstmt, i));
-                    break;
-                case SQLITE_TEXT: {
-                    const char* text = (const char*)sqlite3_column_text(sqstmt, i);
-                    int length = sqlite3_column_bytes(sqstmt, i);
-                    baton->colData[i].marshalUnicode(text, length);
-                }   break;
-                case SQLITE_BLOB: {
-                    const char* blob = (const char*)sqlite3_column_blob(sqstmt, i);
-                    int length = sqlite3_column_bytes(sqstmt, i);
-                    baton->colData[i].marshalString(blob, length);
-                }   break;
-                case SQLITE_NULL:
-                    baton->colData[i].marshalNone();
-                    break;
-                default:
-                    assert(false);
-            }
+            bytes += baton->colData[i].getBuffer().size();
+          }
+          if (stmt->ExceedsLimits(baton, baton->countRows, bytes)) {
+            break;
           }
         }
+        baton->Track(bytes);
 
-        if (stmt->status != SQLITE_DONE) {
+        if (stmt->status != SQLITE_DONE && stmt->status != SQLITE_TOOBIG) {
             stmt->message = std::string(sqlite3_errmsg(stmt->db->_handle));
+            stmt->extended_status = sqlite3_extended_errcode(stmt->db->_handle);
         }
     }
 
+    stmt->db->ConfirmCommit();
     sqlite3_mutex_leave(mtx);
 }
 
+// Appends the current row of stmt to the per-column marshal buffers.
+void Statement::MarshalRow(sqlite3_stmt* stmt, std::vector<Marshaller>& columns) {
+    for (size_t i = 0; i < columns.size(); i++) {
+        int type = sqlite3_column_type(stmt, i);
+        switch (type) {
+            case SQLITE_INTEGER: {
+                int64_t value = sqlite3_column_int64(stmt, i);
+                int32_t smallValue = int32_t(value);
+                if (value == smallValue) {
+                  columns[i].marshalInt(smallValue);
+                } else {
+                  columns[i].marshalDouble(value);
+                }
+                break;
+            }
+            case SQLITE_FLOAT:
+                columns[i].marshalDouble(sqlite3_column_double(stmt, i));
+                break;
+            case SQLITE_TEXT: {
+                const char* text = (const char*)sqlite3_column_text(stmt, i);
+                int length = sqlite3_column_bytes(stmt, i);
+                columns[i].marshalUnicode(text, length);
+            }   break;
+            case SQLITE_BLOB: {
+                const char* blob = (const char*)sqlite3_column_blob(stmt, i);
+                int length = sqlite3_column_bytes(stmt, i);
+                columns[i].marshalString(blob, length);
+            }   break;
+            case SQLITE_NULL:
+                columns[i].marshalNone();
+                break;
+            default:
+                assert(false);
+        }
+    }
+}
+
+// Builds the {column: [values...]} dict that allMarshal() returns.
+Napi::Value Statement::MarshalResult(Napi::Env env, const std::vector<std::string>& names,
+                                     const std::vector<Marshaller>& columns, int rows) {
+    Marshaller marshaller;
+    marshaller.marshalDictBegin();
+    for (size_t i = 0; i < names.size(); i++) {
+      marshaller.marshalString(names[i]);
+      marshaller.marshalList(rows);
+      marshaller.append(columns[i]);
+    }
+    marshaller.marshalDictEnd();
+    const std::vector<char> &buffer = marshaller.getBuffer();
+    return Napi::Buffer<char>::Copy(env, &buffer[0], buffer.size());
+}
+
 void Statement::Work_AfterAllMarshal(napi_env e, napi_status status, void* data) {
   //Nan::HandleScope scope;
     STATEMENT_INIT(MarshalBaton);
+    // Like all(), only an empty result is retried.
+    if (!baton->countRows) {
+        STATEMENT_RETRY(AllMarshal);
+    }
+    stmt->db->ReportExternalMemory();
 
     Napi::Env env = stmt->Env();
     if (stmt->status != SQLITE_DONE) {
@@ -703,16 +1134,7 @@ void Statement::Work_AfterAllMarshal(napi_env e, napi_status status, void* data)
         // Fire callbacks.
         Napi::Function cb = baton->callback.Value();
         if (!cb.IsUndefined() && cb.IsFunction()) {
-          Marshaller marshaller;
-          marshaller.marshalDictBegin();
-          for (size_t i = 0; i < baton->colNames.size(); i++) {
-            marshaller.marshalString(baton->colNames[i]);
-            marshaller.marshalList(baton->countRows);
-            marshaller.append(baton->colData[i]);
-          }
-          marshaller.marshalDictEnd();
-          const std::vector<char> &buffer = marshaller.getBuffer();
-          Napi::Value result(Napi::Buffer<char>::Copy(env, &buffer[0], buffer.size()));
+          Napi::Value result = MarshalResult(env, baton->colNames, baton->colData, baton->countRows);
           Napi::Value argv[] = { env.Null(), result };
           TRY_CATCH_CALL(stmt->Value(), cb, 2, argv);
         }
@@ -720,6 +1142,226 @@ void Statement::Work_AfterAllMarshal(napi_env e, napi_status status, void* data)
     STATEMENT_END();
 }
 
+//----------------------------------------------------------------------
+Napi::Value Statement::AllJSON(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Statement* stmt = this;
+
+    Baton* baton = stmt->WithLimits(stmt->Bind<JSONBaton>(info));
+    if (baton == NULL) {
+        Napi::Error::New(env, "Data type is not supported").ThrowAsJavaScriptException();
+        return env.Null();
+    } else {
+        stmt->Schedule(Work_BeginAllJSON, baton);
+        return info.This();
+    }
+}
+
+Napi::Value Statement::AllNDJSON(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Statement* stmt = this;
+
+    JSONBaton* baton = stmt->WithLimits(stmt->Bind<JSONBaton>(info));
+    if (baton == NULL) {
+        Napi::Error::New(env, "Data type is not supported").ThrowAsJavaScriptException();
+        return env.Null();
+    } else {
+        baton->ndjson = true;
+        stmt->Schedule(Work_BeginAllJSON, baton);
+        return info.This();
+    }
+}
+
+void Statement::Work_BeginAllJSON(Baton* baton) {
+    STATEMENT_BEGIN(AllJSON);
+}
+
+// Whether a column name is an array index ("0" to "4294967294" without
+// leading zeros). Objects list those keys first, in ascending order.
+static bool ArrayIndex(const char* name, uint32_t* index) {
+    size_t length = strlen(name);
+    if (length == 0 || length > 10 || (name[0] == '0' && length > 1)) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (name[i] < '0' || name[i] > '9') return false;
+        value = value * 10 + (name[i] - '0');
+    }
+    if (value >= 4294967295ULL) return false;
+    *index = (uint32_t)value;
+    return true;
+}
+
+void Statement::Work_AllJSON(napi_env e, void* data) {
+    STATEMENT_INIT(JSONBaton);
+    Database::NoBusyWait busy_scope(stmt->db->busy_retry > 0);
+
+    sqlite3_mutex* mtx = sqlite3_db_mutex(stmt->db->_handle);
+    sqlite3_mutex_enter(mtx);
+
+    sqlite3_stmt* sqstmt = stmt->_handle;
+    JSONEncoder& json = baton->json;
+
+    // RowToJS() assigns columns to object properties in order, so a repeated
+    // column name keeps its first position but takes the last value. Work out
+    // that layout once, with each key already encoded.
+    int columns = sqlite3_column_count(sqstmt);
+    std::vector<std::string> keys;
+    std::vector<int> sources;
+    for (int i = 0; i < columns; i++) {
+        JSONEncoder key;
+        const char* name = sqlite3_column_name(sqstmt, i);
+        key.encodeString(name, strlen(name));
+        key.raw(':');
+        int existing = -1;
+        for (size_t j = 0; j < keys.size(); j++) {
+            if (keys[j] == key.getBuffer()) existing = j;
+        }
+        if (existing < 0) {
+            keys.push_back(key.getBuffer());
+            sources.push_back(i);
+        }
+        else {
+            sources[existing] = i;
+        }
+    }
+
+    // Array index keys come first, like JSON.stringify() lists them.
+    std::vector<std::pair<uint32_t, size_t> > indices;
+    std::vector<size_t> others;
+    for (size_t k = 0; k < keys.size(); k++) {
+        uint32_t index;
+        if (ArrayIndex(sqlite3_column_name(sqstmt, sources[k]), &index)) {
+            indices.push_back(std::make_pair(index, k));
+        }
+        else {
+            others.push_back(k);
+        }
+    }
+    if (!indices.empty()) {
+        std::sort(indices.begin(), indices.end());
+        std::vector<std::string> ordered_keys;
+        std::vector<int> ordered_sources;
+        for (size_t j = 0; j < indices.size(); j++) {
+            ordered_keys.push_back(keys[indices[j].second]);
+            ordered_sources.push_back(sources[indices[j].second]);
+        }
+        for (size_t j = 0; j < others.size(); j++) {
+            ordered_keys.push_back(keys[others[j]]);
+            ordered_sources.push_back(sources[others[j]]);
+        }
+        keys.swap(ordered_keys);
+        sources.swap(ordered_sources);
+    }
+
+    // Make sure that we also reset when there are no parameters.
+    if (!baton->parameters.size()) {
+        sqlite3_reset(sqstmt);
+    }
+
+    if (stmt->Bind(baton->parameters)) {
+        bool first = true;
+        sqlite3_int64 count = 0;
+        if (!baton->ndjson) json.raw('[');
+        while ((stmt->status = sqlite3_step(sqstmt)) == SQLITE_ROW) {
+            if (stmt->ExceedsLimits(baton, ++count, json.size())) {
+                break;
+            }
+            if (baton->ndjson) {
+                if (!first) json.raw('\n');
+            }
+            else if (!first) {
+                json.raw(',');
+            }
+            first = false;
+
+            json.raw('{');
+            for (size_t k = 0; k < keys.size(); k++) {
+                if (k) json.raw(',');
+                json.raw(keys[k]);
+                int i = sources[k];
+                switch (sqlite3_column_type(sqstmt, i)) {
+                    case SQLITE_INTEGER:
+                        json.encodeInteger(sqlite3_column_int64(sqstmt, i));
+                        break;
+                    case SQLITE_FLOAT:
+                        json.encodeDouble(sqlite3_column_double(sqstmt, i));
+                        break;
+                    case SQLITE_TEXT: {
+                        const char* text = (const char*)sqlite3_column_text(sqstmt, i);
+                        int length = sqlite3_column_bytes(sqstmt, i);
+                        json.encodeString(text, length);
+                    }   break;
+                    case SQLITE_BLOB: {
+                        const unsigned char* blob = (const unsigned char*)sqlite3_column_blob(sqstmt, i);
+                        int length = sqlite3_column_bytes(sqstmt, i);
+                        json.encodeBlob(blob, length);
+                    }   break;
+                    default:
+                        json.encodeNull();
+                }
+            }
+            json.raw('}');
+            if (stmt->ExceedsLimits(baton, count, json.size())) {
+                break;
+            }
+        }
+        if (baton->ndjson) {
+            if (!first) json.raw('\n');
+        }
+        else {
+            json.raw(']');
+        }
+
+        if (stmt->status != SQLITE_DONE && stmt->status != SQLITE_TOOBIG) {
+            stmt->message = std::string(sqlite3_errmsg(stmt->db->_handle));
+            stmt->extended_status = sqlite3_extended_errcode(stmt->db->_handle);
+            // Leaves nothing behind when failing before the first row, so
+            // that the call can be run again.
+            if (first) json.getBuffer().clear();
+        }
+        baton->Track(json.size());
+    }
+
+    stmt->db->ConfirmCommit();
+    sqlite3_mutex_leave(mtx);
+}
+
+static void FreeJSON(Napi::Env env, char* data, std::string* json) {
+    delete json;
+}
+
+void Statement::Work_AfterAllJSON(napi_env e, napi_status status, void* data) {
+    STATEMENT_INIT(JSONBaton);
+    // Like all(), only an empty result is retried.
+    if (!baton->json.size()) {
+        STATEMENT_RETRY(AllJSON);
+    }
+    stmt->db->ReportExternalMemory();
+
+    Napi::Env env = stmt->Env();
+    Napi::HandleScope scope(env);
+
+    if (stmt->status != SQLITE_DONE) {
+        Error(baton);
+    }
+    else {
+        // Fire callbacks.
+        Napi::Function cb = baton->callback.Value();
+        if (!cb.IsUndefined() && cb.IsFunction()) {
+            // Hand the encoded text over to the Buffer without copying it.
+            std::string* json = new std::string();
+            json->swap(baton->json.getBuffer());
+            Napi::Value result(Napi::Buffer<char>::New(env, &(*json)[0], json->size(), FreeJSON, json));
+            Napi::Value argv[] = { env.Null(), result };
+            TRY_CATCH_CALL(stmt->Value(), cb, 2, argv);
+        }
+    }
+
+    STATEMENT_END();
+}
+
 //----------------------------------------------------------------------
 
 Napi::Value Statement::Each(const Napi::CallbackInfo& info) {
@@ -728,6 +1370,11 @@ Napi::Value Statement::Each(const Napi::CallbackInfo& info) {
 
     int last = info.Length();
 
+    std::shared_ptr<Cancellation::State> cancellation;
+    if (last > 0 && (cancellation = Cancellation::From(info[last - 1]))) {
+        last--;
+    }
+
     Napi::Function completed;
     if (last >= 2 && info[last - 1].IsFunction() && info[last - 2].IsFunction()) {
         completed = info[--last].As<Napi::Function>();
@@ -739,6 +1386,7 @@ Napi::Value Statement::Each(const Napi::CallbackInfo& info) {
         return env.Null();
     }
     else {
+        baton->cancellation = cancellation;
         baton->completed.Reset(completed, 1);
         stmt->Schedule(Work_BeginEach, baton);
         return info.This();
@@ -773,22 +1421,31 @@ void Statement::Work_Each(napi_env e, void* data) {
     if (stmt->Bind(baton->parameters)) {
         while (true) {
             sqlite3_mutex_enter(mtx);
+            if (async->stopped) {
+                // The row callback asked for no more rows, so leave the rest
+                // of the result unread.
+                sqlite3_reset(stmt->_handle);
+                stmt->status = SQLITE_DONE;
+                stmt->db->ConfirmCommit();
+                sqlite3_mutex_leave(mtx);
+                break;
+            }
             stmt->status = sqlite3_step(stmt->_handle);
             if (stmt->status == SQLITE_ROW) {
                 sqlite3_mutex_leave(mtx);
                 Row* row = new Row();
-                GetRow(row, stmt->_handle);
-                NODE_SQLITE3_MUTEX_LOCK(&async->mutex)
-                async->data.push_back(row);
+                size_t bytes = GetRow(row, stmt->_handle);
+                stmt->db->AdjustExternalMemory(bytes);
+                async->memory += bytes;
+                async->rows.push(row);
                 retrieved++;
-                NODE_SQLITE3_MUTEX_UNLOCK(&async->mutex)
-
-                uv_async_send(&async->watcher);
+                async->Send();
             }
             else {
                 if (stmt->status != SQLITE_DONE) {
                     stmt->message = std::string(sqlite3_errmsg(stmt->db->_handle));
                 }
+                stmt->db->ConfirmCommit();
                 sqlite3_mutex_leave(mtx);
                 break;
             }
@@ -796,7 +1453,7 @@ void Statement::Work_Each(napi_env e, void* data) {
     }
 
     async->completed = true;
-    uv_async_send(&async->watcher);
+    async->Send();
 }
 
 void Statement::CloseCallback(uv_handle_t* handle) {
@@ -812,16 +1469,24 @@ void Statement::AsyncEach(uv_async_t* handle) {
     Napi::Env env = async->stmt->Env();
     Napi::HandleScope scope(env);
 
+    // Rows sent from here on need another wakeup. Whether the worker is done
+    // is read before taking the rows, so that none are left behind.
+    async->signalled.exchange(false);
+    bool completed = async->completed;
+
     while (true) {
-        // Get the contents out of the data cache for us to process in the JS callback.
+        // Get the contents out of the queue for us to process in the JS callback.
         Rows rows;
-        NODE_SQLITE3_MUTEX_LOCK(&async->mutex)
-        rows.swap(async->data);
-        NODE_SQLITE3_MUTEX_UNLOCK(&async->mutex)
-
+        async->rows.drain(rows);
         if (rows.empty()) {
             break;
         }
+        // Covers at least the rows taken, as their bytes are counted before
+        // they are pushed.
+        int64_t memory = async->memory.exchange(0);
+
+        Database* db = async->stmt->db;
+        db->ReportExternalMemory();
 
         Napi::Function cb = async->item_cb.Value();
         if (!cb.IsUndefined() && cb.IsFunction()) {
@@ -831,16 +1496,34 @@ void Statement::AsyncEach(uv_async_t* handle) {
             Rows::const_iterator it = rows.begin();
             Rows::const_iterator end = rows.end();
             for (int i = 0; it < end; ++it, i++) {
+                if (async->stopped) {
+                    // Drop rows that were fetched before the worker noticed.
+                    for (unsigned int j = 0; j < (*it)->size(); j++) {
+                        Values::Field* field = (**it)[j];
+                        DELETE_FIELD(field);
+                    }
+                    delete *it;
+                    continue;
+                }
                 argv[1] = RowToJS(env,*it);
                 async->retrieved++;
-                TRY_CATCH_CALL(async->stmt->Value(), cb, 2, argv);
+                std::vector<napi_value> args(argv, argv + 2);
+                Napi::Value result = cb.MakeCallback(async->stmt->Value(), args);
+                if (!result.IsEmpty() && result.IsBoolean() &&
+                        !result.As<Napi::Boolean>().Value()) {
+                    // Returning false from the row callback stops the iteration.
+                    async->stopped = true;
+                }
                 delete *it;
             }
         }
+
+        db->AdjustExternalMemory(-memory);
+        db->ReportExternalMemory();
     }
 
     Napi::Function cb = async->completed_cb.Value();
-    if (async->completed) {
+    if (completed) {
         if (!cb.IsEmpty() &&
                 cb.IsFunction()) {
             Napi::Value argv[] = {
@@ -866,6 +1549,85 @@ void Statement::Work_AfterEach(napi_env e, napi_status status, void* data) {
     STATEMENT_END();
 }
 
+// Steps the statement up to `count` more rows from wherever it currently is,
+// without resetting it first. This is the building block for cursors.
+Napi::Value Statement::Fetch(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Statement* stmt = this;
+
+    REQUIRE_ARGUMENT_INTEGER(0, count);
+    OPTIONAL_ARGUMENT_FUNCTION(1, callback);
+
+    if (count <= 0) {
+        Napi::RangeError::New(env, "Count must be a positive integer").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    Baton* baton = new FetchBaton(stmt, callback, count);
+    stmt->Schedule(Work_BeginFetch, baton);
+    return info.This();
+}
+
+void Statement::Work_BeginFetch(Baton* baton) {
+    STATEMENT_BEGIN(Fetch);
+}
+
+void Statement::Work_Fetch(napi_env e, void* data) {
+    STATEMENT_INIT(FetchBaton);
+
+    sqlite3_mutex* mtx = sqlite3_db_mutex(stmt->db->_handle);
+    sqlite3_mutex_enter(mtx);
+
+    // Once the result is exhausted we must not step again, since SQLite would
+    // silently restart the query.
+    if (stmt->status != SQLITE_DONE) {
+        while ((int)baton->rows.size() < baton->count &&
+                (stmt->status = sqlite3_step(stmt->_handle)) == SQLITE_ROW) {
+            Row* row = new Row();
+            baton->Track(GetRow(row, stmt->_handle));
+            baton->rows.push_back(row);
+        }
+
+        if (stmt->status != SQLITE_ROW && stmt->status != SQLITE_DONE) {
+            stmt->message = std::string(sqlite3_errmsg(stmt->db->_handle));
+        }
+    }
+
+    stmt->db->ConfirmCommit();
+    sqlite3_mutex_leave(mtx);
+}
+
+void Statement::Work_AfterFetch(napi_env e, napi_status status, void* data) {
+    STATEMENT_INIT(FetchBaton);
+    stmt->db->ReportExternalMemory();
+
+    Napi::Env env = stmt->Env();
+    Napi::HandleScope scope(env);
+
+    if (stmt->status != SQLITE_ROW && stmt->status != SQLITE_DONE) {
+        Error(baton);
+    }
+    else {
+        // Fire callbacks.
+        Napi::Function cb = baton->callback.Value();
+        if (!cb.IsUndefined() && cb.IsFunction()) {
+            Napi::Array result(Napi::Array::New(env, baton->rows.size()));
+            Rows::const_iterator it = baton->rows.begin();
+            Rows::const_iterator end = baton->rows.end();
+            for (int i = 0; it < end; ++it, i++) {
+                (result).Set(i, RowToJS(env,*it));
+                delete *it;
+            }
+            baton->rows.clear();
+
+            Napi::Value argv[] = { env.Null(), result };
+            TRY_CATCH_CALL(stmt->Value(), cb, 2, argv);
+        }
+    }
+
+    STATEMENT_END();
+}
+
 Napi::Value Statement::Reset(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
     Statement* stmt = this;
@@ -885,7 +1647,12 @@ void Statement::Work_BeginReset(Baton* baton) {
 void Statement::Work_Reset(napi_env e, void* data) {
     STATEMENT_INIT(Baton);
 
+    sqlite3_mutex* mtx = sqlite3_db_mutex(stmt->db->_handle);
+    sqlite3_mutex_enter(mtx);
+    // Resetting may end the statement's implicit transaction.
     sqlite3_reset(stmt->_handle);
+    stmt->db->ConfirmCommit();
+    sqlite3_mutex_leave(mtx);
     stmt->status = SQLITE_OK;
 }
 
@@ -943,36 +1710,66 @@ Napi::Value Statement::RowToJS(Napi::Env env, Row* row) {
     return scope.Escape(result);
 }
 
-void Statement::GetRow(Row* row, sqlite3_stmt* stmt) {
+// Returns roughly how many bytes of native memory the row holds.
+size_t Statement::GetRow(Row* row, sqlite3_stmt* stmt) {
     int rows = sqlite3_column_count(stmt);
+    size_t bytes = 0;
 
     for (int i = 0; i < rows; i++) {
         int type = sqlite3_column_type(stmt, i);
         const char* name = sqlite3_column_name(stmt, i);
+        bytes += strlen(name);
         switch (type) {
             case SQLITE_INTEGER: {
                 row->push_back(new Values::Integer(name, sqlite3_column_int64(stmt, i)));
+                bytes += sizeof(Values::Integer);
             }   break;
             case SQLITE_FLOAT: {
                 row->push_back(new Values::Float(name, sqlite3_column_double(stmt, i)));
+                bytes += sizeof(Values::Float);
             }   break;
             case SQLITE_TEXT: {
                 const char* text = (const char*)sqlite3_column_text(stmt, i);
                 int length = sqlite3_column_bytes(stmt, i);
                 row->push_back(new Values::Text(name, length, text));
+                bytes += sizeof(Values::Text) + length;
             } break;
             case SQLITE_BLOB: {
                 const void* blob = sqlite3_column_blob(stmt, i);
                 int length = sqlite3_column_bytes(stmt, i);
                 row->push_back(new Values::Blob(name, length, blob));
+                bytes += sizeof(Values::Blob) + length;
             }   break;
             case SQLITE_NULL: {
                 row->push_back(new Values::Null(name));
+                bytes += sizeof(Values::Null);
             }   break;
             default:
                 assert(false);
         }
     }
+
+    return bytes;
+}
+
+// Whether the statement leaves the database unchanged; undefined until it
+// has been prepared.
+Napi::Value Statement::ReadonlyGetter(const Napi::CallbackInfo& info) {
+    Napi::Env env = this->Env();
+    if (!prepared || finalized || _handle == NULL) {
+        return env.Undefined();
+    }
+    return Napi::Boolean::New(env, sqlite3_stmt_readonly(_handle) != 0);
+}
+
+// How many operations of the statement ran inline; see Queue().
+Napi::Value Statement::InlineRunsGetter(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(this->Env(), inline_runs);
+}
+
+// The database the statement belongs to.
+Napi::Value Statement::DatabaseGetter(const Napi::CallbackInfo& info) {
+    return db->Value();
 }
 
 Napi::Value Statement::Finalize_(const Napi::CallbackInfo& info) {
@@ -1030,7 +1827,11 @@ void Statement::CleanQueue() {
 
             Napi::Function cb = call->baton->callback.Value();
 
-            if (prepared && !cb.IsEmpty() &&
+            if (call->baton->deferred) {
+                RejectDeferred(env, call->baton->deferred, exception);
+                called = true;
+            }
+            else if (prepared && !cb.IsEmpty() &&
                 cb.IsFunction()) {
                 TRY_CATCH_CALL(Value(), cb, 1, argv);
                 called = true;
@@ -1051,10 +1852,18 @@ void Statement::CleanQueue() {
     }
     else while (!queue.empty()) {
         // Just delete all items in the queue; we already fired an event when
-        // preparing the statement failed.
+        // preparing the statement failed. Promises still have to be settled,
+        // so they are rejected with the same error.
         Call* call = queue.front();
         queue.pop();
 
+        if (call->baton->deferred) {
+            EXCEPTION(Napi::String::New(env, status != SQLITE_OK ?
+                message.c_str() : "Statement is already finalized"),
+                status != SQLITE_OK ? status : SQLITE_MISUSE, exception);
+            RejectDeferred(env, call->baton->deferred, exception);
+        }
+
         // We don't call the actual callback, so we have to make sure that
         // the baton gets destroyed.
         delete call->baton;
@@ -1,8 +1,10 @@
 #ifndef NODE_SQLITE3_SRC_STATEMENT_H
 #define NODE_SQLITE3_SRC_STATEMENT_H
 
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <string>
 #include <queue>
 #include <vector>
@@ -12,8 +14,9 @@
 #include <uv.h>
 
 #include "database.h"
-#include "threading.h"
+#include "async.h"
 #include "marshal.h"
+#include "json.h"
 
 using namespace Napi;
 
@@ -72,9 +75,9 @@ typedef Row Parameters;
 
 
 class Statement : public Napi::ObjectWrap<Statement> {
-public:
-    static Napi::FunctionReference constructor;
+    friend class Database;
 
+public:
     static Napi::Object Init(Napi::Env env, Napi::Object exports);
     static Napi::Value New(const Napi::CallbackInfo& info);
 
@@ -83,8 +86,15 @@ public:
         Statement* stmt;
         Napi::FunctionReference callback;
         Parameters parameters;
-
-        Baton(Statement* stmt_, Napi::Function cb_) : stmt(stmt_) {
+        // Bytes of parameter and result data owned by this baton, reported
+        // as external memory until the baton is deleted.
+        int64_t memory;
+        Database::BusyRetry busy;
+        std::shared_ptr<Cancellation::State> cancellation;
+        napi_deferred deferred;
+
+        Baton(Statement* stmt_, Napi::Function cb_) :
+                stmt(stmt_), memory(0), deferred(NULL) {
             stmt->Ref();
             callback.Reset(cb_, 1);
         }
@@ -93,9 +103,18 @@ public:
                 Values::Field* field = parameters[i];
                 DELETE_FIELD(field);
             }
+            if (memory) {
+                stmt->db->AdjustExternalMemory(-memory);
+                stmt->db->ReportExternalMemory();
+            }
             stmt->Unref();
             callback.Reset();
         }
+        // May be called from the worker thread.
+        void Track(size_t bytes) {
+            memory += bytes;
+            stmt->db->AdjustExternalMemory(bytes);
+        }
     };
 
     struct RowBaton : Baton {
@@ -111,13 +130,37 @@ public:
         int changes;
     };
 
-    struct RowsBaton : Baton {
+    // Caps on how much a single all()/allMarshal()/allJSON() call may
+    // accumulate; zero means unlimited. Copied from the Database when the
+    // call is made, see Database#configure('maxRows'/'maxBytes').
+    struct ResultLimits {
+        ResultLimits() : max_rows(0), max_bytes(0) {}
+        sqlite3_int64 max_rows;
+        sqlite3_int64 max_bytes;
+    };
+
+    struct RowsBaton : Baton, ResultLimits {
         RowsBaton(Statement* stmt_, Napi::Function cb_) :
             Baton(stmt_, cb_) {}
+        virtual ~RowsBaton() {
+            // Rows are only left over when the call failed part way through.
+            for (Rows::iterator it = rows.begin(); it < rows.end(); ++it) {
+                for (Row::iterator field = (*it)->begin(); field < (*it)->end(); ++field) {
+                    DELETE_FIELD(*field);
+                }
+                delete *it;
+            }
+        }
         Rows rows;
     };
 
-    struct MarshalBaton : Baton {
+    struct FetchBaton : RowsBaton {
+        FetchBaton(Statement* stmt_, Napi::Function cb_, int count_) :
+            RowsBaton(stmt_, cb_), count(count_) {}
+        int count;
+    };
+
+    struct MarshalBaton : Baton, ResultLimits {
       MarshalBaton(Statement* stmt_, Napi::Function cb_) :
             Baton(stmt_, cb_), countRows(0) {}
         std::vector<std::string> colNames;
@@ -125,6 +168,13 @@ public:
         int countRows;
     };
 
+    struct JSONBaton : Baton, ResultLimits {
+        JSONBaton(Statement* stmt_, Napi::Function cb_) :
+            Baton(stmt_, cb_), ndjson(false) {}
+        bool ndjson;
+        JSONEncoder json;
+    };
+
     struct Async;
 
     struct EachBaton : Baton {
@@ -141,15 +191,17 @@ public:
     struct PrepareBaton : Database::Baton {
         Statement* stmt;
         std::string sql;
+        // Hint that the statement will be kept around and reused many times.
+        bool persistent;
         PrepareBaton(Database* db_, Napi::Function cb_, Statement* stmt_) :
-            Baton(db_, cb_), stmt(stmt_) {
+            Baton(db_, cb_), stmt(stmt_), persistent(false) {
             stmt->Ref();
         }
         virtual ~PrepareBaton() {
             stmt->Unref();
-            if (!db->IsOpen() && db->IsLocked()) {
-                // The database handle was closed before the statement could be
-                // prepared.
+            if (!stmt->prepared && !stmt->finalized) {
+                // The database handle was closed, or the call was rejected,
+                // before the statement could be prepared.
                 stmt->Finalize_();
             }
         }
@@ -166,10 +218,15 @@ public:
     struct Async {
         uv_async_t watcher;
         Statement* stmt;
-        Rows data;
-        NODE_SQLITE3_MUTEX_t;
-        bool completed;
+        MPSCQueue<Row*, 1024> rows;
+        std::atomic<int64_t> memory; // Bytes held by the queued rows.
+        // Set while a wakeup is on its way; see ::Async.
+        std::atomic<bool> signalled;
+        std::atomic<bool> completed;
         int retrieved;
+        // Set on the main thread when the row callback returns false; the
+        // worker checks it between sqlite3_step calls.
+        std::atomic<bool> stopped;
 
         // Store the callbacks here because we don't have
         // access to the baton in the async callback.
@@ -177,9 +234,9 @@ public:
         Napi::FunctionReference completed_cb;
 
         Async(Statement* st, uv_async_cb async_cb) :
-                stmt(st), completed(false), retrieved(0) {
+                stmt(st), memory(0), signalled(false), completed(false),
+                retrieved(0), stopped(false) {
             watcher.data = this;
-            NODE_SQLITE3_MUTEX_INIT
             stmt->Ref();
             uv_loop_t *loop;
             napi_get_uv_event_loop(stmt->Env(), &loop);
@@ -190,7 +247,13 @@ public:
             stmt->Unref();
             item_cb.Reset();
             completed_cb.Reset();
-            NODE_SQLITE3_MUTEX_DESTROY
+        }
+
+        // Called from the worker thread.
+        void Send() {
+            if (!signalled.exchange(true)) {
+                uv_async_send(&watcher);
+            }
         }
     };
 
@@ -198,9 +261,13 @@ public:
         db = db_;
         _handle = NULL;
         status = SQLITE_OK;
+        extended_status = SQLITE_OK;
         prepared = false;
         locked = true;
         finalized = false;
+        elapsed = 0;
+        timed_runs = 0;
+        inline_runs = 0;
         db->Ref();
     }
 
@@ -215,10 +282,28 @@ public:
     WORK_DEFINITION(Run);
     WORK_DEFINITION(All);
     WORK_DEFINITION(AllMarshal);
+    WORK_DEFINITION(AllJSON);
+    Napi::Value AllNDJSON(const Napi::CallbackInfo& info);
     WORK_DEFINITION(Each);
+    WORK_DEFINITION(Fetch);
     WORK_DEFINITION(Reset);
 
+    Napi::Value RunSync(const Napi::CallbackInfo& info);
+    Napi::Value GetSync(const Napi::CallbackInfo& info);
+    Napi::Value AllSync(const Napi::CallbackInfo& info);
+
+    Napi::Value RunAsync(const Napi::CallbackInfo& info);
+    Napi::Value GetAsync(const Napi::CallbackInfo& info);
+    Napi::Value AllAsync(const Napi::CallbackInfo& info);
+
     Napi::Value Finalize_(const Napi::CallbackInfo& info);
+    Napi::Value ReadonlyGetter(const Napi::CallbackInfo& info);
+    Napi::Value InlineRunsGetter(const Napi::CallbackInfo& info);
+    Napi::Value DatabaseGetter(const Napi::CallbackInfo& info);
+
+    static void MarshalRow(sqlite3_stmt* stmt, std::vector<Marshaller>& columns);
+    static Napi::Value MarshalResult(Napi::Env env, const std::vector<std::string>& names,
+                                     const std::vector<Marshaller>& columns, int rows);
 
 protected:
     static void Work_BeginPrepare(Database::Baton* baton);
@@ -231,28 +316,53 @@ protected:
     static void Finalize_(Baton* baton);
     void Finalize_();
 
-    template <class T> inline Values::Field* BindParameter(const Napi::Value source, T pos);
+    template <napi_async_execute_callback work>
+    static void Work_Timed(napi_env env, void* data);
+    void Queue(Baton* baton, const char* name,
+               napi_async_execute_callback execute,
+               napi_async_complete_callback complete);
+
+    template <class T> static inline Values::Field* BindParameter(const Napi::Value source, T pos);
+    static void ParseParameters(const Napi::Value source, Parameters& parameters);
+    static size_t ParameterBytes(const Parameters& parameters);
     template <class T> T* Bind(const Napi::CallbackInfo& info, int start = 0, int end = -1);
     bool Bind(const Parameters &parameters);
+    static int BindParameters(sqlite3_stmt* handle, const Parameters& parameters);
 
-    static void GetRow(Row* row, sqlite3_stmt* stmt);
+    static size_t GetRow(Row* row, sqlite3_stmt* stmt);
     static Napi::Value RowToJS(Napi::Env env, Row* row);
     void Schedule(Work_Callback callback, Baton* baton);
     void Process();
     void CleanQueue();
+    void Cancel(Baton* baton);
+    Napi::Value SchedulePromise(Napi::Env env, Baton* baton, Work_Callback callback);
     template <class T> static void Error(T* baton);
+    bool CheckSync(Napi::Env env);
+    void ThrowSync(Napi::Env env);
+    template <class T> T* WithLimits(T* baton);
+    bool ExceedsLimits(const ResultLimits* limits, sqlite3_int64 rows, sqlite3_int64 bytes);
 
 protected:
     Database* db;
 
     sqlite3_stmt* _handle;
     int status;
+    // Extended result code of the last failed step, see
+    // sqlite3_extended_errcode().
+    int extended_status;
     std::string message;
 
     bool prepared;
     bool locked;
     bool finalized;
     std::queue<Call*> queue;
+
+    // Moving average of how long recent runs took in nanoseconds, and the
+    // number of runs it is based on; see Queue().
+    uint64_t elapsed;
+    unsigned int timed_runs;
+    // Number of operations that ran on the main thread.
+    unsigned int inline_runs;
 };
 
 }
@@ -0,0 +1,88 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('admission control', function() {
+    afterEach(function() {
+        sqlite3.configure('maxConcurrency', 0);
+        sqlite3.configure('maxDatabaseConcurrency', 0);
+        sqlite3.configure('maxQueueDepth', 0);
+    });
+
+    it('should reject calls beyond the maximum queue depth', function(done) {
+        sqlite3.configure('maxQueueDepth', 2);
+        var db = new sqlite3.Database(':memory:', function(err) {
+            if (err) throw err;
+            var results = [];
+            db.serialize();
+            for (var i = 0; i < 5; i++) {
+                db.get("SELECT 1", function(err) {
+                    results.push(err ? err.message : 'ok');
+                    if (results.length < 5) return;
+                    assert.deepEqual(results.sort(), [
+                        'SQLITE_BUSY: Database queue is full',
+                        'SQLITE_BUSY: Database queue is full',
+                        'ok', 'ok', 'ok'
+                    ]);
+                    db.close(done);
+                });
+            }
+        });
+    });
+
+    it('should still close a database with a full queue', function(done) {
+        sqlite3.configure('maxQueueDepth', 1);
+        var db = new sqlite3.Database(':memory:', function(err) {
+            if (err) throw err;
+            var results = [];
+            db.serialize();
+            db.get("SELECT 1", function(err) {
+                results.push(err ? err.message : 'ok');
+            });
+            db.get("SELECT 1", function(err) {
+                results.push(err ? err.message : 'ok');
+            });
+            db.close(function(err) {
+                if (err) throw err;
+                assert.deepEqual(results, ['ok', 'ok']);
+                done();
+            });
+        });
+    });
+
+    it('should run all work with limited concurrency', function(done) {
+        sqlite3.configure('maxConcurrency', 1);
+        sqlite3.configure('maxDatabaseConcurrency', 1);
+        var remaining = 4 * 10;
+        for (var d = 0; d < 4; d++) {
+            (function(db) {
+                db.parallelize(function() {
+                    for (var i = 0; i < 10; i++) {
+                        db.get("SELECT ? AS value", i, function(err, row) {
+                            if (err) throw err;
+                            assert.equal(typeof row.value, 'number');
+                            if (--remaining === 0) done();
+                        });
+                    }
+                });
+            })(new sqlite3.Database(':memory:'));
+        }
+    });
+
+    it('should validate options', function() {
+        assert.throws(function() {
+            sqlite3.configure('maxConcurrency', -1);
+        }, /non-negative integer/);
+        assert.throws(function() {
+            sqlite3.configure('maxQueueDepth', 1.5);
+        }, /non-negative integer/);
+        assert.throws(function() {
+            sqlite3.configure('maxQueueDepth', NaN);
+        }, /non-negative integer/);
+        assert.throws(function() {
+            sqlite3.configure('maxQueueDepth', Math.pow(2, 32));
+        }, /non-negative integer/);
+        assert.throws(function() {
+            sqlite3.configure('nonsense', 1);
+        }, /not a valid configuration option/);
+    });
+});
@@ -0,0 +1,72 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('allJSON', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.serialize(function() {
+            db.run("CREATE TABLE foo (id INT, txt TEXT, num FLOAT, blb BLOB)");
+            var stmt = db.prepare("INSERT INTO foo VALUES(?, ?, ?, ?)");
+            stmt.run(1, 'plain', 0.1, null);
+            stmt.run(2, 'quote " backslash \\ newline \n tab \t bell \u0007', 1e21, Buffer.from([0, 1, 255]));
+            stmt.run(9007199254740993, 'unicode é中😀', -1.5e-7, null);
+            stmt.run(null, null, 123456.789, Buffer.alloc(0));
+            stmt.finalize(done);
+        });
+    });
+
+    var queries = [
+        "SELECT * FROM foo ORDER BY rowid",
+        "SELECT id, id AS id2, txt AS id FROM foo ORDER BY rowid",
+        "SELECT * FROM foo WHERE 0",
+        // Array index keys come first in objects, in ascending order.
+        "SELECT txt AS b, id AS \"10\", num AS \"2\", id AS \"02\", " +
+            "txt AS \"4294967295\", id AS \"-1\", num AS \"0\", id AS \"2\" FROM foo ORDER BY rowid"
+    ];
+
+    queries.forEach(function(sql) {
+        it('should match JSON.stringify for ' + sql, function(done) {
+            db.all(sql, function(err, rows) {
+                if (err) throw err;
+                db.allJSON(sql, function(err, json) {
+                    if (err) throw err;
+                    assert.ok(Buffer.isBuffer(json));
+                    assert.equal(json.toString(), JSON.stringify(rows));
+                    done();
+                });
+            });
+        });
+    });
+
+    it('should produce one line per row with allNDJSON', function(done) {
+        var sql = queries[0];
+        db.all(sql, function(err, rows) {
+            if (err) throw err;
+            db.allNDJSON(sql, function(err, ndjson) {
+                if (err) throw err;
+                var expected = rows.map(function(row) {
+                    return JSON.stringify(row) + '\n';
+                }).join('');
+                assert.equal(ndjson.toString(), expected);
+                done();
+            });
+        });
+    });
+
+    it('should bind parameters', function(done) {
+        db.allJSON("SELECT id FROM foo WHERE id = ?", 1, function(err, json) {
+            if (err) throw err;
+            assert.deepEqual(JSON.parse(json), [{ id: 1 }]);
+            done();
+        });
+    });
+
+    it('should report errors', function(done) {
+        db.allJSON("SELECT nonexistent FROM foo", function(err) {
+            assert.ok(err);
+            assert.equal(err.code, 'SQLITE_ERROR');
+            done();
+        });
+    });
+});
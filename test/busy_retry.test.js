@@ -0,0 +1,99 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('busy retry', function() {
+    var holder, db;
+    beforeEach(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile('test/tmp/busy_retry.db');
+        holder = new sqlite3.Database('test/tmp/busy_retry.db');
+        holder.serialize(function() {
+            holder.run("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT)");
+            db = new sqlite3.Database('test/tmp/busy_retry.db', done);
+        });
+    });
+    afterEach(function(done) {
+        db.close(function() {
+            holder.close(done);
+        });
+    });
+
+    it('should run once the lock is released', function(done) {
+        db.configure('busyRetry', 5000);
+        holder.exec("BEGIN EXCLUSIVE", function(err) {
+            if (err) throw err;
+            var released = false;
+            db.run("INSERT INTO foo (txt) VALUES ('a')", function(err) {
+                if (err) throw err;
+                assert.ok(released);
+                db.get("SELECT COUNT(*) AS count FROM foo", function(err, row) {
+                    if (err) throw err;
+                    assert.equal(row.count, 1);
+                    done();
+                });
+            });
+            setTimeout(function() {
+                released = true;
+                holder.exec("COMMIT");
+            }, 100);
+        });
+    });
+
+    it('should retry transactions', function(done) {
+        db.configure('busyRetry', 5000);
+        holder.exec("BEGIN EXCLUSIVE", function(err) {
+            if (err) throw err;
+            db.transaction([
+                "SELECT 1 AS one",
+                "INSERT INTO foo (txt) VALUES ('a')"
+            ], function(err, results) {
+                if (err) throw err;
+                assert.deepEqual(results[0].rows, [{ one: 1 }]);
+                assert.equal(results[1].changes, 1);
+                done();
+            });
+            setTimeout(function() {
+                holder.exec("COMMIT");
+            }, 100);
+        });
+    });
+
+    it('should give up after the configured time', function(done) {
+        db.configure('busyRetry', 50);
+        holder.exec("BEGIN EXCLUSIVE", function(err) {
+            if (err) throw err;
+            var start = Date.now();
+            db.run("INSERT INTO foo (txt) VALUES ('a')", function(err) {
+                assert.ok(err);
+                assert.equal(err.code, 'SQLITE_BUSY');
+                assert.ok(Date.now() - start >= 40);
+                holder.exec("COMMIT", done);
+            });
+        });
+    });
+
+    it('should keep the busy timeout for calls that are not retried', function(done) {
+        db.configure('busyRetry', 5000);
+        holder.exec("BEGIN EXCLUSIVE", function(err) {
+            if (err) throw err;
+            db.exec("INSERT INTO foo (txt) VALUES ('a')", function(err) {
+                if (err) throw err;
+                db.get("SELECT COUNT(*) AS count FROM foo", function(err, row) {
+                    if (err) throw err;
+                    assert.equal(row.count, 1);
+                    done();
+                });
+            });
+            setTimeout(function() {
+                holder.exec("COMMIT");
+            }, 100);
+        });
+    });
+
+    it('should reject invalid values', function() {
+        assert.throws(function() {
+            db.configure('busyRetry', -1);
+        }, /non-negative integer/);
+    });
+});
@@ -0,0 +1,126 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('cancellation', function() {
+    // Never finishes on its own.
+    var runaway = 'WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) ' +
+        'SELECT count(*) AS count FROM c';
+
+    var db;
+    beforeEach(function(done) {
+        db = new sqlite3.Database(':memory:', function(err) {
+            if (err) return done(err);
+            db.run("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT)", done);
+        });
+    });
+    afterEach(function(done) {
+        db.close(done);
+    });
+
+    function assertInterrupted(err) {
+        assert.ok(err);
+        assert.equal(err.errno, sqlite3.INTERRUPT);
+        assert.equal(err.code, 'SQLITE_INTERRUPT');
+    }
+
+    it('should stop a running query after its timeout', function(done) {
+        var start = Date.now();
+        db.get(runaway, function(err) {
+            assertInterrupted(err);
+            assert.ok(Date.now() - start >= 40);
+            done();
+        }, { timeout: 50 });
+    });
+
+    it('should leave other calls on the connection alone', function(done) {
+        db.serialize(function() {
+            db.all(runaway, function(err) {
+                assertInterrupted(err);
+            }, { timeout: 20 });
+            db.get("SELECT 1 AS one", function(err, row) {
+                if (err) throw err;
+                assert.equal(row.one, 1);
+                done();
+            });
+        });
+    });
+
+    it('should stop a running query when the signal aborts', function(done) {
+        if (typeof AbortController === 'undefined') return this.skip();
+        var controller = new AbortController();
+        db.each(runaway, function(err) {
+            assertInterrupted(err);
+        }, function() {
+            done(new Error('Completed query without error, but expected error'));
+        }, { signal: controller.signal });
+        db.wait(function() {
+            db.get("SELECT 1 AS one", function(err, row) {
+                if (err) throw err;
+                assert.equal(row.one, 1);
+                done();
+            });
+        });
+        setTimeout(function() { controller.abort(); }, 20);
+    });
+
+    it('should drop a queued call without running it', function(done) {
+        var cancellation = new sqlite3.Cancellation();
+        var stmt = new sqlite3.Statement(db, "INSERT INTO foo (txt) VALUES (?)");
+        stmt.run('a', function(err) {
+            assertInterrupted(err);
+        }, cancellation);
+        stmt.run('b', function(err) {
+            if (err) throw err;
+            stmt.finalize();
+            db.all("SELECT txt FROM foo", function(err, rows) {
+                if (err) throw err;
+                assert.deepEqual(rows, [{ txt: 'b' }]);
+                done();
+            });
+        });
+        // The statement is still being prepared, so both runs are queued.
+        cancellation.cancel();
+        assert.ok(cancellation.cancelled);
+    });
+
+    it('should not run exec after the signal has aborted', function(done) {
+        if (typeof AbortController === 'undefined') return this.skip();
+        var controller = new AbortController();
+        controller.abort();
+        db.exec("INSERT INTO foo (txt) VALUES ('a')", function(err) {
+            assertInterrupted(err);
+            db.get("SELECT COUNT(*) AS count FROM foo", function(err, row) {
+                if (err) throw err;
+                assert.equal(row.count, 0);
+                done();
+            });
+        }, { signal: controller.signal });
+    });
+
+    it('should finish calls that complete in time', function(done) {
+        db.run("INSERT INTO foo (txt) VALUES (?)", 'a', function(err) {
+            if (err) throw err;
+            assert.equal(this.changes, 1);
+            db.all("SELECT txt FROM foo", [], function(err, rows) {
+                if (err) throw err;
+                assert.deepEqual(rows, [{ txt: 'a' }]);
+                done();
+            }, { timeout: 10000 });
+        }, { timeout: 10000 });
+    });
+
+    it('should expire after the timeout', function(done) {
+        var cancellation = new sqlite3.Cancellation(10);
+        assert.ok(!cancellation.cancelled);
+        setTimeout(function() {
+            assert.ok(cancellation.cancelled);
+            done();
+        }, 30);
+    });
+
+    it('should reject an invalid timeout', function() {
+        assert.throws(function() {
+            new sqlite3.Cancellation(-1);
+        }, /Timeout must be a non-negative number/);
+    });
+});
@@ -0,0 +1,229 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('change events', function() {
+    var db;
+    beforeEach(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.exec("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT);" +
+            "CREATE TABLE bar (id INTEGER PRIMARY KEY, txt TEXT)", done);
+    });
+    afterEach(function(done) {
+        db.close(done);
+    });
+
+    // Events are delivered after the call that committed has called back.
+    function later(fn) {
+        return function(err) {
+            if (err) throw err;
+            setImmediate(fn);
+        };
+    }
+
+    it('should batch the changes of a statement', function(done) {
+        var events = [];
+        db.on('changes', function(changes) { events.push(changes); });
+        db.run("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 1000) " +
+               "INSERT INTO foo (txt) SELECT 'row ' || x FROM c", later(function() {
+            assert.equal(events.length, 1);
+            var changes = events[0];
+            assert.deepEqual(changes.tables, ['foo']);
+            assert.ok(changes.types instanceof Uint8Array);
+            assert.ok(changes.rowids instanceof Float64Array);
+            assert.equal(changes.rowids.length, 1000);
+            for (var i = 0; i < 1000; i++) {
+                assert.equal(changes.types[i], sqlite3.INSERT);
+                assert.equal(changes.tableIndexes[i], 0);
+                assert.equal(changes.rowids[i], i + 1);
+            }
+            done();
+        }));
+    });
+
+    it('should deliver a transaction once it commits', function(done) {
+        var events = [];
+        db.on('changes', function(changes) { events.push(changes); });
+        db.exec("BEGIN; INSERT INTO foo (txt) VALUES ('a'); INSERT INTO bar (txt) VALUES ('b'); ROLLBACK;" +
+                "BEGIN; INSERT INTO foo (txt) VALUES ('c'); UPDATE foo SET txt = 'd'; " +
+                "INSERT INTO bar (txt) VALUES ('e'); COMMIT", later(function() {
+            assert.equal(events.length, 1);
+            var changes = events[0];
+            assert.deepEqual(changes.tables, ['foo', 'bar']);
+            assert.deepEqual(Array.from(changes.types),
+                [sqlite3.INSERT, sqlite3.UPDATE, sqlite3.INSERT]);
+            assert.deepEqual(Array.from(changes.tableIndexes), [0, 0, 1]);
+            assert.deepEqual(Array.from(changes.rowids), [1, 1, 1]);
+            done();
+        }));
+    });
+
+    it('should only report the tables asked for', function(done) {
+        var events = [];
+        db.configure('changesTables', ['bar']);
+        db.on('changes', function(changes) { events.push(changes); });
+        db.exec("INSERT INTO foo (txt) VALUES ('a'); INSERT INTO bar (txt) VALUES ('b')", later(function() {
+            assert.equal(events.length, 1);
+            assert.deepEqual(events[0].tables, ['bar']);
+            assert.deepEqual(Array.from(events[0].rowids), [1]);
+            done();
+        }));
+    });
+
+    it('should coalesce changes of the same row', function(done) {
+        var events = [];
+        db.configure('changesCoalesce', true);
+        db.on('changes', function(changes) { events.push(changes); });
+        db.exec("INSERT INTO foo (txt) VALUES ('a'), ('b'); BEGIN;" +
+                "INSERT INTO foo (txt) VALUES ('c'); UPDATE foo SET txt = 'x';" +
+                "DELETE FROM foo WHERE id = 2; INSERT INTO foo (txt) VALUES ('d');" +
+                "DELETE FROM foo WHERE id = 4; COMMIT", later(function() {
+            assert.equal(events.length, 2);
+            var changes = events[1];
+            assert.deepEqual(Array.from(changes.types),
+                [sqlite3.INSERT, sqlite3.UPDATE, sqlite3.DELETE]);
+            assert.deepEqual(Array.from(changes.rowids), [3, 1, 2]);
+            done();
+        }));
+    });
+
+    describe('with savepoints', function() {
+        beforeEach(function(done) {
+            db.exec("INSERT INTO foo (id, txt) VALUES (5, 'e')", done);
+        });
+
+        it('should leave out changes of a failed transaction operation', function(done) {
+            var events = [];
+            db.on('changes', function(changes) { events.push(changes); });
+            db.transaction([
+                "INSERT INTO foo (id, txt) VALUES (2, 'b')",
+                "INSERT INTO foo (id, txt) VALUES (3, 'c'), (5, 'dup')",
+                "UPDATE foo SET txt = 'v' WHERE id = 2"
+            ], { isolate: true }, later(function() {
+                assert.equal(events.length, 1);
+                assert.deepEqual(Array.from(events[0].types), [sqlite3.INSERT, sqlite3.UPDATE]);
+                assert.deepEqual(Array.from(events[0].rowids), [2, 2]);
+                done();
+            }));
+        });
+
+        it('should undo coalescing of a failed transaction operation', function(done) {
+            var events = [];
+            db.configure('changesCoalesce', true);
+            db.on('changes', function(changes) { events.push(changes); });
+            db.transaction([
+                "INSERT INTO foo (id, txt) VALUES (2, 'b')",
+                "INSERT INTO foo (id, txt) VALUES (2, 'u'), (5, 'dup') ON CONFLICT(id) DO UPDATE " +
+                    "SET txt = excluded.txt, id = CASE WHEN excluded.txt = 'dup' THEN 2 ELSE foo.id END",
+                "INSERT INTO foo (id, txt) VALUES (3, 'c'), (5, 'dup')",
+                "DELETE FROM foo WHERE id = 5"
+            ], { isolate: true }, later(function() {
+                assert.equal(events.length, 1);
+                assert.deepEqual(Array.from(events[0].types), [sqlite3.INSERT, sqlite3.DELETE]);
+                assert.deepEqual(Array.from(events[0].rowids), [2, 5]);
+                done();
+            }));
+        });
+
+        it('should leave out a failed transaction nested in another', function(done) {
+            var events = [];
+            db.on('changes', function(changes) { events.push(changes); });
+            db.exec("BEGIN; INSERT INTO bar (txt) VALUES ('a')");
+            db.transaction([
+                "INSERT INTO foo (id, txt) VALUES (3, 'c'), (5, 'dup')"
+            ], function(err) {
+                assert.ok(err);
+                db.exec("COMMIT", later(function() {
+                    assert.equal(events.length, 1);
+                    assert.deepEqual(events[0].tables, ['bar']);
+                    assert.deepEqual(Array.from(events[0].rowids), [1]);
+                    done();
+                }));
+            });
+        });
+    });
+
+    describe('with a failed commit', function() {
+        var file, reader;
+        beforeEach(function(done) {
+            helper.ensureExists('test/tmp');
+            helper.deleteFile('test/tmp/changes_commit.db');
+            file = new sqlite3.Database('test/tmp/changes_commit.db');
+            file.configure('busyTimeout', 0);
+            file.exec("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT)", function(err) {
+                if (err) return done(err);
+                reader = new sqlite3.Database('test/tmp/changes_commit.db');
+                // The reader's shared lock keeps COMMIT from getting the
+                // exclusive lock it needs.
+                reader.exec("BEGIN; SELECT * FROM foo", done);
+            });
+        });
+        afterEach(function(done) {
+            reader.close(function() {
+                file.close(done);
+            });
+        });
+
+        function failCommit(events, callback) {
+            file.on('changes', function(changes) { events.push(changes); });
+            file.exec("BEGIN; INSERT INTO foo (txt) VALUES ('a')", function(err) {
+                if (err) throw err;
+                file.exec("COMMIT", function(err) {
+                    assert.ok(err);
+                    assert.equal(err.code, 'SQLITE_BUSY');
+                    setImmediate(callback);
+                });
+            });
+        }
+
+        it('should not report changes that are rolled back after all', function(done) {
+            var events = [];
+            failCommit(events, function() {
+                assert.equal(events.length, 0);
+                file.exec("ROLLBACK", later(function() {
+                    assert.equal(events.length, 0);
+                    done();
+                }));
+            });
+        });
+
+        it('should report changes once the commit goes through', function(done) {
+            var events = [];
+            failCommit(events, function() {
+                assert.equal(events.length, 0);
+                reader.exec("COMMIT", function(err) {
+                    if (err) throw err;
+                    file.exec("COMMIT", later(function() {
+                        assert.equal(events.length, 1);
+                        assert.deepEqual(Array.from(events[0].rowids), [1]);
+                        done();
+                    }));
+                });
+            });
+        });
+    });
+
+    it('should emit row events only for the kinds listened to', function(done) {
+        var deleted = [];
+        db.on('delete', function(type, database, table, rowid) {
+            assert.equal(type, 'delete');
+            assert.equal(table, 'foo');
+            deleted.push(rowid);
+        });
+        db.exec("INSERT INTO foo (txt) VALUES ('a'), ('b'); DELETE FROM foo WHERE id = 2", later(function() {
+            assert.deepEqual(deleted, [2]);
+            done();
+        }));
+    });
+
+    it('should stop when the last listener is removed', function(done) {
+        var count = 0;
+        function listener() { count++; }
+        db.on('changes', listener);
+        db.removeListener('changes', listener);
+        db.run("INSERT INTO foo (txt) VALUES ('a')", later(function() {
+            assert.equal(count, 0);
+            done();
+        }));
+    });
+});
@@ -0,0 +1,82 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('cursor', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.serialize(function() {
+            db.run("CREATE TABLE foo (id INT, txt TEXT)");
+            var stmt = db.prepare("INSERT INTO foo VALUES(?, ?)");
+            for (var i = 0; i < 10; i++) {
+                stmt.run(i, 'row ' + i);
+            }
+            stmt.finalize(done);
+        });
+    });
+
+    it('should fetch rows in pages', function(done) {
+        var stmt = db.prepare("SELECT id FROM foo WHERE id >= ? ORDER BY id");
+        var cursor = stmt.cursor(2);
+        cursor.fetch(4, function(err, rows) {
+            if (err) throw err;
+            assert.deepEqual(rows.map(function(row) { return row.id; }), [2, 3, 4, 5]);
+            assert.ok(!cursor.done);
+            cursor.fetch(4, function(err, rows) {
+                if (err) throw err;
+                assert.deepEqual(rows.map(function(row) { return row.id; }), [6, 7, 8, 9]);
+                cursor.fetch(4, function(err, rows) {
+                    if (err) throw err;
+                    assert.equal(rows.length, 0);
+                    assert.ok(cursor.done);
+                    stmt.finalize(done);
+                });
+            });
+        });
+    });
+
+    it('should restart when a new cursor is opened', function(done) {
+        var stmt = db.prepare("SELECT id FROM foo ORDER BY id");
+        stmt.cursor().fetch(3, function(err, rows) {
+            if (err) throw err;
+            assert.equal(rows[0].id, 0);
+            stmt.cursor().fetch(20, function(err, rows) {
+                if (err) throw err;
+                assert.equal(rows.length, 10);
+                assert.equal(rows[0].id, 0);
+                assert.ok(this.done);
+                stmt.finalize(done);
+            });
+        });
+    });
+
+    it('should report errors from binding', function(done) {
+        var stmt = db.prepare("SELECT id FROM foo WHERE id = ?");
+        stmt.cursor(1, 2, 3).fetch(1, function(err) {
+            assert.ok(err);
+            assert.equal(err.code, 'SQLITE_RANGE');
+            stmt.finalize(done);
+        });
+    });
+
+    if (typeof Symbol === 'function' && Symbol.asyncIterator) {
+        it('should support async iteration', function(done) {
+            var stmt = db.prepare("SELECT id FROM foo ORDER BY id");
+            var cursor = stmt.cursor();
+            cursor.pageSize = 3;
+            var iterator = cursor[Symbol.asyncIterator]();
+            var ids = [];
+            function next() {
+                iterator.next().then(function(result) {
+                    if (result.done) {
+                        assert.deepEqual(ids, [0, 1, 2, 3, 4, 5, 6, 7, 8, 9]);
+                        return stmt.finalize(done);
+                    }
+                    ids.push(result.value.id);
+                    next();
+                }, done);
+            }
+            next();
+        });
+    }
+});
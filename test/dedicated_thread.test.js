@@ -0,0 +1,84 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('dedicated thread', function() {
+    before(function() {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile('test/tmp/dedicated_thread.db');
+    });
+
+    var db;
+    it('should open with a mode and options', function(done) {
+        db = new sqlite3.Database('test/tmp/dedicated_thread.db',
+            sqlite3.OPEN_READWRITE | sqlite3.OPEN_CREATE,
+            { dedicatedThread: true }, done);
+    });
+
+    it('should run statements in order', function(done) {
+        db.serialize(function() {
+            db.run("CREATE TABLE foo (id INT, txt TEXT)");
+            var stmt = db.prepare("INSERT INTO foo VALUES(?, ?)");
+            for (var i = 0; i < 100; i++) {
+                stmt.run(i, 'row ' + i);
+            }
+            stmt.finalize();
+        });
+        db.all("SELECT * FROM foo ORDER BY id", function(err, rows) {
+            if (err) throw err;
+            assert.equal(rows.length, 100);
+            assert.deepEqual(rows[42], { id: 42, txt: 'row 42' });
+            done();
+        });
+    });
+
+    it('should support each, exec and backups', function(done) {
+        var count = 0;
+        db.each("SELECT id FROM foo", function(err) {
+            if (err) throw err;
+            count++;
+        }, function(err) {
+            if (err) throw err;
+            assert.equal(count, 100);
+            db.exec("DELETE FROM foo WHERE id >= 50", function(err) {
+                if (err) throw err;
+                var backup = db.backup('test/tmp/dedicated_thread_backup.db');
+                backup.step(-1, function(err) {
+                    if (err) throw err;
+                    assert.ok(backup.completed);
+                    backup.finish(done);
+                });
+            });
+        });
+    });
+
+    it('should report errors', function(done) {
+        db.run("INSERT INTO missing VALUES(1)", function(err) {
+            assert.ok(err);
+            assert.equal(err.code, 'SQLITE_ERROR');
+            done();
+        });
+    });
+
+    it('should close the database', function(done) {
+        db.close(done);
+    });
+
+    it('should call the open callback without options', function(done) {
+        var other = new sqlite3.Database(':memory:', function(err) {
+            if (err) throw err;
+            other.close(function(err) {
+                if (err) throw err;
+                var another = new sqlite3.Database(':memory:', sqlite3.OPEN_READWRITE, function(err) {
+                    if (err) throw err;
+                    another.close(done);
+                });
+            });
+        });
+    });
+
+    after(function() {
+        helper.deleteFile('test/tmp/dedicated_thread.db');
+        helper.deleteFile('test/tmp/dedicated_thread_backup.db');
+    });
+});
@@ -36,4 +36,19 @@ describe('each', function() {
             done();
         });
     });
+
+    it('Statement#each stops when the row callback returns false', function(done) {
+        var retrieved = 0;
+
+        db.each('SELECT id, txt FROM foo LIMIT 0, ?', 10000, function(err, row) {
+            if (err) throw err;
+            retrieved++;
+            if (retrieved === 50) return false;
+        }, function(err, num) {
+            if (err) throw err;
+            assert.equal(retrieved, 50);
+            assert.equal(num, 50);
+            done();
+        });
+    });
 });
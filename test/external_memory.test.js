@@ -0,0 +1,63 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('external memory', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.run("CREATE TABLE foo (data BLOB)", done);
+    });
+
+    it('should report bound parameters until the statement completes', function(done) {
+        var size = 16 * 1024 * 1024;
+        var buffer = Buffer.alloc(size);
+        var before = process.memoryUsage().external;
+        db.run("INSERT INTO foo VALUES(?)", buffer, function(err) {
+            if (err) throw err;
+            setImmediate(function() {
+                var after = process.memoryUsage().external;
+                assert.ok(after - before < size / 2, 'released ' + (after - before));
+                done();
+            });
+        });
+        var queued = process.memoryUsage().external;
+        assert.ok(queued - before >= size, 'reported ' + (queued - before));
+    });
+
+    // Text results become JS strings on the heap, so any external memory
+    // seen while they are handled is the native copy.
+    it('should report rows from all() until the callback returns', function(done) {
+        var size = 16 * 1024 * 1024;
+        var before = process.memoryUsage().external;
+        db.all("SELECT hex(zeroblob(?)) AS data", size / 2, function(err, rows) {
+            if (err) throw err;
+            assert.equal(rows[0].data.length, size);
+            var held = process.memoryUsage().external;
+            assert.ok(held - before >= size / 2, 'reported ' + (held - before));
+            setImmediate(function() {
+                var after = process.memoryUsage().external;
+                assert.ok(after - before < size / 2, 'released ' + (after - before));
+                done();
+            });
+        });
+    });
+
+    it('should report rows from each() while they are handled', function(done) {
+        var size = 16 * 1024 * 1024;
+        var before = process.memoryUsage().external;
+        db.each("SELECT hex(zeroblob(?)) AS data", size / 2, function(err, row) {
+            if (err) throw err;
+            assert.equal(row.data.length, size);
+            var held = process.memoryUsage().external;
+            assert.ok(held - before >= size / 2, 'reported ' + (held - before));
+        }, function(err, count) {
+            if (err) throw err;
+            assert.equal(count, 1);
+            setImmediate(function() {
+                var after = process.memoryUsage().external;
+                assert.ok(after - before < size / 2, 'released ' + (after - before));
+                done();
+            });
+        });
+    });
+});
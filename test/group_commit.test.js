@@ -0,0 +1,119 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('group commit', function() {
+    var db;
+    beforeEach(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile('test/tmp/group_commit.db');
+        db = new sqlite3.Database('test/tmp/group_commit.db');
+        db.run("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT UNIQUE)", done);
+    });
+    afterEach(function(done) {
+        db.close(done);
+    });
+
+    it('should commit writes together and report each result', function(done) {
+        db.configure('groupCommit', 20);
+        var remaining = 10;
+        for (var i = 0; i < 10; i++) {
+            db.run("INSERT INTO foo (txt) VALUES (?)", 'row ' + i, function(err) {
+                if (err) throw err;
+                assert.equal(this.changes, 1);
+                assert.ok(this.lastID > 0);
+                if (--remaining) return;
+                db.get("SELECT COUNT(*) AS count FROM foo", function(err, row) {
+                    if (err) throw err;
+                    assert.equal(row.count, 10);
+                    done();
+                });
+            });
+        }
+    });
+
+    it('should isolate failing writes', function(done) {
+        db.configure('groupCommit', 20);
+        var errors = [];
+        db.run("INSERT INTO foo (txt) VALUES ($txt)", { $txt: 'a' }, function(err) {
+            errors[0] = err;
+        });
+        db.run("INSERT INTO foo (txt) VALUES (?)", ['a'], function(err) {
+            errors[1] = err;
+        });
+        db.run("INSERT INTO foo (txt) VALUES (?)", 'b', function(err) {
+            errors[2] = err;
+            assert.equal(errors[0], null);
+            assert.equal(errors[1].code, 'SQLITE_CONSTRAINT');
+            assert.equal(errors[2], null);
+            db.all("SELECT txt FROM foo ORDER BY id", function(err, rows) {
+                if (err) throw err;
+                assert.deepEqual(rows, [{ txt: 'a' }, { txt: 'b' }]);
+                done();
+            });
+        });
+    });
+
+    it('should flush when the batch is full', function(done) {
+        db.configure('groupCommit', 60000);
+        db.configure('groupCommitSize', 2);
+        db.run("INSERT INTO foo (txt) VALUES ('a')");
+        db.run("INSERT INTO foo (txt) VALUES ('b')", function(err) {
+            if (err) throw err;
+            done();
+        });
+    });
+
+    it('should keep the order of other operations', function(done) {
+        db.configure('groupCommit', 60000);
+        db.run("INSERT INTO foo (txt) VALUES ('a')");
+        db.get("SELECT COUNT(*) AS count FROM foo", function(err, row) {
+            if (err) throw err;
+            assert.equal(row.count, 1);
+            done();
+        });
+    });
+
+    it('should keep the order of calls on prepared statements', function(done) {
+        var select = db.prepare("SELECT COUNT(*) AS count FROM foo", function(err) {
+            if (err) throw err;
+            db.configure('groupCommit', 60000);
+            db.run("INSERT INTO foo (txt) VALUES ('a')");
+            select.get(function(err, row) {
+                if (err) throw err;
+                assert.equal(row.count, 1);
+                select.finalize(done);
+            });
+        });
+    });
+
+    it('should not let synchronous calls overtake held writes', function(done) {
+        var select = db.prepareSync("SELECT COUNT(*) AS count FROM foo");
+        db.configure('groupCommit', 60000);
+        db.run("INSERT INTO foo (txt) VALUES ('a')", function(err) {
+            if (err) throw err;
+            setImmediate(function() {
+                assert.equal(select.getSync().count, 1);
+                select.finalize(done);
+            });
+        });
+        // The held write is queued first, so the database is busy.
+        assert.throws(function() {
+            select.getSync();
+        }, /Database is busy/);
+    });
+
+    it('should not group transaction control statements', function(done) {
+        db.configure('groupCommit', 60000);
+        db.serialize(function() {
+            db.run("BEGIN");
+            db.run("INSERT INTO foo (txt) VALUES ('a')");
+            db.run("ROLLBACK");
+            db.get("SELECT COUNT(*) AS count FROM foo", function(err, row) {
+                if (err) throw err;
+                assert.equal(row.count, 0);
+                done();
+            });
+        });
+    });
+});
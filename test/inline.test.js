@@ -0,0 +1,159 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('inline execution', function() {
+    var db;
+    beforeEach(function(done) {
+        db = new sqlite3.Database(':memory:', function(err) {
+            if (err) return done(err);
+            db.exec("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT);" +
+                "INSERT INTO foo (txt) VALUES ('a'), ('b'), ('c')", done);
+        });
+    });
+    afterEach(function(done) {
+        db.close(done);
+    });
+
+    it('should keep callbacks asynchronous', function(done) {
+        db.configure('inlineThreshold', 1000000);
+        var stmt = db.prepare("SELECT txt FROM foo WHERE id = ?");
+        var remaining = 50;
+        var returned;
+
+        function next() {
+            var id = remaining % 3 + 1;
+            returned = false;
+            stmt.get(id, function(err, row) {
+                if (err) throw err;
+                assert.ok(returned);
+                assert.equal(row.txt, ['a', 'b', 'c'][id - 1]);
+                if (--remaining) return next();
+                stmt.finalize(done);
+            });
+            returned = true;
+        }
+        next();
+    });
+
+    it('should run cheap statements on the main thread', function(done) {
+        db.configure('inlineThreshold', 1000000);
+        var count = db.prepareSync("SELECT COUNT(*) AS count FROM foo");
+        var insert = db.prepare("INSERT INTO foo (txt) VALUES (?)");
+        var runs = 0;
+
+        // Calls made from a callback wait for the statement to be released,
+        // so make them from the event loop.
+        function next() {
+            insert.run('x', function(err) {
+                if (err) throw err;
+                if (++runs < 4) return setImmediate(next);
+                assert.equal(insert.inlineRuns, 0);
+                setImmediate(function() {
+                    insert.run('y', function(err) {
+                        if (err) throw err;
+                        count.finalize();
+                        insert.finalize(done);
+                    });
+                    // The row is there as soon as run() returns.
+                    assert.equal(insert.inlineRuns, 1);
+                    assert.equal(count.getSync().count, 8);
+                });
+            });
+        }
+        next();
+    });
+
+    it('should give the same results as worker runs', function(done) {
+        db.configure('inlineThreshold', 1000000);
+        var insert = db.prepare("INSERT INTO foo (txt) VALUES (?)");
+        var select = db.prepare("SELECT COUNT(*) AS count FROM foo");
+        var count = 20;
+        var finished = 0;
+
+        for (var i = 0; i < count; i++) {
+            insert.run('x' + i, function(err) {
+                if (err) throw err;
+                assert.ok(this.lastID > 3);
+                if (++finished < count) return;
+                select.all(function(err, rows) {
+                    if (err) throw err;
+                    assert.deepEqual(rows, [{ count: count + 3 }]);
+                    insert.finalize();
+                    select.finalize(done);
+                });
+            });
+        }
+    });
+
+    it('should report errors from inline runs', function(done) {
+        db.configure('inlineThreshold', 1000000);
+        var stmt = db.prepare("INSERT INTO foo (id, txt) VALUES (?, 'x')");
+        var remaining = 10;
+
+        function next() {
+            stmt.run(remaining + 100, function(err) {
+                if (err) throw err;
+                if (--remaining) return next();
+                stmt.run(101, function(err) {
+                    assert.ok(err);
+                    assert.equal(err.code, 'SQLITE_CONSTRAINT');
+                    stmt.finalize(done);
+                });
+            });
+        }
+        next();
+    });
+
+    it('should reject invalid thresholds', function() {
+        assert.throws(function() {
+            db.configure('inlineThreshold', -1);
+        }, /Value must be a non-negative number/);
+    });
+});
+
+describe('inline execution with a locked database', function() {
+    var holder, db;
+    beforeEach(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile('test/tmp/inline_busy.db');
+        holder = new sqlite3.Database('test/tmp/inline_busy.db');
+        holder.serialize(function() {
+            holder.run("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT)");
+            db = new sqlite3.Database('test/tmp/inline_busy.db', done);
+        });
+    });
+    afterEach(function(done) {
+        db.close(function() {
+            holder.close(done);
+        });
+    });
+
+    it('should wait for the lock on a worker', function(done) {
+        db.configure('inlineThreshold', 1000000);
+        var insert = db.prepare("INSERT INTO foo (txt) VALUES (?)");
+        var runs = 0;
+
+        function next() {
+            insert.run('x', function(err) {
+                if (err) throw err;
+                if (++runs < 4) return setImmediate(next);
+                holder.exec("BEGIN EXCLUSIVE", function(err) {
+                    if (err) throw err;
+                    var start = Date.now();
+                    insert.run('y', function(err) {
+                        if (err) throw err;
+                        assert.equal(insert.inlineRuns, 0);
+                        insert.finalize(done);
+                    });
+                    // The main thread didn't wait for the busy timeout.
+                    assert.ok(Date.now() - start < 500);
+                    setTimeout(function() {
+                        holder.exec("COMMIT");
+                    }, 100);
+                });
+            });
+        }
+        next();
+    });
+});
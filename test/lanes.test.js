@@ -0,0 +1,105 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('priority lanes', function() {
+    var db;
+    beforeEach(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.run("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT)", done);
+    });
+    afterEach(function(done) {
+        db.close(done);
+    });
+
+    it('should start interactive calls ahead of queued bulk work', function(done) {
+        var order = [];
+        db.serialize();
+        db.bulk(function() {
+            for (var i = 0; i < 5; i++) {
+                db.run("INSERT INTO foo (txt) VALUES ('bulk')", function(err) {
+                    if (err) throw err;
+                    order.push('bulk');
+                });
+            }
+        });
+        db.get("SELECT 1", function(err) {
+            if (err) throw err;
+            order.push('interactive');
+        });
+        // Waits for the bulk work as well.
+        db.wait(function() {
+            assert.equal(order.indexOf('interactive'), 1);
+            assert.equal(order.length, 6);
+            done();
+        });
+    });
+
+    it('should not starve bulk work', function(done) {
+        var order = [];
+        db.serialize();
+        db.bulk(function() {
+            db.run("INSERT INTO foo (txt) VALUES ('bulk')");
+            db.run("INSERT INTO foo (txt) VALUES ('bulk')", function(err) {
+                if (err) throw err;
+                order.push('bulk');
+            });
+        });
+        for (var i = 0; i < 20; i++) {
+            db.get("SELECT 1", function(err) {
+                if (err) throw err;
+                order.push('interactive');
+            });
+        }
+        db.bulk(function() {
+            db.wait(function() {
+                var position = order.indexOf('bulk');
+                assert.ok(position > 0 && position < 20);
+                done();
+            });
+        });
+    });
+
+    it('should close only after queued bulk work', function(done) {
+        var other = new sqlite3.Database(':memory:');
+        var finished = 0;
+        other.serialize();
+        other.run("CREATE TABLE foo (txt TEXT)");
+        other.bulk(function() {
+            for (var i = 0; i < 100; i++) {
+                other.run("INSERT INTO foo (txt) VALUES ('bulk')", function(err) {
+                    if (err) throw err;
+                    finished++;
+                });
+            }
+        });
+        other.close(function(err) {
+            if (err) throw err;
+            assert.equal(finished, 100);
+            done();
+        });
+    });
+
+    it('should keep order within a lane', function(done) {
+        var order = [];
+        db.bulk();
+        db.serialize(function() {
+            for (var i = 0; i < 10; i++) {
+                db.run("INSERT INTO foo (txt) VALUES (?)", i);
+            }
+        });
+        db.interactive();
+        db.all("SELECT txt FROM foo", function(err) {
+            if (err) throw err;
+            order.push('read');
+        });
+        db.bulk(function() {
+            db.all("SELECT CAST(txt AS INTEGER) AS n FROM foo ORDER BY id", function(err, rows) {
+                if (err) throw err;
+                assert.deepEqual(rows.map(function(row) { return row.n; }),
+                    [0, 1, 2, 3, 4, 5, 6, 7, 8, 9]);
+                assert.deepEqual(order, ['read']);
+                done();
+            });
+        });
+    });
+});
@@ -0,0 +1,97 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('allMarshalPartitioned', function() {
+    var db;
+    before(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile('test/tmp/partitioned.db');
+        db = new sqlite3.Database('test/tmp/partitioned.db');
+        db.serialize(function() {
+            db.run("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT, num REAL, blb BLOB)");
+            db.run("CREATE TABLE empty (id INTEGER PRIMARY KEY, txt TEXT)");
+            db.run("BEGIN");
+            var stmt = db.prepare("INSERT INTO foo VALUES(?, ?, ?, ?)");
+            for (var i = 0; i < 1000; i++) {
+                stmt.run(i * 7 - 300, 'row ' + i, i / 3, i % 5 ? null : Buffer.from([i % 256]));
+            }
+            stmt.finalize();
+            db.run("COMMIT", done);
+        });
+    });
+
+    var range = "SELECT * FROM foo WHERE id >= $start AND id < $end ORDER BY id";
+
+    [1, 3, 8].forEach(function(partitions) {
+        it('should match allMarshal with ' + partitions + ' partitions', function(done) {
+            db.allMarshal("SELECT * FROM foo ORDER BY id", function(err, expected) {
+                if (err) throw err;
+                db.allMarshalPartitioned(range, { table: 'foo', key: 'id', partitions: partitions }, function(err, result) {
+                    if (err) throw err;
+                    assert.ok(Buffer.isBuffer(result));
+                    assert.ok(result.equals(expected));
+                    done();
+                });
+            });
+        });
+    });
+
+    it('should share partitions among a limited number of threads', function(done) {
+        db.allMarshal("SELECT * FROM foo ORDER BY id", function(err, expected) {
+            if (err) throw err;
+            sqlite3.configure('maxConcurrency', 2);
+            db.allMarshalPartitioned(range, { table: 'foo', key: 'id', partitions: 64 }, function(err, result) {
+                sqlite3.configure('maxConcurrency', 0);
+                if (err) throw err;
+                assert.ok(result.equals(expected));
+                done();
+            });
+        });
+    });
+
+    it('should handle empty tables', function(done) {
+        db.allMarshal("SELECT * FROM empty", function(err, expected) {
+            if (err) throw err;
+            db.allMarshalPartitioned("SELECT * FROM empty WHERE rowid >= $start AND rowid < $end",
+                    { table: 'empty' }, function(err, result) {
+                if (err) throw err;
+                assert.ok(result.equals(expected));
+                done();
+            });
+        });
+    });
+
+    it('should require a key range in the query', function(done) {
+        db.allMarshalPartitioned("SELECT * FROM foo", { table: 'foo' }, function(err) {
+            assert.ok(err);
+            assert.equal(err.code, 'SQLITE_MISUSE');
+            done();
+        });
+    });
+
+    it('should validate options', function() {
+        assert.throws(function() {
+            db.allMarshalPartitioned(range, {});
+        }, /Table name expected/);
+        assert.throws(function() {
+            db.allMarshalPartitioned(range, { table: 'foo', partitions: 0 });
+        }, /Partitions must be between 1 and 64/);
+    });
+
+    it('should refuse in-memory databases', function(done) {
+        var memory = new sqlite3.Database(':memory:');
+        memory.allMarshalPartitioned(range, { table: 'foo' }, function(err) {
+            assert.ok(err);
+            assert.equal(err.message, 'SQLITE_MISUSE: Partitioned scans need a database file');
+            memory.close(done);
+        });
+    });
+
+    after(function(done) {
+        db.close(function() {
+            helper.deleteFile('test/tmp/partitioned.db');
+            done();
+        });
+    });
+});
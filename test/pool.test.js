@@ -0,0 +1,146 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('pool', function() {
+    before(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile('test/tmp/pool.db');
+        var db = new sqlite3.Database('test/tmp/pool.db');
+        db.serialize(function() {
+            db.run("PRAGMA journal_mode = WAL");
+            db.run("CREATE TABLE foo (id INT, txt TEXT)");
+            db.close(done);
+        });
+    });
+
+    it('should refuse in-memory databases', function() {
+        assert.throws(function() {
+            new sqlite3.Pool(':memory:');
+        }, /Pool requires a database file/);
+    });
+
+    it('should report whether statements are read-only', function(done) {
+        var db = new sqlite3.Database(':memory:');
+        var select = db.prepare("SELECT 1", function(err) {
+            if (err) throw err;
+            assert.strictEqual(select.readonly, true);
+            var create = db.prepare("CREATE TABLE bar (id INT)", function(err) {
+                if (err) throw err;
+                assert.strictEqual(create.readonly, false);
+                select.finalize();
+                create.finalize();
+                db.close(done);
+            });
+        });
+    });
+
+    describe('in WAL mode', function() {
+        var pool;
+        before(function(done) {
+            pool = new sqlite3.Pool('test/tmp/pool.db', { readers: 3 }, done);
+        });
+
+        it('should open readers', function() {
+            assert.ok(pool.wal);
+            assert.equal(pool.readers.length, 3);
+        });
+
+        it('should see writes made through the pool', function(done) {
+            for (var i = 0; i < 100; i++) {
+                pool.run("INSERT INTO foo VALUES(?, ?)", i, 'row ' + i);
+            }
+            pool.get("SELECT count(*) AS count FROM foo", function(err, row) {
+                if (err) throw err;
+                assert.equal(row.count, 100);
+                done();
+            });
+        });
+
+        it('should run concurrent reads', function(done) {
+            var remaining = 10;
+            for (var i = 0; i < 10; i++) {
+                pool.all("SELECT * FROM foo WHERE id >= ?", 50, function(err, rows) {
+                    if (err) throw err;
+                    assert.equal(rows.length, 50);
+                    if (--remaining === 0) done();
+                });
+            }
+        });
+
+        it('should send writes issued through read methods to the writer', function(done) {
+            pool.all("DELETE FROM foo WHERE id >= 90", function(err, rows) {
+                if (err) throw err;
+                assert.deepEqual(rows, []);
+                pool.get("SELECT count(*) AS count FROM foo", function(err, row) {
+                    if (err) throw err;
+                    assert.equal(row.count, 90);
+                    done();
+                });
+            });
+        });
+
+        it('should not read past a write in flight', function(done) {
+            pool.exec("INSERT INTO foo SELECT id + 1000, txt FROM foo");
+            pool.get("SELECT count(*) AS count FROM foo", function(err, row) {
+                if (err) throw err;
+                assert.equal(row.count, 180);
+                pool.transaction(["DELETE FROM foo WHERE id >= 1000"]);
+                pool.get("SELECT count(*) AS count FROM foo", function(err, row) {
+                    if (err) throw err;
+                    assert.equal(row.count, 90);
+                    done();
+                });
+            });
+        });
+
+        it('should read from the writer inside a transaction', function(done) {
+            pool.serialize(function() {
+                pool.run("BEGIN");
+                pool.run("DELETE FROM foo");
+            });
+            pool.writer.wait(function() {
+                pool.get("SELECT count(*) AS count FROM foo", function(err, row) {
+                    if (err) throw err;
+                    assert.equal(row.count, 0);
+                    pool.run("ROLLBACK", done);
+                });
+            });
+        });
+
+        it('should close all connections', function(done) {
+            pool.close(done);
+        });
+    });
+
+    it('should remember a bounded number of queries', function(done) {
+        var pool = new sqlite3.Pool('test/tmp/pool.db', { readers: 1, readonlyCache: 2 }, function(err) {
+            if (err) throw err;
+            var i = 0;
+            (function next() {
+                if (i === 10) {
+                    assert.equal(pool._readonly.size, 2);
+                    // Dropped queries are classified again when they come back.
+                    return pool.get("SELECT 0 AS value", function(err, row) {
+                        if (err) throw err;
+                        assert.equal(row.value, 0);
+                        assert.equal(pool._readonly.size, 2);
+                        assert.strictEqual(pool._readonly.get("SELECT 0 AS value"), true);
+                        pool.close(done);
+                    });
+                }
+                pool.get("SELECT " + i + " AS value", function(err, row) {
+                    if (err) throw err;
+                    assert.equal(row.value, i++);
+                    next();
+                });
+            })();
+        });
+    });
+
+    after(function() {
+        helper.deleteFile('test/tmp/pool.db');
+        helper.deleteFile('test/tmp/pool.db-wal');
+        helper.deleteFile('test/tmp/pool.db-shm');
+    });
+});
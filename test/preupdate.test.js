@@ -0,0 +1,160 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('preupdate events', function() {
+    var db;
+    beforeEach(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.exec("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT, num REAL, data BLOB);" +
+            "CREATE TABLE bar (id INTEGER PRIMARY KEY, txt TEXT)", done);
+    });
+    afterEach(function(done) {
+        db.close(done);
+    });
+
+    // Events are delivered after the call that committed has called back.
+    function later(fn) {
+        return function(err) {
+            if (err) throw err;
+            setImmediate(fn);
+        };
+    }
+
+    it('should capture old and new values once the transaction commits', function(done) {
+        var events = [];
+        db.on('preupdate', function(changes) { events.push(changes); });
+        db.exec("BEGIN;" +
+                "INSERT INTO foo (txt, num, data) VALUES ('a', 1.5, x'0102');" +
+                "UPDATE foo SET txt = 'b', id = 5 WHERE id = 1;" +
+                "DELETE FROM foo WHERE id = 5;" +
+                "COMMIT", later(function() {
+            assert.equal(events.length, 1);
+            var changes = events[0];
+            assert.equal(changes.length, 3);
+
+            assert.equal(changes[0].type, 'insert');
+            assert.equal(changes[0].table, 'foo');
+            assert.equal(changes[0].newRowid, 1);
+            assert.strictEqual(changes[0].old, undefined);
+            assert.deepEqual(changes[0].new, [1, 'a', 1.5, Buffer.from([1, 2])]);
+
+            assert.equal(changes[1].type, 'update');
+            assert.equal(changes[1].oldRowid, 1);
+            assert.equal(changes[1].newRowid, 5);
+            assert.deepEqual(changes[1].old, [1, 'a', 1.5, Buffer.from([1, 2])]);
+            assert.deepEqual(changes[1].new, [5, 'b', 1.5, Buffer.from([1, 2])]);
+
+            assert.equal(changes[2].type, 'delete');
+            assert.equal(changes[2].oldRowid, 5);
+            assert.deepEqual(changes[2].old, [5, 'b', 1.5, Buffer.from([1, 2])]);
+            assert.strictEqual(changes[2].new, undefined);
+            done();
+        }));
+    });
+
+    it('should drop the changes of a rolled back transaction', function(done) {
+        var events = [];
+        db.on('preupdate', function(changes) { events.push(changes); });
+        db.exec("BEGIN; INSERT INTO foo (txt) VALUES ('a'); ROLLBACK;" +
+                "INSERT INTO bar (txt) VALUES (NULL)", later(function() {
+            assert.equal(events.length, 1);
+            assert.equal(events[0].length, 1);
+            assert.equal(events[0][0].table, 'bar');
+            assert.deepEqual(events[0][0].new, [1, null]);
+            done();
+        }));
+    });
+
+    describe('with a failed commit', function() {
+        var file, reader;
+        beforeEach(function(done) {
+            helper.ensureExists('test/tmp');
+            helper.deleteFile('test/tmp/preupdate_commit.db');
+            file = new sqlite3.Database('test/tmp/preupdate_commit.db');
+            file.configure('busyTimeout', 0);
+            file.exec("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT)", function(err) {
+                if (err) return done(err);
+                reader = new sqlite3.Database('test/tmp/preupdate_commit.db');
+                // The reader's shared lock keeps COMMIT from getting the
+                // exclusive lock it needs.
+                reader.exec("BEGIN; SELECT * FROM foo", done);
+            });
+        });
+        afterEach(function(done) {
+            reader.close(function() {
+                file.close(done);
+            });
+        });
+
+        function failCommit(events, callback) {
+            file.on('preupdate', function(changes) { events.push(changes); });
+            file.exec("BEGIN; INSERT INTO foo (txt) VALUES ('a')", function(err) {
+                if (err) throw err;
+                file.exec("COMMIT", function(err) {
+                    assert.ok(err);
+                    assert.equal(err.code, 'SQLITE_BUSY');
+                    setImmediate(callback);
+                });
+            });
+        }
+
+        it('should not report changes that are rolled back after all', function(done) {
+            var events = [];
+            failCommit(events, function() {
+                assert.equal(events.length, 0);
+                file.exec("ROLLBACK", later(function() {
+                    assert.equal(events.length, 0);
+                    done();
+                }));
+            });
+        });
+
+        it('should report changes once the commit goes through', function(done) {
+            var events = [];
+            failCommit(events, function() {
+                assert.equal(events.length, 0);
+                reader.exec("COMMIT", function(err) {
+                    if (err) throw err;
+                    file.exec("COMMIT", later(function() {
+                        assert.equal(events.length, 1);
+                        assert.equal(events[0].length, 1);
+                        assert.equal(events[0][0].type, 'insert');
+                        assert.deepEqual(events[0][0].new, [1, 'a']);
+                        done();
+                    }));
+                });
+            });
+        });
+    });
+
+    it('should only capture the tables asked for', function(done) {
+        var events = [];
+        db.configure('changesTables', ['bar']);
+        db.on('preupdate', function(changes) { events.push(changes); });
+        db.exec("INSERT INTO foo (txt) VALUES ('a'); INSERT INTO bar (txt) VALUES ('b')", later(function() {
+            assert.equal(events.length, 1);
+            assert.equal(events[0][0].table, 'bar');
+            done();
+        }));
+    });
+
+    it('should leave out rows of a failed transaction operation', function(done) {
+        var events = [];
+        db.exec("INSERT INTO bar (id, txt) VALUES (5, 'e')", function(err) {
+            if (err) throw err;
+            db.on('preupdate', function(changes) { events.push(changes); });
+            db.transaction([
+                "INSERT INTO bar (id, txt) VALUES (2, 'b')",
+                "INSERT INTO foo (id, txt) VALUES (3, 'c')",
+                "INSERT INTO bar (id, txt) VALUES (4, 'd'), (5, 'dup')"
+            ], { isolate: true }, later(function() {
+                assert.equal(events.length, 1);
+                assert.deepEqual(events[0].map(function(change) {
+                    return [change.table, change.newRowid];
+                }), [['bar', 2], ['foo', 3]]);
+                done();
+            }));
+        });
+    });
+});
@@ -0,0 +1,141 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('promises', function() {
+    var db;
+    beforeEach(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.exec("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT);" +
+            "INSERT INTO foo (txt) VALUES ('a'), ('b')", done);
+    });
+    afterEach(function(done) {
+        db.close(done);
+    });
+
+    it('should run statements', function() {
+        var stmt = db.prepare("INSERT INTO foo (txt) VALUES (?)");
+        return Promise.all([stmt.runAsync('c'), stmt.runAsync('d')]).then(function(results) {
+            assert.deepEqual(results, [
+                { lastID: 3, changes: 1 },
+                { lastID: 4, changes: 1 }
+            ]);
+            stmt.finalize();
+        });
+    });
+
+    it('should get rows', function() {
+        var stmt = db.prepare("SELECT txt FROM foo WHERE id = ?");
+        return stmt.getAsync(2).then(function(row) {
+            assert.deepEqual(row, { txt: 'b' });
+            return stmt.getAsync(5);
+        }).then(function(row) {
+            assert.strictEqual(row, undefined);
+            stmt.finalize();
+        });
+    });
+
+    it('should get all rows', function() {
+        return db.allAsync("SELECT id, txt FROM foo WHERE id > ? ORDER BY id", 0).then(function(rows) {
+            assert.deepEqual(rows, [
+                { id: 1, txt: 'a' },
+                { id: 2, txt: 'b' }
+            ]);
+            return db.allAsync("SELECT * FROM foo WHERE id > 2");
+        }).then(function(rows) {
+            assert.deepEqual(rows, []);
+        });
+    });
+
+    it('should exec statements', function() {
+        return db.execAsync("DELETE FROM foo").then(function(result) {
+            assert.strictEqual(result, undefined);
+            return db.getAsync("SELECT COUNT(*) AS count FROM foo");
+        }).then(function(row) {
+            assert.equal(row.count, 0);
+        });
+    });
+
+    it('should reject with errors', function() {
+        return db.runAsync("INSERT INTO foo (id, txt) VALUES (1, 'x')").then(function() {
+            assert.fail('should have been rejected');
+        }, function(err) {
+            assert.equal(err.code, 'SQLITE_CONSTRAINT');
+            return db.execAsync("INSERT INTO nonexistent VALUES (1)");
+        }).then(function() {
+            assert.fail('should have been rejected');
+        }, function(err) {
+            assert.equal(err.code, 'SQLITE_ERROR');
+            assert.ok(/no such table: nonexistent/.test(err.message));
+        });
+    });
+
+    it('should reject when preparing fails', function() {
+        return db.getAsync("SELECT * FROM nonexistent").then(function() {
+            assert.fail('should have been rejected');
+        }, function(err) {
+            assert.equal(err.code, 'SQLITE_ERROR');
+            assert.ok(/no such table: nonexistent/.test(err.message));
+        });
+    });
+
+    it('should reject cancelled calls', function() {
+        var cancellation = new sqlite3.Cancellation();
+        cancellation.cancel();
+        return db.allAsync("SELECT * FROM foo", cancellation).then(function() {
+            assert.fail('should have been rejected');
+        }, function(err) {
+            assert.equal(err.code, 'SQLITE_INTERRUPT');
+        });
+    });
+
+    it('should reject calls on a finalized statement', function(done) {
+        var stmt = db.prepare("SELECT 1");
+        stmt.finalize(function() {
+            stmt.getAsync().then(function() {
+                done(new Error('should have been rejected'));
+            }, function(err) {
+                assert.equal(err.code, 'SQLITE_MISUSE');
+                done();
+            });
+        });
+    });
+
+    // Without anything else going on in the event loop, each reaction has
+    // to run as soon as its promise is settled.
+    function sequential(database, done) {
+        var stmt = database.prepare("SELECT txt FROM foo WHERE id = ?");
+        var remaining = 20;
+        var timer = setTimeout(function() {
+            done(new Error('promise reactions were held back'));
+        }, 1000);
+        function next() {
+            return stmt.getAsync(remaining % 2 + 1).then(function(row) {
+                assert.equal(row.txt, remaining % 2 ? 'b' : 'a');
+                if (--remaining) return next();
+            });
+        }
+        next().then(function() {
+            clearTimeout(timer);
+            stmt.finalize(done);
+        }, done);
+    }
+
+    it('should settle promises right away with a dedicated thread', function(done) {
+        var dedicated = new sqlite3.Database(':memory:', { dedicatedThread: true }, function(err) {
+            if (err) return done(err);
+            dedicated.exec("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT);" +
+                "INSERT INTO foo (txt) VALUES ('a'), ('b')", function(err) {
+                if (err) return done(err);
+                sequential(dedicated, function(err) {
+                    if (err) return done(err);
+                    dedicated.close(done);
+                });
+            });
+        });
+    });
+
+    it('should settle promises right away when running inline', function(done) {
+        db.configure('inlineThreshold', 1000000);
+        sequential(db, done);
+    });
+});
@@ -0,0 +1,99 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('result limits', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.serialize(function() {
+            db.run("CREATE TABLE foo (id INT, txt TEXT)");
+            var stmt = db.prepare("INSERT INTO foo VALUES(?, ?)");
+            for (var i = 0; i < 100; i++) {
+                stmt.run(i, new Array(101).join('x'));
+            }
+            stmt.finalize(done);
+        });
+    });
+
+    afterEach(function() {
+        db.configure('maxRows', 0);
+        db.configure('maxBytes', 0);
+    });
+
+    it('should reject invalid values', function() {
+        assert.throws(function() {
+            db.configure('maxRows', 'ten');
+        }, /Value must be a non-negative integer/);
+        assert.throws(function() {
+            db.configure('maxBytes', -1);
+        }, /Value must be a non-negative integer/);
+        [NaN, 1.5, Infinity, Math.pow(2, 53)].forEach(function(value) {
+            assert.throws(function() {
+                db.configure('maxRows', value);
+            }, /Value must be a non-negative integer/);
+            assert.throws(function() {
+                db.configure('maxBytes', value);
+            }, /Value must be a non-negative integer/);
+        });
+    });
+
+    it('should allow results up to maxRows', function(done) {
+        db.configure('maxRows', 100);
+        db.all("SELECT * FROM foo", function(err, rows) {
+            if (err) throw err;
+            assert.equal(rows.length, 100);
+            done();
+        });
+    });
+
+    ['all', 'allMarshal', 'allJSON', 'allNDJSON'].forEach(function(method) {
+        it(method + ' should fail when exceeding maxRows', function(done) {
+            db.configure('maxRows', 10);
+            db[method]("SELECT * FROM foo", function(err, result) {
+                assert.ok(err);
+                assert.equal(err.code, 'SQLITE_TOOBIG');
+                assert.equal(err.message, 'SQLITE_TOOBIG: Result exceeds maxRows limit of 10');
+                assert.equal(result, undefined);
+                done();
+            });
+        });
+
+        it(method + ' should fail when exceeding maxBytes', function(done) {
+            db.configure('maxBytes', 2000);
+            db[method]("SELECT * FROM foo", function(err) {
+                assert.ok(err);
+                assert.equal(err.code, 'SQLITE_TOOBIG');
+                assert.equal(err.message, 'SQLITE_TOOBIG: Result exceeds maxBytes limit of 2000');
+                done();
+            });
+        });
+    });
+
+    it('should not affect each', function(done) {
+        db.configure('maxRows', 10);
+        var count = 0;
+        db.each("SELECT * FROM foo", function(err) {
+            if (err) throw err;
+            count++;
+        }, function(err, num) {
+            if (err) throw err;
+            assert.equal(num, 100);
+            assert.equal(count, 100);
+            done();
+        });
+    });
+
+    it('should leave the statement usable after a limit error', function(done) {
+        var stmt = db.prepare("SELECT * FROM foo");
+        db.configure('maxRows', 10);
+        stmt.all(function(err) {
+            assert.equal(err.code, 'SQLITE_TOOBIG');
+            db.configure('maxRows', 0);
+            stmt.all(function(err, rows) {
+                if (err) throw err;
+                assert.equal(rows.length, 100);
+                stmt.finalize(done);
+            });
+        });
+    });
+});
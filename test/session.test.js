@@ -0,0 +1,145 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('sessions', function() {
+    var db, replica;
+    before(function() {
+        if (!sqlite3.Session) this.skip();
+    });
+    beforeEach(function(done) {
+        var schema = "CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT);" +
+            "CREATE TABLE bar (id INTEGER PRIMARY KEY, txt TEXT)";
+        db = new sqlite3.Database(':memory:');
+        replica = new sqlite3.Database(':memory:');
+        db.exec(schema, function(err) {
+            if (err) return done(err);
+            replica.exec(schema, done);
+        });
+    });
+    afterEach(function(done) {
+        db.close(function() {
+            replica.close(done);
+        });
+    });
+
+    it('should replicate changes with a changeset', function(done) {
+        var session = db.session();
+        db.exec("INSERT INTO foo (txt) VALUES ('a'), ('b'); INSERT INTO bar (txt) VALUES ('c');" +
+                "UPDATE foo SET txt = 'x' WHERE id = 1; DELETE FROM foo WHERE id = 2");
+        session.changeset(function(err, changeset) {
+            if (err) throw err;
+            assert.ok(Buffer.isBuffer(changeset));
+            assert.ok(changeset.length > 0);
+            replica.applyChangeset(changeset, function(err, conflicts) {
+                if (err) throw err;
+                assert.equal(conflicts, 0);
+                replica.all("SELECT 'foo' AS t, * FROM foo UNION ALL SELECT 'bar', * FROM bar", function(err, rows) {
+                    if (err) throw err;
+                    assert.deepEqual(rows, [
+                        { t: 'foo', id: 1, txt: 'x' },
+                        { t: 'bar', id: 1, txt: 'c' }
+                    ]);
+                    session.close(done);
+                });
+            });
+        });
+    });
+
+    it('should only record the tables asked for', function(done) {
+        var session = db.session(['bar']);
+        db.exec("INSERT INTO foo (txt) VALUES ('a'); INSERT INTO bar (txt) VALUES ('b')");
+        session.patchset(function(err, patchset) {
+            if (err) throw err;
+            replica.applyChangeset(patchset, function(err) {
+                if (err) throw err;
+                replica.get("SELECT (SELECT COUNT(*) FROM foo) AS foo, (SELECT COUNT(*) FROM bar) AS bar", function(err, row) {
+                    if (err) throw err;
+                    assert.deepEqual(row, { foo: 0, bar: 1 });
+                    done();
+                });
+            });
+        });
+    });
+
+    it('should return an empty changeset without changes', function(done) {
+        db.session().changeset(function(err, changeset) {
+            if (err) throw err;
+            assert.equal(changeset.length, 0);
+            done();
+        });
+    });
+
+    describe('conflicts', function() {
+        var changeset;
+        beforeEach(function(done) {
+            var session = db.session();
+            db.run("INSERT INTO foo (id, txt) VALUES (1, 'new')");
+            session.changeset(function(err, result) {
+                if (err) return done(err);
+                changeset = result;
+                replica.run("INSERT INTO foo (id, txt) VALUES (1, 'old')", done);
+            });
+        });
+
+        function check(txt, done) {
+            return function(err) {
+                if (err) throw err;
+                replica.get("SELECT txt FROM foo WHERE id = 1", function(err, row) {
+                    if (err) throw err;
+                    assert.equal(row.txt, txt);
+                    done();
+                });
+            };
+        }
+
+        it('should abort by default', function(done) {
+            replica.applyChangeset(changeset, function(err) {
+                assert.ok(err);
+                assert.equal(err.code, 'SQLITE_ABORT');
+                assert.ok(/conflict conflict/.test(err.message));
+                check('old', done)();
+            });
+        });
+
+        it('should omit conflicting changes', function(done) {
+            replica.applyChangeset(changeset, 'omit', function(err, conflicts) {
+                assert.equal(conflicts, 1);
+                check('old', done)(err);
+            });
+        });
+
+        it('should replace conflicting rows', function(done) {
+            replica.applyChangeset(changeset, { conflict: 'replace' }, check('new', done));
+        });
+
+        it('should reject unknown actions', function() {
+            assert.throws(function() {
+                replica.applyChangeset(changeset, 'ignore');
+            }, /Conflict action must be/);
+        });
+    });
+
+    it('should fail after the session is closed', function(done) {
+        var session = db.session();
+        session.close(function(err) {
+            if (err) throw err;
+            assert.ok(session.closed);
+            session.changeset(function(err) {
+                assert.equal(err.code, 'SQLITE_MISUSE');
+                done();
+            });
+        });
+    });
+
+    it('should be closed along with its database', function(done) {
+        var other = new sqlite3.Database(':memory:');
+        var session = other.session(function(err) {
+            if (err) throw err;
+            other.close(function(err) {
+                if (err) throw err;
+                assert.ok(session.closed);
+                done();
+            });
+        });
+    });
+});
@@ -0,0 +1,75 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('snapshot', function() {
+    var db, other;
+    before(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile('test/tmp/snapshot.db');
+        helper.deleteFile('test/tmp/snapshot.db-wal');
+        helper.deleteFile('test/tmp/snapshot.db-shm');
+        db = new sqlite3.Database('test/tmp/snapshot.db');
+        db.serialize(function() {
+            db.run("PRAGMA journal_mode = WAL");
+            db.run("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT)");
+            db.run("INSERT INTO foo (txt) VALUES ('a')", function(err) {
+                if (err) throw err;
+                other = new sqlite3.Database('test/tmp/snapshot.db', done);
+            });
+        });
+    });
+    after(function(done) {
+        other.close(function() {
+            db.close(done);
+        });
+    });
+
+    it('should let another connection read an earlier version', function(done) {
+        db.snapshot(function(err, snapshot) {
+            if (err) throw err;
+            db.run("INSERT INTO foo (txt) VALUES ('b')", function(err) {
+                if (err) throw err;
+                other.openSnapshot(snapshot, function(err) {
+                    if (err) throw err;
+                    assert.ok(other.inTransaction);
+                    other.get("SELECT COUNT(*) AS count FROM foo", function(err, row) {
+                        if (err) throw err;
+                        assert.equal(row.count, 1);
+                        other.exec("COMMIT", function(err) {
+                            if (err) throw err;
+                            other.get("SELECT COUNT(*) AS count FROM foo", function(err, row) {
+                                if (err) throw err;
+                                assert.equal(row.count, 2);
+                                done();
+                            });
+                        });
+                    });
+                });
+            });
+        });
+    });
+
+    it('should hold on to the snapshot while it is opened', function(done) {
+        db.snapshot(function(err, snapshot) {
+            if (err) throw err;
+            // Nothing else refers to the snapshot once openSnapshot() is called.
+            other.openSnapshot(snapshot, function(err) {
+                if (err) throw err;
+                other.get("SELECT COUNT(*) AS count FROM foo", function(err, row) {
+                    if (err) throw err;
+                    assert.ok(row.count > 0);
+                    other.exec("COMMIT", done);
+                });
+            });
+            snapshot = null;
+            if (global.gc) global.gc();
+        });
+    });
+
+    it('should reject values that are not snapshots', function() {
+        assert.throws(function() {
+            other.openSnapshot({});
+        }, /Snapshot expected/);
+    });
+});
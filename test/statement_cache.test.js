@@ -0,0 +1,115 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('statement cache', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.configure('statementCache', 2);
+        db.serialize(function() {
+            db.run("CREATE TABLE foo (id INT, txt TEXT)");
+            for (var i = 0; i < 10; i++) {
+                db.run("INSERT INTO foo VALUES(?, ?)", i, 'row ' + i);
+            }
+            db.wait(done);
+        });
+    });
+
+    it('should reject invalid sizes', function() {
+        assert.throws(function() {
+            db.configure('statementCache', 'big');
+        }, /Value must be a non-negative integer/);
+    });
+
+    it('should reuse idle statements', function(done) {
+        db.get("SELECT txt FROM foo WHERE id = ?", 3, function(err, row) {
+            if (err) throw err;
+            assert.equal(row.txt, 'row 3');
+            var first = this;
+            db.get("SELECT txt FROM foo WHERE id = ?", 4, function(err, row) {
+                if (err) throw err;
+                assert.equal(row.txt, 'row 4');
+                assert.strictEqual(this, first);
+                done();
+            });
+        });
+    });
+
+    it('should use a fresh statement when the cached one is busy', function(done) {
+        var sql = "SELECT count(*) AS count FROM foo";
+        var statements = [];
+        var remaining = 3;
+        for (var i = 0; i < 3; i++) {
+            db.get(sql, function(err, row) {
+                if (err) throw err;
+                assert.equal(row.count, 10);
+                statements.push(this);
+                if (--remaining === 0) {
+                    assert.notStrictEqual(statements[0], statements[1]);
+                    done();
+                }
+            });
+        }
+    });
+
+    it('should start get from the first row every time', function(done) {
+        var sql = "SELECT id FROM foo ORDER BY id";
+        db.get(sql, function(err, row) {
+            if (err) throw err;
+            assert.equal(row.id, 0);
+            db.get(sql, function(err, row) {
+                if (err) throw err;
+                assert.equal(row.id, 0);
+                done();
+            });
+        });
+    });
+
+    it('should not reuse bindings from an earlier call', function(done) {
+        var sql = "SELECT ? AS value";
+        db.get(sql, 5, function(err, row) {
+            if (err) throw err;
+            assert.equal(row.value, 5);
+            db.get(sql, function(err, row) {
+                if (err) throw err;
+                assert.equal(row.value, null);
+                done();
+            });
+        });
+    });
+
+    it('should work with each', function(done) {
+        var sql = "SELECT id FROM foo";
+        var rows = 0;
+        db.each(sql, function(err) {
+            if (err) throw err;
+            rows++;
+        }, function(err, count) {
+            if (err) throw err;
+            assert.equal(count, 10);
+            db.each(sql, function(err) {
+                if (err) throw err;
+                rows++;
+            }, function(err, count) {
+                if (err) throw err;
+                assert.equal(rows, 20);
+                done();
+            });
+        });
+    });
+
+    it('should report prepare errors', function(done) {
+        db.all("SELECT * FROM missing", function(err) {
+            assert.ok(err);
+            assert.equal(err.code, 'SQLITE_ERROR');
+            done();
+        });
+    });
+
+    it('should finalize cached statements on close', function(done) {
+        db.all("SELECT * FROM foo", function(err) {
+            if (err) throw err;
+        });
+        db.close(done);
+    });
+});
@@ -0,0 +1,91 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('synchronous calls', function() {
+    var db;
+    beforeEach(function(done) {
+        db = new sqlite3.Database(':memory:', function(err) {
+            if (err) return done(err);
+            db.execSync("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT);" +
+                "INSERT INTO foo (txt) VALUES ('a'), ('b')");
+            done();
+        });
+    });
+    afterEach(function(done) {
+        db.close(done);
+    });
+
+    it('should run statements', function(done) {
+        var stmt = db.prepareSync("INSERT INTO foo (txt) VALUES (?)");
+        assert.equal(stmt.runSync('c'), stmt);
+        assert.equal(stmt.lastID, 3);
+        assert.equal(stmt.changes, 1);
+        stmt.finalize(done);
+    });
+
+    it('should get rows', function(done) {
+        var stmt = db.prepareSync("SELECT txt FROM foo WHERE id = ?");
+        assert.deepEqual(stmt.getSync(2), { txt: 'b' });
+        assert.strictEqual(stmt.getSync(5), undefined);
+        stmt.finalize(done);
+    });
+
+    it('should get all rows', function(done) {
+        var stmt = db.prepareSync("SELECT id, txt FROM foo ORDER BY id");
+        assert.deepEqual(stmt.allSync(), [
+            { id: 1, txt: 'a' },
+            { id: 2, txt: 'b' }
+        ]);
+        stmt.finalize(done);
+    });
+
+    it('should mix with asynchronous calls', function(done) {
+        var stmt = db.prepareSync("SELECT COUNT(*) AS count FROM foo");
+        db.run("INSERT INTO foo (txt) VALUES ('c')", function(err) {
+            if (err) throw err;
+            assert.deepEqual(stmt.getSync(), { count: 3 });
+            stmt.get(function(err, row) {
+                if (err) throw err;
+                assert.deepEqual(row, { count: 3 });
+                stmt.finalize(done);
+            });
+        });
+    });
+
+    it('should throw errors', function(done) {
+        assert.throws(function() {
+            db.execSync("INSERT INTO nonexistent VALUES (1)");
+        }, function(err) {
+            return err.code === 'SQLITE_ERROR' && /no such table: nonexistent/.test(err.message);
+        });
+        assert.throws(function() {
+            db.prepareSync("SELECT * FROM nonexistent");
+        }, /no such table: nonexistent/);
+        var stmt = db.prepareSync("INSERT INTO foo (id, txt) VALUES (?, 'x')");
+        assert.throws(function() {
+            stmt.runSync(1);
+        }, function(err) {
+            return err.code === 'SQLITE_CONSTRAINT';
+        });
+        stmt.finalize(done);
+    });
+
+    it('should refuse to run while the database is busy', function(done) {
+        db.run("INSERT INTO foo (txt) VALUES ('c')", done);
+        assert.throws(function() {
+            db.execSync("DELETE FROM foo");
+        }, function(err) {
+            return err.code === 'SQLITE_BUSY' && /Database is busy/.test(err.message);
+        });
+    });
+
+    it('should refuse finalized statements', function(done) {
+        var stmt = db.prepareSync("SELECT 1");
+        stmt.finalize(function() {
+            assert.throws(function() {
+                stmt.getSync();
+            }, /Statement is already finalized/);
+            done();
+        });
+    });
+});
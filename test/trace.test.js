@@ -64,4 +64,46 @@ describe('tracing', function() {
         db.run("CREATE TABLE foo (id int)");
         db.close(done);
     });
+
+    it('should deliver many events in order', function(done) {
+        var db = new sqlite3.Database(':memory:');
+        var ids = [];
+        db.on('trace', function(sql) {
+            var match = sql.match(/^SELECT (\d+)$/);
+            if (match) ids.push(Number(match[1]));
+        });
+
+        db.serialize(function() {
+            for (var i = 0; i < 2000; i++) {
+                db.run("SELECT " + i);
+            }
+        });
+
+        db.close(function(err) {
+            if (err) throw err;
+            assert.equal(ids.length, 2000);
+            for (var i = 0; i < ids.length; i++) {
+                assert.equal(ids[i], i);
+            }
+            done();
+        });
+    });
+
+    it('should deliver events of statements run on the main thread', function(done) {
+        var db = new sqlite3.Database(':memory:', function(err) {
+            if (err) throw err;
+            var count = 0;
+            db.on('trace', function() { count++; });
+            var sql = [];
+            for (var i = 0; i < 2000; i++) {
+                sql.push("SELECT " + i);
+            }
+            db.execSync(sql.join(';'));
+            db.close(function(err) {
+                if (err) throw err;
+                assert.equal(count, 2000);
+                done();
+            });
+        });
+    });
 });
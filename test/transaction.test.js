@@ -0,0 +1,107 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('transaction', function() {
+    var db;
+    beforeEach(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.run("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT UNIQUE)", done);
+    });
+    afterEach(function(done) {
+        db.close(done);
+    });
+
+    it('should run all operations and return their results', function(done) {
+        db.transaction([
+            "INSERT INTO foo (txt) VALUES ('a')",
+            { sql: "INSERT INTO foo (txt) VALUES (?)", params: ['b'] },
+            { sql: "INSERT INTO foo (txt) VALUES ($txt)", params: { $txt: 'c' } },
+            { sql: "UPDATE foo SET txt = txt || ? WHERE id > 1", params: '!' },
+            { sql: "SELECT id, txt FROM foo ORDER BY id" }
+        ], function(err, results) {
+            if (err) throw err;
+            assert.equal(results.length, 5);
+            assert.equal(results[0].lastID, 1);
+            assert.equal(results[1].lastID, 2);
+            assert.equal(results[2].lastID, 3);
+            assert.equal(results[3].changes, 2);
+            assert.equal(results[3].rows, undefined);
+            assert.deepEqual(results[4].rows, [
+                { id: 1, txt: 'a' },
+                { id: 2, txt: 'b!' },
+                { id: 3, txt: 'c!' }
+            ]);
+            assert.ok(!db.inTransaction);
+            done();
+        });
+    });
+
+    it('should roll back every operation on error', function(done) {
+        db.transaction([
+            "INSERT INTO foo (txt) VALUES ('a')",
+            "INSERT INTO foo (txt) VALUES ('b')",
+            "INSERT INTO foo (txt) VALUES ('a')",
+            "INSERT INTO foo (txt) VALUES ('c')"
+        ], function(err, results) {
+            assert.ok(err);
+            assert.equal(err.code, 'SQLITE_CONSTRAINT');
+            assert.equal(err.index, 2);
+            assert.equal(results, undefined);
+            assert.ok(!db.inTransaction);
+            db.get("SELECT COUNT(*) AS count FROM foo", function(err, row) {
+                if (err) throw err;
+                assert.equal(row.count, 0);
+                done();
+            });
+        });
+    });
+
+    it('should accept prepared statements', function(done) {
+        var stmt = new sqlite3.Statement(db, "INSERT INTO foo (txt) VALUES (?)", function(err) {
+            if (err) throw err;
+            db.transaction([
+                { statement: stmt, params: ['x'] },
+                { statement: stmt, params: ['y'] }
+            ], function(err, results) {
+                if (err) throw err;
+                assert.deepEqual(results.map(function(r) { return r.lastID; }), [1, 2]);
+                // The statement is usable again afterwards.
+                stmt.run('z', function(err) {
+                    if (err) throw err;
+                    assert.equal(this.lastID, 3);
+                    stmt.finalize(done);
+                });
+            });
+        });
+    });
+
+    it('should use a savepoint inside an open transaction', function(done) {
+        db.serialize(function() {
+            db.run("BEGIN");
+            db.run("INSERT INTO foo (txt) VALUES ('outer')");
+            db.transaction([
+                "INSERT INTO foo (txt) VALUES ('inner')",
+                "INSERT INTO foo (txt) VALUES ('outer')"
+            ], function(err) {
+                assert.ok(err);
+                assert.equal(err.index, 1);
+                assert.ok(db.inTransaction);
+            });
+            db.run("COMMIT");
+            db.all("SELECT txt FROM foo", function(err, rows) {
+                if (err) throw err;
+                assert.deepEqual(rows, [{ txt: 'outer' }]);
+                done();
+            });
+        });
+    });
+
+    it('should report invalid operations synchronously', function() {
+        assert.throws(function() {
+            db.transaction("INSERT INTO foo (txt) VALUES ('a')");
+        }, /Array of operations expected/);
+        assert.throws(function() {
+            db.transaction([{ params: [1] }]);
+        }, /Operation must have SQL or a statement/);
+    });
+});
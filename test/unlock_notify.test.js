@@ -0,0 +1,113 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('shared cache unlock notify', function() {
+    var mode = sqlite3.OPEN_READWRITE | sqlite3.OPEN_CREATE | sqlite3.OPEN_SHAREDCACHE;
+    var writer, reader;
+    beforeEach(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile('test/tmp/unlock_notify.db');
+        writer = new sqlite3.Database('test/tmp/unlock_notify.db', mode);
+        writer.run("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT)", function(err) {
+            if (err) throw err;
+            reader = new sqlite3.Database('test/tmp/unlock_notify.db', mode, done);
+        });
+    });
+    afterEach(function(done) {
+        reader.close(function() {
+            writer.close(done);
+        });
+    });
+
+    it('should wait for the writer to commit', function(done) {
+        writer.exec("BEGIN; INSERT INTO foo (txt) VALUES ('a')", function(err) {
+            if (err) throw err;
+            var committed = false;
+            reader.all("SELECT txt FROM foo", function(err, rows) {
+                if (err) throw err;
+                assert.ok(committed);
+                assert.deepEqual(rows, [{ txt: 'a' }]);
+                done();
+            });
+            setTimeout(function() {
+                committed = true;
+                writer.exec("COMMIT");
+            }, 50);
+        });
+    });
+
+    it('should go on with exec() from the statement that had to wait', function(done) {
+        writer.exec("BEGIN; INSERT INTO foo (txt) VALUES ('a')", function(err) {
+            if (err) throw err;
+            // Running the whole script again would fail to create the table.
+            reader.exec("CREATE TEMP TABLE copy (txt TEXT);" +
+                        "INSERT INTO copy SELECT txt FROM foo", function(err) {
+                if (err) throw err;
+                reader.all("SELECT txt FROM copy", function(err, rows) {
+                    if (err) throw err;
+                    assert.deepEqual(rows, [{ txt: 'a' }]);
+                    done();
+                });
+            });
+            setTimeout(function() {
+                writer.exec("COMMIT");
+            }, 50);
+        });
+    });
+
+    it('should wait to prepare while the schema is being changed', function(done) {
+        writer.exec("BEGIN; CREATE TABLE bar (id INTEGER PRIMARY KEY)", function(err) {
+            if (err) throw err;
+            var committed = false;
+            var statement = reader.prepare("SELECT * FROM bar", function(err) {
+                if (err) throw err;
+                assert.ok(committed);
+                statement.finalize(done);
+            });
+            setTimeout(function() {
+                committed = true;
+                writer.exec("COMMIT");
+            }, 50);
+        });
+    });
+
+    it('should wait for allJSON() and allMarshal()', function(done) {
+        writer.exec("BEGIN; INSERT INTO foo (txt) VALUES ('a')", function(err) {
+            if (err) throw err;
+            var remaining = 2;
+            reader.allJSON("SELECT txt FROM foo", function(err, json) {
+                if (err) throw err;
+                assert.deepEqual(JSON.parse(json), [{ txt: 'a' }]);
+                if (!--remaining) done();
+            });
+            reader.allMarshal("SELECT txt FROM foo", function(err, result) {
+                if (err) throw err;
+                assert.ok(Buffer.isBuffer(result));
+                if (!--remaining) done();
+            });
+            setTimeout(function() {
+                writer.exec("COMMIT");
+            }, 50);
+        });
+    });
+
+    it('should wake up every waiting statement', function(done) {
+        writer.exec("BEGIN; INSERT INTO foo (txt) VALUES ('a')", function(err) {
+            if (err) throw err;
+            var remaining = 3;
+            reader.parallelize(function() {
+                for (var i = 0; i < 3; i++) {
+                    reader.get("SELECT COUNT(*) AS count FROM foo", function(err, row) {
+                        if (err) throw err;
+                        assert.equal(row.count, 1);
+                        if (!--remaining) done();
+                    });
+                }
+            });
+            setTimeout(function() {
+                writer.exec("COMMIT");
+            }, 50);
+        });
+    });
+});
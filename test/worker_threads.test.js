@@ -0,0 +1,82 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var path = require('path');
+
+var workerThreads;
+try {
+    workerThreads = require('worker_threads');
+} catch (err) {}
+
+// Each worker opens its own in-memory database, sums a series there and
+// sends back the result.
+var script = [
+    "var sqlite3 = require(" + JSON.stringify(path.resolve(__dirname, '..')) + ");",
+    "var workerData = require('worker_threads').workerData;",
+    "var parentPort = require('worker_threads').parentPort;",
+    "var db = new sqlite3.Database(':memory:');",
+    "db.get('WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < ?) ' +",
+    "       'SELECT sum(x) AS total FROM c', workerData.count, function(err, row) {",
+    "    if (err) throw err;",
+    "    db.close(function() {",
+    "        parentPort.postMessage(row.total);",
+    "    });",
+    "});"
+].join('\n');
+
+describe('worker threads', function() {
+    before(function() {
+        // Builds for older Node-API versions share one set of state between
+        // threads, whatever version the running Node supports.
+        if (!workerThreads || !(sqlite3.NAPI_VERSION >= 6)) this.skip();
+    });
+
+    function run(count, callback) {
+        var worker = new workerThreads.Worker(script, {
+            eval: true,
+            workerData: { count: count }
+        });
+        worker.once('message', function(total) { callback(null, total); });
+        worker.once('error', callback);
+    }
+
+    it('should open databases in several workers at once', function(done) {
+        var counts = [10, 100, 1000, 10000];
+        var remaining = counts.length;
+        counts.forEach(function(count) {
+            run(count, function(err, total) {
+                if (err) return done(err);
+                assert.equal(total, count * (count + 1) / 2);
+                if (--remaining === 0) done();
+            });
+        });
+    });
+
+    it('should keep working on the main thread', function(done) {
+        var db = new sqlite3.Database(':memory:');
+        run(100, function(err, total) {
+            if (err) return done(err);
+            assert.equal(total, 5050);
+            db.get("SELECT 1 AS one", function(err, row) {
+                if (err) return done(err);
+                assert.equal(row.one, 1);
+                db.close(done);
+            });
+        });
+    });
+
+    it('should clean up when a worker exits with a query running', function(done) {
+        var worker = new workerThreads.Worker([
+            "var sqlite3 = require(" + JSON.stringify(path.resolve(__dirname, '..')) + ");",
+            "var db = new sqlite3.Database(':memory:', function() {",
+            "    db.get('WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) ' +",
+            "           'SELECT count(*) FROM c', function() {});",
+            "    require('worker_threads').parentPort.postMessage('running');",
+            "});"
+        ].join('\n'), { eval: true });
+        worker.once('message', function() {
+            worker.terminate();
+        });
+        worker.once('exit', function() { done(); });
+        worker.once('error', done);
+    });
+});